@@ -6,11 +6,5 @@ if [ "$#" -ne 1 ]; then
     exit 1
 fi
 
-# create temporary file in /tmp
-tmpfile=$(mktemp /tmp/playvoc.XXXXXX)
-
-# install handler to remove temporary file on exit
-trap "rm -f $tmpfile" EXIT
-
-build/voctool -i $1 -o $tmpfile
-mplayer $tmpfile
+# the decoded file is piped into the player, messages of voctool go to stderr
+build/voctool -i "$1" -o - | mplayer -
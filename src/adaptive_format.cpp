@@ -0,0 +1,108 @@
+#include "adaptive_format.h"
+#include "compare_audio.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <span>
+
+std::vector<VocBlock> createAdaptiveBlocks(
+    const std::vector<uint8_t>& raw,
+    size_t blockLength,
+    double maxError,
+    uint32_t sampleRate,
+    const FormatEncoder& encode)
+{
+    if (blockLength == 0)
+    {
+        throw std::runtime_error("Block length must be at least one sample");
+    }
+
+    if (maxError < 0)
+    {
+        throw std::runtime_error("Maximum error must not be negative");
+    }
+
+    static const VocSampleFormat formatsBySize[] = { VOC_FORMAT_ADPCM_2BIT, VOC_FORMAT_ADPCM_4BIT, VOC_FORMAT_PCM_8BIT };
+
+    size_t blockCount = raw.empty() ? 0 : std::max<size_t>(raw.size() / blockLength, 1);
+    auto blockBegin = [&](size_t block) { return block * blockLength; };
+    auto blockEnd = [&](size_t block) { return block + 1 < blockCount ? (block + 1) * blockLength : raw.size(); };
+    auto meetsMaxError = [&](size_t begin, std::vector<uint8_t>& samples, std::vector<uint8_t>& decoded, size_t blockBegin, size_t blockEnd)
+    {
+        return computeAudioDifference(
+            std::span<uint8_t>(samples).subspan(blockBegin - begin, blockEnd - blockBegin),
+            std::span<uint8_t>(decoded).subspan(blockBegin - begin, blockEnd - blockBegin),
+            sampleRate).averageDifference <= maxError;
+    };
+
+    std::vector<VocSampleFormat> formats(blockCount);
+    std::vector<std::vector<VocBlock>> encodedBlocks(blockCount);
+    for (size_t block = 0; block < blockCount; ++block)
+    {
+        std::vector<uint8_t> samples(raw.begin() + blockBegin(block), raw.begin() + blockEnd(block));
+
+        for (VocSampleFormat format : formatsBySize)
+        {
+            formats[block] = format;
+            encodedBlocks[block] = createExactSoundBlocks(format, samples, [&](const std::vector<uint8_t>& input) { return encode(format, input); });
+            if (format == VOC_FORMAT_PCM_8BIT)
+            {
+                break;
+            }
+
+            auto decoded = decodeToPcm(VocFile{ 0, 1, 10, format, {}, encodedBlocks[block] }).sampleData;
+            if (meetsMaxError(0, samples, decoded, 0, samples.size()))
+            {
+                break;
+            }
+        }
+    }
+
+    // Adjacent blocks in the same format are stored as one sound block, which saves the block
+    // headers and reference bytes and keeps the decoder state across the block boundaries.
+    // The run is encoded again as a whole and only used if every block still meets maxError.
+    std::vector<VocBlock> blocks;
+    for (size_t first = 0; first < blockCount;)
+    {
+        size_t last = first + 1;
+        while (last < blockCount && formats[last] == formats[first])
+        {
+            ++last;
+        }
+
+        VocSampleFormat format = formats[first];
+        std::vector<VocBlock> merged;
+        if (last - first > 1)
+        {
+            size_t begin = blockBegin(first);
+            std::vector<uint8_t> samples(raw.begin() + begin, raw.begin() + blockEnd(last - 1));
+            merged = createExactSoundBlocks(format, samples, [&](const std::vector<uint8_t>& input) { return encode(format, input); });
+            if (format != VOC_FORMAT_PCM_8BIT)
+            {
+                auto decoded = decodeToPcm(VocFile{ 0, 1, 10, format, {}, merged }).sampleData;
+                for (size_t block = first; block < last && !merged.empty(); ++block)
+                {
+                    if (!meetsMaxError(begin, samples, decoded, blockBegin(block), blockEnd(block)))
+                    {
+                        merged.clear();
+                    }
+                }
+            }
+        }
+
+        if (!merged.empty())
+        {
+            blocks.insert(blocks.end(), std::make_move_iterator(merged.begin()), std::make_move_iterator(merged.end()));
+        }
+        else
+        {
+            for (size_t block = first; block < last; ++block)
+            {
+                blocks.insert(blocks.end(), std::make_move_iterator(encodedBlocks[block].begin()), std::make_move_iterator(encodedBlocks[block].end()));
+            }
+        }
+        first = last;
+    }
+    return blocks;
+}
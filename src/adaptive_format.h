@@ -0,0 +1,33 @@
+#ifndef ADAPTIVE_FORMAT_H
+#define ADAPTIVE_FORMAT_H
+
+#include "voc_format.h"
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+/**
+ * @brief Encodes unsigned 8bit samples in the given format into the sample data of a sound block.
+ */
+using FormatEncoder = std::function<std::vector<uint8_t>(VocSampleFormat, const std::vector<uint8_t>&)>;
+
+/**
+ * @brief Splits raw into blocks of blockLength samples and stores each block in the
+ *        smallest format whose average squared difference to raw is at most maxError.
+ *
+ * The formats are tried from the smallest to the largest: ADPCM2, ADPCM4 and PCM, so the
+ * expensive encoders only run on blocks the cheaper ones cannot represent well enough.
+ * Runs of adjacent blocks in the same format are merged into one sound block if the
+ * merged encoding still meets maxError for every block.
+ * The last block also takes the samples that do not fill a whole block. The returned
+ * blocks decode to exactly raw.size() samples.
+ */
+std::vector<VocBlock> createAdaptiveBlocks(
+    const std::vector<uint8_t>& raw,
+    size_t blockLength,
+    double maxError,
+    uint32_t sampleRate,
+    const FormatEncoder& encode);
+
+#endif
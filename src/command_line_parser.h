@@ -62,14 +62,35 @@ public:
     void parse(int argc, char* argv[])
     {
         std::string programName = (argc > 0) ? argv[0] : "(unknown)";
-        for (int i = 1; i < argc; ++i)
+        try
         {
-            std::string param = argv[i];
+            parseArguments(std::vector<std::string>(argv + std::min(argc, 1), argv + argc));
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cout << e.what() << "\n";
+            printUsage(programName);
+            exit(1);
+        }
+    }
+
+    /**
+     * Parses arguments without the program name. Errors throw std::runtime_error instead
+     * of printing the usage and exiting. A parameter that is given twice keeps the last value.
+     */
+    void parseArguments(const std::vector<std::string>& arguments)
+    {
+        for (auto& param : m_parameters)
+        {
+            param.value.reset();
+        }
+
+        for (size_t i = 0; i < arguments.size(); ++i)
+        {
+            const std::string& param = arguments[i];
             if (param.size() < 2 || param[0] != '-')
             {
-                std::cout << "invalid parameter \"" << param << "\"\n";
-                printUsage(programName);
-                exit(1);
+                throw std::runtime_error("invalid parameter \"" + param + "\"");
             }
 
             Parameter* parameter = nullptr;
@@ -95,20 +116,16 @@ public:
 
             if (!parameter) 
             {
-                std::cout << "unknown parameter \"" << param << "\"\n";
-                printUsage(programName);
-                exit(1);
+                throw std::runtime_error("unknown parameter \"" + param + "\"");
             }
             
-            if (i + 1 >= argc)
+            if (i + 1 >= arguments.size())
             {
-                std::cout << "missing string after parameter \"" << param << "\"\n";
-                printUsage(programName);
-                exit(1);
+                throw std::runtime_error("missing string after parameter \"" + param + "\"");
             }
 
             ++i;
-            parameter->value = argv[i];
+            parameter->value = arguments[i];
         }
 
         // check if parameters are missing
@@ -116,9 +133,7 @@ public:
         {
             if (!param.value.has_value() && param.required == ParameterRequired::yes)
             {
-                std::cout << "Parameter \"" << param.name << "\" is missing.\n";
-                printUsage(programName);
-                exit(1);
+                throw std::runtime_error("Parameter \"" + param.name + "\" is missing.");
             }
             if (!param.value.has_value())
             {
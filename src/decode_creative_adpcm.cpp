@@ -0,0 +1,58 @@
+#include "decode_creative_adpcm.h"
+
+void decodeAdpcm4(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output)
+{
+    if (output.size() != data.size() * 2 + 1)
+    {
+        throw std::runtime_error("Output buffer size does not match ADPCM4 data size");
+    }
+
+    CreativeAdpcmDecoder4Bit decoder(initial);
+
+    uint8_t* out = output.data();
+    *out++ = initial;
+
+    for (uint8_t byte : data)
+    {
+        *out++ = decoder.decodeNibble(byte >> 4);
+        *out++ = decoder.decodeNibble(byte & 0x0F);
+    }
+}
+
+
+std::vector<uint8_t> decodeAdpcm4(uint8_t initial, std::span<const uint8_t> data)
+{
+    std::vector<uint8_t> decoded(data.size() * 2 + 1);
+    decodeAdpcm4(initial, data, decoded);
+    return decoded;
+}
+
+
+void decodeAdpcm2(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output)
+{
+    if (output.size() != data.size() * 4 + 1)
+    {
+        throw std::runtime_error("Output buffer size does not match ADPCM2 data size");
+    }
+
+    CreativeAdpcmDecoder2Bit decoder(initial);
+
+    uint8_t* out = output.data();
+    *out++ = initial;
+
+    for (uint8_t byte : data)
+    {
+        *out++ = decoder.decode2bits((byte >> 6) & 0x03);
+        *out++ = decoder.decode2bits((byte >> 4) & 0x03);
+        *out++ = decoder.decode2bits((byte >> 2) & 0x03);
+        *out++ = decoder.decode2bits((byte >> 0) & 0x03);
+    }
+}
+
+
+std::vector<uint8_t> decodeAdpcm2(uint8_t initial, std::span<const uint8_t> data)
+{
+    std::vector<uint8_t> decoded(data.size() * 4 + 1);
+    decodeAdpcm2(initial, data, decoded);
+    return decoded;
+}
@@ -0,0 +1,240 @@
+#include "decode_creative_adpcm_parallel.h"
+#include "decode_creative_adpcm.h"
+#include "execution_context.h"
+
+#include "omp.h"
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+/*
+ * Parallel decoding works in three passes:
+ *
+ * 1. For every chunk the mapping "decoder state at chunk start -> decoder state at chunk end"
+ *    is computed concurrently.
+ * 2. A serial prefix pass walks these mappings to find the decoder state at every chunk start.
+ * 3. All chunks are decoded concurrently starting from their known state.
+ *
+ * The decoder state consists of a control value (accumulator or scale) and the previous
+ * sample. The control value only depends on the input symbols, and every decoding step maps
+ * the previous sample x to clamp(x + delta, 0, 255). A sequence of such clamped additions
+ * is again a clamped addition clamp(x + offset, low, high), so the mapping of a chunk is fully
+ * described by a few integers per possible start control value.
+ */
+
+namespace { // annonymous namespace
+
+/**
+ * The function x -> clamp(x + offset, low, high).
+ */
+struct ClampedAdd
+{
+    int offset = 0;
+    int low = 0;
+    int high = 255;
+
+    void append(int delta)
+    {
+        offset += delta;
+        low = std::clamp(low + delta, 0, 255);
+        high = std::clamp(high + delta, 0, 255);
+    }
+
+    // returns the function "other after this"
+    ClampedAdd then(const ClampedAdd& other) const
+    {
+        return {
+            offset + other.offset,
+            std::clamp(low + other.offset, other.low, other.high),
+            std::clamp(high + other.offset, other.low, other.high)};
+    }
+
+    uint8_t apply(uint8_t value) const
+    {
+        return static_cast<uint8_t>(std::clamp(value + offset, low, high));
+    }
+};
+
+struct Adpcm4Traits
+{
+    using Decoder = CreativeAdpcmDecoder4Bit;
+    static constexpr size_t symbolsPerByte = 2;
+    static constexpr std::array<uint8_t, 4> controlValues = {1, 2, 4, 8};
+
+    static uint8_t symbol(uint8_t byte, size_t n) { return (byte >> (4 - 4 * n)) & 0x0f; }
+    static uint8_t control(const Decoder& decoder) { return decoder.accumulator(); }
+    static uint8_t decode(Decoder& decoder, uint8_t symbol) { return decoder.decodeNibble(symbol); }
+};
+
+struct Adpcm2Traits
+{
+    using Decoder = CreativeAdpcmDecoder2Bit;
+    static constexpr size_t symbolsPerByte = 4;
+    static constexpr std::array<uint8_t, 6> controlValues = {0, 4, 8, 12, 16, 20};
+
+    static uint8_t symbol(uint8_t byte, size_t n) { return (byte >> (6 - 2 * n)) & 0x03; }
+    static uint8_t control(const Decoder& decoder) { return decoder.scale(); }
+    static uint8_t decode(Decoder& decoder, uint8_t symbol) { return decoder.decode2bits(symbol); }
+};
+
+template <typename Traits>
+size_t controlIndex(uint8_t control)
+{
+    auto it = std::find(Traits::controlValues.begin(), Traits::controlValues.end(), control);
+    if (it == Traits::controlValues.end())
+    {
+        throw std::logic_error("Unexpected ADPCM decoder state");
+    }
+    return it - Traits::controlValues.begin();
+}
+
+/**
+ * Mapping of a chunk for one start control value.
+ */
+struct ChunkTransition
+{
+    uint8_t control;
+    ClampedAdd previous;
+};
+
+template <typename Traits>
+using ChunkMap = std::array<ChunkTransition, Traits::controlValues.size()>;
+
+template <typename Traits, size_t... Index>
+std::array<typename Traits::Decoder, sizeof...(Index)> makeDecoders(std::index_sequence<Index...>)
+{
+    return { typename Traits::Decoder(0, Traits::controlValues[Index])... };
+}
+
+template <typename Traits>
+ChunkMap<Traits> computeChunkMap(std::span<const uint8_t> chunk)
+{
+    using Decoder = typename Traits::Decoder;
+    constexpr size_t stateCount = Traits::controlValues.size();
+
+    auto decoders = makeDecoders<Traits>(std::make_index_sequence<stateCount>());
+    std::array<ClampedAdd, stateCount> functions = {};
+
+    // run all control values in lockstep until they agree, which usually happens after a few symbols
+    size_t pos = 0;
+    size_t symbolCount = chunk.size() * Traits::symbolsPerByte;
+    bool converged = false;
+    for (; pos < symbolCount; ++pos)
+    {
+        converged = true;
+        for (size_t i = 1; i < stateCount; ++i)
+        {
+            converged &= Traits::control(decoders[i]) == Traits::control(decoders[0]);
+        }
+        if (converged)
+        {
+            break;
+        }
+
+        uint8_t symbol = Traits::symbol(chunk[pos / Traits::symbolsPerByte], pos % Traits::symbolsPerByte);
+        for (size_t i = 0; i < stateCount; ++i)
+        {
+            functions[i].append(decoders[i].step(symbol));
+        }
+    }
+
+    // from here on all trajectories are identical and share one function
+    Decoder& shared = decoders[0];
+    ClampedAdd suffix;
+    for (; pos < symbolCount; ++pos)
+    {
+        uint8_t symbol = Traits::symbol(chunk[pos / Traits::symbolsPerByte], pos % Traits::symbolsPerByte);
+        suffix.append(shared.step(symbol));
+    }
+
+    ChunkMap<Traits> map;
+    for (size_t i = 0; i < stateCount; ++i)
+    {
+        map[i].control = Traits::control(converged ? shared : decoders[i]);
+        map[i].previous = functions[i].then(suffix);
+    }
+    return map;
+}
+
+template <typename Traits>
+void decodeParallel(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output, size_t chunkSize)
+{
+    using Decoder = typename Traits::Decoder;
+
+    if (output.size() != data.size() * Traits::symbolsPerByte + 1)
+    {
+        throw std::runtime_error("Output buffer size does not match ADPCM data size");
+    }
+
+    if (chunkSize == 0)
+    {
+        // keep enough chunks per thread for load balancing, but make them large enough
+        // so the additional mapping pass stays cheap compared to the decoding itself
+        const size_t minChunkSize = 64 * 1024;
+        chunkSize = std::max(minChunkSize, data.size() / (4 * ExecutionContext::threads()) + 1);
+    }
+
+    output[0] = initial;
+    size_t chunkCount = (data.size() + chunkSize - 1) / chunkSize;
+    auto chunk = [&](size_t n) { return data.subspan(n * chunkSize, std::min(chunkSize, data.size() - n * chunkSize)); };
+
+    // the last chunk does not need a mapping, as nothing follows it
+    std::vector<ChunkMap<Traits>> maps(chunkCount > 0 ? chunkCount - 1 : 0);
+    #pragma omp parallel for schedule(dynamic) num_threads(ExecutionContext::threads())
+    for (int64_t n = 0; n < static_cast<int64_t>(maps.size()); ++n)
+    {
+        maps[n] = computeChunkMap<Traits>(chunk(n));
+    }
+
+    std::vector<Decoder> startStates;
+    startStates.reserve(chunkCount);
+    Decoder state(initial);
+    for (size_t n = 0; n < chunkCount; ++n)
+    {
+        startStates.push_back(state);
+        if (n < maps.size())
+        {
+            const auto& transition = maps[n][controlIndex<Traits>(Traits::control(state))];
+            state = Decoder(transition.previous.apply(state.previous()), transition.control);
+        }
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(ExecutionContext::threads())
+    for (int64_t n = 0; n < static_cast<int64_t>(chunkCount); ++n)
+    {
+        Decoder decoder = startStates[n];
+        uint8_t* out = output.data() + 1 + n * chunkSize * Traits::symbolsPerByte;
+        for (uint8_t byte : chunk(n))
+        {
+            for (size_t i = 0; i < Traits::symbolsPerByte; ++i)
+            {
+                *out++ = Traits::decode(decoder, Traits::symbol(byte, i));
+            }
+        }
+    }
+}
+
+} // annonymous namespace
+
+void decodeAdpcm4Parallel(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output, size_t chunkSize)
+{
+    if (chunkSize == 0 && (ExecutionContext::threads() == 1 || data.size() < 1024 * 1024))
+    {
+        decodeAdpcm4(initial, data, output);
+        return;
+    }
+    decodeParallel<Adpcm4Traits>(initial, data, output, chunkSize);
+}
+
+void decodeAdpcm2Parallel(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output, size_t chunkSize)
+{
+    if (chunkSize == 0 && (ExecutionContext::threads() == 1 || data.size() < 1024 * 1024))
+    {
+        decodeAdpcm2(initial, data, output);
+        return;
+    }
+    decodeParallel<Adpcm2Traits>(initial, data, output, chunkSize);
+}
@@ -0,0 +1,22 @@
+#ifndef DECODE_CREATIVE_ADPCM_PARALLEL_H
+#define DECODE_CREATIVE_ADPCM_PARALLEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+/**
+ * Multithreaded versions of decodeAdpcm4 and decodeAdpcm2. The output is identical
+ * to the serial decoders.
+ *
+ * @param initial The reference byte, it is stored as first output sample.
+ * @param data The ADPCM data following the reference byte.
+ * @param output Output buffer, must hold exactly data.size() * 2 + 1 (4bit) or
+ *               data.size() * 4 + 1 (2bit) samples.
+ * @param chunkSize Number of input bytes decoded per task. If 0 the chunk size is
+ *                  chosen automatically and small inputs are decoded serially.
+ */
+void decodeAdpcm4Parallel(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output, size_t chunkSize = 0);
+void decodeAdpcm2Parallel(uint8_t initial, std::span<const uint8_t> data, std::span<uint8_t> output, size_t chunkSize = 0);
+
+#endif
@@ -1,10 +1,42 @@
 #include "detect_file_format.h"
+#include "file_tools.h"
 
 #include <fstream>
 #include <stdexcept>
 
+/**
+ * Only one byte can be put back into a stream, so stdin is detected by its first byte,
+ * which already tells RIFF, RF64 and BW64 apart from "Creative Voice File". The readers
+ * check the rest of the header.
+ */
+FileFormat detectStreamFormat(FILE* stream)
+{
+    int first = getc(stream);
+    if (first == EOF)
+    {
+        return FileFormat::UNKNOWN;
+    }
+    ungetc(first, stream);
+
+    if (first == 'R' || first == 'B')
+    {
+        return FileFormat::WAV;
+    }
+    else if (first == 'C')
+    {
+        return FileFormat::VOC;
+    }
+    return FileFormat::UNKNOWN;
+}
+
+
 FileFormat detectFileFormat(const std::string& filePath)
 {
+    if (isStandardStream(filePath))
+    {
+        return detectStreamFormat(openFile(filePath, "rb").get());
+    }
+
     std::ifstream file(filePath, std::ios::binary);
     if (!file.is_open())
     {
@@ -19,7 +51,9 @@ FileFormat detectFileFormat(const std::string& filePath)
         return FileFormat::UNKNOWN;
     }
 
-    if (buffer[0] == 'R' && buffer[1] == 'I' && buffer[2] == 'F' && buffer[3] == 'F')
+    if ((buffer[0] == 'R' && buffer[1] == 'I' && buffer[2] == 'F' && buffer[3] == 'F') ||
+        (buffer[0] == 'R' && buffer[1] == 'F' && buffer[2] == '6' && buffer[3] == '4') ||
+        (buffer[0] == 'B' && buffer[1] == 'W' && buffer[2] == '6' && buffer[3] == '4'))
     {
         return FileFormat::WAV;
     }
@@ -29,4 +63,4 @@ FileFormat detectFileFormat(const std::string& filePath)
     }
 
     return FileFormat::UNKNOWN;
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 #define _DETECT_FILE_FORMAT_H
 
 #include <string>
+#include <cstdio>
 
 enum class FileFormat
 {
@@ -10,7 +11,17 @@ enum class FileFormat
     VOC = 2
 };
 
+/**
+ * @brief Detects the format from the first bytes of the file. For "-" they are read from
+ *        stdin and stay in the stream for the reader of the detected format.
+ */
 FileFormat detectFileFormat(const std::string& filePath);
 
+/**
+ * @brief Detects the format from the first byte of the stream and puts it back, so the
+ *        stream can still be read from the start.
+ */
+FileFormat detectStreamFormat(FILE* stream);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+#ifndef ENCODE_ADAPTIVE_LEVEL_H
+#define ENCODE_ADAPTIVE_LEVEL_H
+
+#include "encode_state_search.h"
+#include "progress.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * Returns true if the samples of the next group change faster than a single nibble can
+ * follow from the current accumulator. The decoder then has to raise its accumulator in
+ * time, which only a longer search can plan.
+ */
+inline bool isAdpcm4Transient(const uint8_t* data, size_t length, uint8_t accumulator, uint8_t previous)
+{
+    int largestStep = 7 * accumulator + accumulator / 2;
+    int last = previous;
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (std::abs(data[i] - last) > largestStep)
+        {
+            return true;
+        }
+        last = data[i];
+    }
+    return false;
+}
+
+/**
+ * Level 1 search without the overhead of DecoderStateSearch. On equal error the smaller
+ * nibble wins, like in the exhaustive search.
+ */
+template <typename Expand>
+DecoderStateSearch::Result searchSingleNibble(uint8_t target, uint8_t accumulator, uint8_t previous, Expand& expand)
+{
+    uint8_t childAccumulators[16];
+    uint8_t childPrevious[16];
+    uint32_t squaredDiffs[16];
+    expand(accumulator, previous, target, childAccumulators, childPrevious, squaredDiffs);
+
+    uint8_t best = 0;
+    for (uint8_t nibble = 1; nibble < 16; ++nibble)
+    {
+        if (squaredDiffs[nibble] < squaredDiffs[best])
+        {
+            best = nibble;
+        }
+    }
+    return { squaredDiffs[best], best, childAccumulators[best], childPrevious[best] };
+}
+
+/**
+ * Merges two nibbles per byte after the first sample, an odd last nibble is dropped.
+ */
+inline std::vector<uint8_t> mergeAdpcm4Nibbles(uint8_t first, const std::vector<uint8_t>& nibbles)
+{
+    std::vector<uint8_t> binaryResult(nibbles.size() / 2 + 1);
+    binaryResult[0] = first;
+    for (size_t n = 0; n < nibbles.size() / 2; ++n)
+    {
+        binaryResult[n + 1] = ((nibbles[2 * n] << 4) + (nibbles[2 * n + 1]));
+    }
+    return binaryResult;
+}
+
+/**
+ * Returns the nibbles for raw[1] up to the second last sample, the level of every group
+ * is chosen as described for encodeAdaptiveLevel().
+ */
+template <typename Expand>
+std::vector<uint8_t> searchAdaptiveLevel(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError, Expand& expand)
+{
+    if (raw.empty())
+    {
+        throw std::runtime_error("Cannot encode empty data");
+    }
+
+    if (maxLevel < 1 || maxLevel > 8)
+    {
+        throw std::runtime_error("Level must be between 1 and 8");
+    }
+
+    if (maxError < 0)
+    {
+        throw std::runtime_error("Maximum error must not be negative");
+    }
+
+    DecoderStateSearch stateSearch;
+    auto appendHistory = [](uint64_t history, uint64_t nibble, int) { return (history << 4) | nibble; };
+
+    std::vector<uint8_t> nibbles;
+    nibbles.reserve(raw.size());
+    uint8_t accumulator = 1;
+    uint8_t previous = raw[0];
+    ProgressStage progress("Encoding ADPCM4", raw.size());
+
+    // like the combined search, the last sample is not encoded
+    for (size_t i = 1; i + 1 < raw.size();)
+    {
+        progress.update(i);
+        uint64_t fullLevel = std::min<uint64_t>(maxLevel, raw.size() - 1 - i);
+        uint64_t level = 1;
+        auto best = searchSingleNibble(raw[i], accumulator, previous, expand);
+        if (fullLevel > 1 && (best.squaredDiff > maxError || isAdpcm4Transient(&raw[i], fullLevel, accumulator, previous)))
+        {
+            level = fullLevel;
+            best = stateSearch.search(&raw[i], static_cast<int>(level), accumulator, previous, expand, appendHistory);
+        }
+
+        for (uint64_t n = level; n-- > 0;)
+        {
+            nibbles.push_back((best.history >> (4 * n)) & 0xf);
+        }
+        accumulator = best.accumulator;
+        previous = best.previous;
+        i += level;
+    }
+    return nibbles;
+}
+
+/**
+ * Encodes raw to 4bit ADPCM like the combined search, but chooses the level per group.
+ *
+ * Every group is searched with level 1 first. If its average squared error per sample is
+ * above maxError, or isAdpcm4Transient() flags the group, it is searched again with maxLevel
+ * and the longer group is used. Smooth regions are therefore encoded at level 1 speed and
+ * only the difficult ones pay for the full search. With a maxError of 0 only groups that
+ * level 1 encodes without any error stay at level 1.
+ *
+ * All levels use DecoderStateSearch, which finds the same nibbles as the exhaustive search.
+ * Expand has the signature of the Expand function of DecoderStateSearch.
+ */
+template <typename Expand>
+std::vector<uint8_t> encodeAdaptiveLevel(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError, Expand expand)
+{
+    auto nibbles = searchAdaptiveLevel(raw, maxLevel, maxError, expand);
+    return mergeAdpcm4Nibbles(raw[0], nibbles);
+}
+
+#endif
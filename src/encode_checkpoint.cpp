@@ -0,0 +1,231 @@
+#include "encode_checkpoint.h"
+#include "incremental_encode.h"
+#include "file_tools.h"
+#include "decode_creative_adpcm.h"
+
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+
+namespace { // annonymous namespace
+
+const std::string checkpointMagic = "VOCTOOL-CHECKPOINT-1";
+
+void appendUint64(std::vector<uint8_t>& data, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+class CheckpointReader
+{
+public:
+    CheckpointReader(const std::vector<uint8_t>& data, const std::string& filename) :
+        m_data(data),
+        m_filename(filename)
+    {
+    }
+
+    const uint8_t* read(size_t length)
+    {
+        if (length > m_data.size() - m_position)
+        {
+            throw std::runtime_error("Checkpoint file is truncated: " + m_filename);
+        }
+        const uint8_t* bytes = &m_data[m_position];
+        m_position += length;
+        return bytes;
+    }
+
+    uint64_t readUint64()
+    {
+        const uint8_t* bytes = read(8);
+        uint64_t value = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            value |= uint64_t(bytes[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    std::string readString()
+    {
+        size_t length = readUint64();
+        const uint8_t* bytes = read(length);
+        return std::string(bytes, bytes + length);
+    }
+
+private:
+    const std::vector<uint8_t>& m_data;
+    const std::string& m_filename;
+    size_t m_position = 0;
+};
+
+} // annonymous namespace
+
+
+EncodeCheckpoint::EncodeCheckpoint(const std::string& filename, const std::string& settings, const std::vector<uint8_t>& raw, std::chrono::steady_clock::duration interval) :
+    m_filename(filename),
+    m_settings(settings),
+    m_inputHash(hashSamples(raw.data(), raw.size())),
+    m_interval(interval),
+    m_nextWrite(std::chrono::steady_clock::now() + interval)
+{
+}
+
+
+void EncodeCheckpoint::resume(const std::string& filename)
+{
+    auto data = loadFile(filename);
+    CheckpointReader reader(data, filename);
+
+    if (data.size() < checkpointMagic.size() || !std::equal(checkpointMagic.begin(), checkpointMagic.end(), reader.read(checkpointMagic.size())))
+    {
+        throw std::runtime_error("Not a checkpoint file: " + filename);
+    }
+    if (reader.readUint64() != m_inputHash)
+    {
+        throw std::runtime_error("Checkpoint was written for other input: " + filename);
+    }
+    if (reader.readString() != m_settings)
+    {
+        throw std::runtime_error("Checkpoint was written with other settings: " + filename);
+    }
+
+    std::map<size_t, std::vector<uint8_t>> segments;
+    size_t segmentCount = reader.readUint64();
+    for (size_t s = 0; s < segmentCount; ++s)
+    {
+        size_t index = reader.readUint64();
+        size_t nibbleCount = reader.readUint64();
+        const uint8_t* bytes = reader.read((nibbleCount + 1) / 2);
+
+        std::vector<uint8_t>& nibbles = segments[index];
+        nibbles.resize(nibbleCount);
+        for (size_t n = 0; n < nibbleCount; ++n)
+        {
+            nibbles[n] = (n % 2 == 0) ? bytes[n / 2] >> 4 : bytes[n / 2] & 0xf;
+        }
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_segments = std::move(segments);
+}
+
+
+std::optional<std::vector<uint8_t>> EncodeCheckpoint::segment(size_t index) const
+{
+    std::lock_guard lock(m_mutex);
+    auto it = m_segments.find(index);
+    if (it == m_segments.end())
+    {
+        return {};
+    }
+    return it->second;
+}
+
+
+size_t EncodeCheckpoint::storedNibbles() const
+{
+    std::lock_guard lock(m_mutex);
+    size_t count = 0;
+    for (const auto& [index, nibbles] : m_segments)
+    {
+        count += nibbles.size();
+    }
+    return count;
+}
+
+
+bool EncodeCheckpoint::due() const
+{
+    std::lock_guard lock(m_mutex);
+    return std::chrono::steady_clock::now() >= m_nextWrite;
+}
+
+
+void EncodeCheckpoint::store(size_t index, std::vector<uint8_t> nibbles)
+{
+    std::lock_guard lock(m_mutex);
+    m_segments[index] = std::move(nibbles);
+    if (std::chrono::steady_clock::now() >= m_nextWrite)
+    {
+        writeLocked();
+    }
+}
+
+
+void EncodeCheckpoint::write()
+{
+    std::lock_guard lock(m_mutex);
+    writeLocked();
+}
+
+
+void EncodeCheckpoint::remove()
+{
+    std::lock_guard lock(m_mutex);
+    std::filesystem::remove(m_filename);
+}
+
+
+void EncodeCheckpoint::writeLocked()
+{
+    std::vector<uint8_t> data;
+    data.insert(data.end(), checkpointMagic.begin(), checkpointMagic.end());
+    appendUint64(data, m_inputHash);
+    appendUint64(data, m_settings.size());
+    data.insert(data.end(), m_settings.begin(), m_settings.end());
+
+    appendUint64(data, m_segments.size());
+    for (const auto& [index, nibbles] : m_segments)
+    {
+        appendUint64(data, index);
+        appendUint64(data, nibbles.size());
+        for (size_t n = 0; n < nibbles.size(); n += 2)
+        {
+            uint8_t second = (n + 1 < nibbles.size()) ? nibbles[n + 1] : 0;
+            data.push_back(static_cast<uint8_t>((nibbles[n] << 4) | second));
+        }
+    }
+
+    // write a new file and replace the old one, so there is always a complete checkpoint
+    std::string temporaryFilename = m_filename + ".tmp";
+    storeFile(temporaryFilename, data);
+    std::filesystem::rename(temporaryFilename, m_filename);
+
+    m_nextWrite = std::chrono::steady_clock::now() + m_interval;
+}
+
+
+ResumedNibbles resumeSequentialEncode(const EncodeCheckpoint* checkpoint, const std::vector<uint8_t>& raw, size_t groupLength)
+{
+    ResumedNibbles resumed = { {}, 1, raw[0] };
+    if (!checkpoint)
+    {
+        return resumed;
+    }
+
+    auto stored = checkpoint->segment(0);
+    if (!stored)
+    {
+        return resumed;
+    }
+
+    if (stored->size() % groupLength != 0 || stored->size() >= raw.size())
+    {
+        throw std::runtime_error("Checkpoint does not match the encoder");
+    }
+
+    CreativeAdpcmDecoder4Bit decoder(raw[0]);
+    for (uint8_t nibble : *stored)
+    {
+        decoder.decodeNibble(nibble);
+    }
+    resumed.nibbles = std::move(*stored);
+    resumed.accumulator = decoder.accumulator();
+    resumed.previous = decoder.previous();
+    return resumed;
+}
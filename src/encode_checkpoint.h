@@ -0,0 +1,98 @@
+#ifndef ENCODE_CHECKPOINT_H
+#define ENCODE_CHECKPOINT_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+/**
+ * @brief Keeps the nibbles of the finished segments of an encode and writes them to a file
+ *        at a fixed interval, so an interrupted encode can be resumed.
+ *
+ * The sequential encoders store everything they encoded so far as segment 0, the trellis
+ * encoder stores every finished segment under its index. A checkpoint belongs to one input
+ * and one set of settings, both are checked when it is resumed. All methods are thread safe.
+ */
+class EncodeCheckpoint
+{
+public:
+    /**
+     * @param filename File the checkpoint is written to.
+     * @param settings Encoder and options, a checkpoint is only resumed with the same settings.
+     * @param raw The samples that are encoded.
+     * @param interval Minimum time between two writes of the file.
+     */
+    EncodeCheckpoint(const std::string& filename, const std::string& settings, const std::vector<uint8_t>& raw, std::chrono::steady_clock::duration interval);
+
+    /**
+     * @brief Loads the segments of an earlier run. Throws if the file was written for other
+     *        samples or settings.
+     */
+    void resume(const std::string& filename);
+
+    /**
+     * @brief Returns the nibbles stored for the segment, if any.
+     */
+    std::optional<std::vector<uint8_t>> segment(size_t index) const;
+
+    /**
+     * @brief Number of nibbles in all stored segments.
+     */
+    size_t storedNibbles() const;
+
+    /**
+     * @brief True if the interval has passed since the file was written last.
+     */
+    bool due() const;
+
+    /**
+     * @brief Stores the nibbles of a segment, replacing earlier nibbles of the same segment.
+     *        The file is written if due() is true.
+     */
+    void store(size_t index, std::vector<uint8_t> nibbles);
+
+    /**
+     * @brief Writes the file now. The file is replaced atomically, so an interruption
+     *        while writing keeps the previous checkpoint.
+     */
+    void write();
+
+    /**
+     * @brief Removes the file after the encode has finished.
+     */
+    void remove();
+
+private:
+    void writeLocked();
+
+    std::string m_filename;
+    std::string m_settings;
+    uint64_t m_inputHash;
+    std::chrono::steady_clock::duration m_interval;
+    std::chrono::steady_clock::time_point m_nextWrite;
+    std::map<size_t, std::vector<uint8_t>> m_segments;
+    mutable std::mutex m_mutex;
+};
+
+/**
+ * @brief Nibbles restored from a checkpoint of a sequential encoder and the decoder state after them.
+ */
+struct ResumedNibbles
+{
+    std::vector<uint8_t> nibbles;
+    uint8_t accumulator;
+    uint8_t previous;
+};
+
+/**
+ * @brief Restores segment 0 of the checkpoint for the encoders that encode the samples in order,
+ *        in groups of groupLength samples. Without checkpoint or stored nibbles the result is
+ *        empty and in the start state of the decoder.
+ */
+ResumedNibbles resumeSequentialEncode(const EncodeCheckpoint* checkpoint, const std::vector<uint8_t>& raw, size_t groupLength);
+
+#endif
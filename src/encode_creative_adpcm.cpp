@@ -1,21 +1,28 @@
 #include "encode_creative_adpcm.h"
 #include "decode_creative_adpcm.h"
+#include "encode_level_dispatch.h"
+#include "encode_state_search.h"
+#include "encode_trellis.h"
+#include "encode_adaptive_level.h"
+#include "encode_time_limited.h"
+#include "encode_checkpoint.h"
+#include "progress.h"
+#include "execution_context.h"
 
 #include "omp.h"
 
 #include <limits>
 #include <cassert>
-#include <memory>
 #include <iostream>
-#include <random>
 #include <algorithm>
+#include <stdexcept>
 
-uint64_t getNthNibble(int n, uint64_t value)
+constexpr uint64_t getNthNibble(int n, uint64_t value)
 {
     return (0xf & (value >> (4 * n)));
 }
 
-uint64_t getNth2bit(int n, uint64_t value)
+constexpr uint64_t getNth2bit(int n, uint64_t value)
 {
     return (0x3 & (value >> (2 * n)));
 }
@@ -32,13 +39,45 @@ constexpr uint64_t constPow(uint64_t val, uint64_t exp)
 }
 
 
-struct Best
+// aligned to a cache line, so the bests of different threads do not share one
+struct alignas(64) Best
 {
     uint64_t bestIndex = 0;
     uint64_t bestDiff = std::numeric_limits<uint64_t>::max();
     CreativeAdpcmDecoder4Bit bestDecoder = CreativeAdpcmDecoder4Bit(0);
 };
 
+/**
+ * Returns the result with the smaller difference. On equal difference the smaller
+ * index wins, so the result does not depend on how candidates are split between threads.
+ */
+Best betterOf(const Best& a, const Best& b)
+{
+    if (b.bestDiff < a.bestDiff || (b.bestDiff == a.bestDiff && b.bestIndex < a.bestIndex))
+    {
+        return b;
+    }
+    return a;
+}
+
+// MSVC only supports OpenMP 2.0, which has no user defined reductions
+#if defined(_OPENMP) && _OPENMP >= 201307
+    #define VOCTOOL_OMP_DECLARE_REDUCTION 1
+    #pragma omp declare reduction(minBest : Best : omp_out = betterOf(omp_out, omp_in)) initializer(omp_priv = Best())
+#endif
+
+void expandAdpcm4Nibbles(uint8_t accumulator, uint8_t previous, uint8_t target, uint8_t* childAccumulators, uint8_t* childPrevious, uint32_t* squaredDiffs)
+{
+    for (uint8_t nibble = 0; nibble < 16; ++nibble)
+    {
+        CreativeAdpcmDecoder4Bit decoder(previous, accumulator);
+        int diff = decoder.decodeNibble(nibble) - target;
+        childAccumulators[nibble] = decoder.accumulator();
+        childPrevious[nibble] = decoder.previous();
+        squaredDiffs[nibble] = diff * diff;
+    }
+}
+
 /**
  * Encodes the given sequence of unsigned 8bit values to 4bit ADPCM.
  * The first 8bit value is stored "as is", but the following values are
@@ -51,66 +90,98 @@ struct Best
  * by 16. A value between 3 and 5 produces good results.
  * Increasing the number further does not add much quality improvements,
  * but drastically increases the runtime, so 5 is the default.
+ * From level 4 on the state table search of createAdpcm4BitFromRaw() on one
+ * core is faster than the exhaustive search on all cores of common machines,
+ * so it is used instead. The result is the same.
  */
 std::vector<uint8_t> createAdpcm4BitFromRawOpenMP(const std::vector<uint8_t>& raw, uint64_t combinedNibbles)
 {
-    uint64_t squaredSum = 0u;
+    if (combinedNibbles < 1 || combinedNibbles > 8)
+    {
+        throw std::runtime_error("Level must be between 1 and 8");
+    }
+    if (combinedNibbles >= 4)
+    {
+        return createAdpcm4BitFromRaw(raw, combinedNibbles);
+    }
+
+    const int64_t candidateCount = static_cast<int64_t>(constPow(16, combinedNibbles));
 
     CreativeAdpcmDecoder4Bit decoder(raw[0]);
     
     std::vector<uint64_t> result(raw.size() / combinedNibbles);
 
-    for (size_t i = 1; i < raw.size() / combinedNibbles; ++i)
-    {
-        std::vector<Best> bestResults(omp_get_max_threads());
+    Best groupBest;
+#ifndef VOCTOOL_OMP_DECLARE_REDUCTION
+    std::vector<Best> threadBests(ExecutionContext::threads());
+#endif
+    ProgressStage progress("Encoding ADPCM4", raw.size());
+    bool cancelled = false;
 
-        // try every possible input for the decoder
-        #pragma omp parallel for
-        for (int64_t n = 0; n < static_cast<int64_t>(constPow(16, combinedNibbles)); ++n)
+    // One team of threads handles all groups, the groups are separated by the barriers
+    // at the end of the worksharing loop and of the single block.
+    #pragma omp parallel num_threads(ExecutionContext::threads())
+    {
+        for (size_t i = 1; i < raw.size() / combinedNibbles; ++i)
         {
-            CreativeAdpcmDecoder4Bit decoderCopy = decoder;
-            uint64_t diffSum = 0;
-            for (size_t nib = 0; nib < combinedNibbles; ++nib)
+            const uint8_t* targets = &raw[i*combinedNibbles - combinedNibbles + 1];
+            const CreativeAdpcmDecoder4Bit groupDecoder = decoder;
+
+#ifdef VOCTOOL_OMP_DECLARE_REDUCTION
+            #pragma omp for schedule(static) reduction(minBest : groupBest)
+#else
+            Best& threadBest = threadBests[omp_get_thread_num()];
+            threadBest = Best();
+            #pragma omp for schedule(static)
+#endif
+            for (int64_t n = 0; n < candidateCount; ++n)
             {
-                int32_t diff = (int32_t)decoderCopy.decodeNibble(getNthNibble(nib, n)) - (int32_t)raw[i*combinedNibbles + nib - combinedNibbles + 1];
-                diffSum += diff * diff;
+#ifdef VOCTOOL_OMP_DECLARE_REDUCTION
+                Best& best = groupBest;
+#else
+                Best& best = threadBest;
+#endif
+                // try every possible input for the decoder
+                CreativeAdpcmDecoder4Bit decoderCopy = groupDecoder;
+                uint64_t diffSum = 0;
+                for (size_t nib = 0; nib < combinedNibbles; ++nib)
+                {
+                    int32_t diff = (int32_t)decoderCopy.decodeNibble(getNthNibble(nib, n)) - (int32_t)targets[nib];
+                    diffSum += diff * diff;
+                }
+
+                // every thread sees its candidates in increasing order, so the first best one is kept
+                if (diffSum < best.bestDiff)
+                {
+                    best.bestDiff = diffSum;
+                    best.bestIndex = n;
+                    best.bestDecoder = decoderCopy;
+                }
             }
- 
-            auto& best = bestResults.at(omp_get_thread_num());
 
-            if (diffSum < best.bestDiff)
+            #pragma omp single
             {
-                best.bestDiff = diffSum;
-                best.bestIndex = n;
-                best.bestDecoder = decoderCopy;
+#ifndef VOCTOOL_OMP_DECLARE_REDUCTION
+                // now merge results from threads
+                for (const auto& best : threadBests)
+                {
+                    groupBest = betterOf(groupBest, best);
+                }
+#endif
+                decoder = groupBest.bestDecoder;
+                result[i-1] = groupBest.bestIndex;
+                groupBest = Best();
+                cancelled = !progress.add(combinedNibbles);
             }
-        }
 
-        // now merge results from threads
-        uint64_t bestIndex = 0;
-        uint64_t bestDiff = std::numeric_limits<uint64_t>::max();
-        CreativeAdpcmDecoder4Bit bestDecoder(0);
-        for (auto& best : bestResults)
-        {
-            // printf("diff: %d\n", best.bestDiff);
-            if (best.bestDiff < bestDiff)
+            // all threads see the same value after the barrier of the single block
+            if (cancelled)
             {
-                bestDiff = best.bestDiff;
-                bestIndex = best.bestIndex;
-                bestDecoder = best.bestDecoder;
+                break;
             }
         }
-
-
-        decoder = bestDecoder; 
-        result[i-1] = bestIndex;
-        squaredSum += bestDiff;
-
-
-        // if (i % 10 == 0) printf("%d\n", i);
     }
-
-    // printf("sum: %ld\n", squaredSum);
+    progress.throwIfCancelled();
 
     std::vector<uint8_t> nibbles(result.size() * combinedNibbles);
     for (size_t i = 0; i < result.size(); ++i)
@@ -143,25 +214,62 @@ std::vector<uint8_t> createAdpcm4BitFromRawOpenMP(const std::vector<uint8_t>& ra
  * The encoder uses an ADPCM decoder and tries every possible input
  * until it gets the output that most closely matches the input value.
  * The parameter combinedNibbles controlls the number of nibbles
- * that are combined. Each additional nibble muliplies the runtime
- * by 16. A value between 3 and 4 produces good results.
- * Increasing the number further does not add much quality improvements,
- * but drastically increases the runtime, so 4 is the default.
+ * that are combined. A value between 3 and 4 produces good results,
+ * so 4 is the default. Up to level 3 each additional nibble multiplies
+ * the runtime by 16, from level 4 on DecoderStateSearch keeps at most
+ * one candidate per decoder state, so the runtime grows linearly.
  */
-std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedNibbles)
+template <uint64_t combinedNibbles>
+std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, EncodeCheckpoint* checkpoint)
 {
-    uint64_t squaredSum = 0u;
+    constexpr uint64_t candidateCount = constPow(16, combinedNibbles);
 
-    CreativeAdpcmDecoder4Bit decoder(raw[0]);
+    auto resumed = resumeSequentialEncode(checkpoint, raw, combinedNibbles);
+    CreativeAdpcmDecoder4Bit decoder(resumed.previous, resumed.accumulator);
     
     std::vector<uint64_t> result(raw.size() / combinedNibbles);
+    ProgressStage progress("Encoding ADPCM4", raw.size());
+    size_t resumedGroups = resumed.nibbles.size() / combinedNibbles;
+    for (size_t i = 0; i < resumedGroups; ++i)
+    {
+        for (size_t nib = 0; nib < combinedNibbles; ++nib)
+        {
+            result[i] |= uint64_t(resumed.nibbles[i * combinedNibbles + nib]) << (4 * nib);
+        }
+    }
 
-    for (size_t i = 1; i < raw.size() / combinedNibbles; ++i)
+    // From level 4 on the candidates are searched using a table of decoder states, see DecoderStateSearch.
+    // The history is built with the first nibble in the lowest bits, like the candidate index n below,
+    // so ties are resolved exactly like in the exhaustive search.
+    DecoderStateSearch stateSearch;
+
+    for (size_t i = 1 + resumedGroups; i < raw.size() / combinedNibbles; ++i)
     {
+        progress.update(i * combinedNibbles);
+
+        if (checkpoint && checkpoint->due())
+        {
+            std::vector<uint8_t> nibbles((i - 1) * combinedNibbles);
+            for (size_t n = 0; n < nibbles.size(); ++n)
+            {
+                nibbles[n] = getNthNibble(n % combinedNibbles, result[n / combinedNibbles]);
+            }
+            checkpoint->store(0, std::move(nibbles));
+        }
+
+        if constexpr (combinedNibbles >= 4)
+        {
+            auto best = stateSearch.search(&raw[i*combinedNibbles - combinedNibbles + 1], combinedNibbles, decoder.accumulator(), decoder.previous(), expandAdpcm4Nibbles,
+                [](uint64_t history, uint64_t nibble, int depth) { return history | (nibble << (4 * depth)); });
+            decoder = CreativeAdpcmDecoder4Bit(best.previous, best.accumulator);
+            result[i-1] = best.history;
+            continue;
+        }
+
         Best bestResults;
 
         // try every possible input for the decoder
-        for (uint64_t n = 0; n < constPow(16, combinedNibbles); ++n)
+        for (uint64_t n = 0; n < candidateCount; ++n)
         {
             CreativeAdpcmDecoder4Bit decoderCopy = decoder;
             uint64_t diffSum = 0;
@@ -181,14 +289,8 @@ std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, uin
 
         decoder = bestResults.bestDecoder; 
         result[i-1] = bestResults.bestIndex;
-        squaredSum += bestResults.bestDiff;
-
-
-        // if (i % 10 == 0) printf("%d\n", i);
     }
 
-    // printf("sum: %ld\n", squaredSum);
-
     std::vector<uint8_t> nibbles(result.size() * combinedNibbles);
     for (size_t i = 0; i < result.size(); ++i)
     {
@@ -212,145 +314,29 @@ std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, uin
 }
 
 
-struct TrellisBranch
+std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedNibbles, EncodeCheckpoint* checkpoint)
 {
-    TrellisBranch(uint8_t firstValue) :
-        decoder(firstValue)
-    {
-    }
-
-    TrellisBranch(const CreativeAdpcmDecoder4Bit& dec, std::shared_ptr<TrellisBranch> p, uint8_t nib, uint64_t diff) :
-        decoder(dec), parent(p), nibble(nib), squaredDiff(diff)
-    {
-    }
-    
-    CreativeAdpcmDecoder4Bit decoder;
-    std::shared_ptr<TrellisBranch> parent;  // Points to parent branch instead of copying history
-    uint8_t nibble = 0;                      // Only this branch's nibble
-    uint64_t squaredDiff = 0;
-};
-
-// Reconstruct history by walking back through parent pointers
-std::vector<uint8_t> reconstructHistory(const std::shared_ptr<TrellisBranch>& branch) {
-    std::vector<uint8_t> history;
-    auto current = branch;
-    
-    // Walk back through parents, collecting nibbles
-    while (current->parent) {
-        history.push_back(current->nibble);
-        current = current->parent;
-    }
-    
-    // Reverse because we collected from end to beginning
-    std::reverse(history.begin(), history.end());
-    return history;
+    return dispatchCombinedLevel(combinedNibbles, [&](auto level) {
+        return createAdpcm4BitFromRaw<level()>(raw, checkpoint);
+    });
 }
 
 
-std::vector<uint8_t> createAdpcm4BitFromRawTrellis(const std::vector<uint8_t>& raw, uint32_t maxBranches)
+std::vector<uint8_t> createAdpcm4BitFromRawAdaptive(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError)
 {
-    assert(!raw.empty());
-
-    int randomBranches = maxBranches / 2; // 50% random branches
-    
-    // Initialize random number generator
-    std::random_device rd;
-    std::mt19937 gen(rd());
-
-    // Initialize trellis branches, we need maxBranches * 16 + maxBranches branches to cover all possibilities
-    std::vector<std::shared_ptr<TrellisBranch>> trellisBranches;
-    for (int i = 0; i < maxBranches * 16 + maxBranches; ++i)
-    {
-        auto branch = std::make_shared<TrellisBranch>(raw.front());
-        trellisBranches.push_back(branch);
-    }
-
-    for (int pos = 1; pos < raw.size(); ++pos)
-    {
-        // first sort branches by squaredDiff
-        std::sort(trellisBranches.begin(), trellisBranches.begin() + maxBranches * 16,
-            [](const std::shared_ptr<TrellisBranch>& a, const std::shared_ptr<TrellisBranch>& b)
-            {
-                return a->squaredDiff < b->squaredDiff;
-            });
-        
-        // Select random branches from the sorted list (excluding the best ones we'll keep anyway)
-        // We sample from branches beyond the top (maxBranches - randomBranches) to add diversity
-        int numBestBranches = maxBranches - randomBranches;
-        if (maxBranches * 16 > numBestBranches + randomBranches)
-        {
-            // Create a distribution for selecting random branches from the remaining pool
-            std::uniform_int_distribution<> distrib(numBestBranches, maxBranches * 16 - 1);
-            
-            // Collect random indices
-            std::vector<int> randomIndices;
-            for (int i = 0; i < randomBranches; ++i)
-            {
-                randomIndices.push_back(distrib(gen));
-            }
-            
-            // Sort random indices to avoid duplicates and maintain order
-            std::sort(randomIndices.begin(), randomIndices.end());
-            randomIndices.erase(std::unique(randomIndices.begin(), randomIndices.end()), randomIndices.end());
-            
-            // Move random branches to fill the slots after the best branches
-            int targetSlot = numBestBranches;
-            for (int srcIdx : randomIndices)
-            {
-                if (targetSlot < maxBranches)
-                {
-                    std::swap(trellisBranches[targetSlot], trellisBranches[srcIdx]);
-                    ++targetSlot;
-                }
-            }
-        }
-        
-        // std::cout << "Best diff: " << trellisBranches.front()->squaredDiff << "\n";
-
-        #pragma omp parallel for
-        for (int branchNo = 0; branchNo < maxBranches; ++branchNo)
-        {
-            for (uint8_t nibble = 0; nibble < 16; ++nibble)
-            {
-                auto& currentBranch = trellisBranches[branchNo];
-                auto decoderCopy = currentBranch->decoder;
-                uint8_t decodedValue = decoderCopy.decodeNibble(nibble);
-                int32_t diff = (int32_t)decodedValue - (int32_t)raw[pos];
-                uint64_t newSquaredDiff = currentBranch->squaredDiff + diff * diff;
-                auto& newBranch = trellisBranches[ maxBranches + branchNo * 16 + nibble ];
-                
-                // Create new branch using the constructor that links to parent
-                newBranch = std::make_shared<TrellisBranch>(decoderCopy, currentBranch, nibble, newSquaredDiff);
-            }
-        }
-
-        // move the first maxBranches branches to the back, so they will be ignored in next sorting
-        std::rotate(trellisBranches.begin(), trellisBranches.begin() + maxBranches, trellisBranches.begin() + maxBranches * 17);
-    }
-
-    // find best branch
-    std::shared_ptr<TrellisBranch> bestBranch = trellisBranches.front();
-    for (int i = 0; i < maxBranches * 16; ++i)
-    {
-        if (trellisBranches[i]->squaredDiff < bestBranch->squaredDiff)
-        {
-            bestBranch = trellisBranches[i];
-        }
-    }
+    return encodeAdaptiveLevel(raw, maxLevel, maxError, expandAdpcm4Nibbles);
+}
 
-    // Reconstruct history by walking back through parent chain
-    std::vector<uint8_t> nibbles = reconstructHistory(bestBranch);
-    std::vector<uint8_t> binaryResult(nibbles.size() / 2);
 
-    // merge nibbles into bytes
-    for (size_t n = 0; n < nibbles.size() / 2; ++n)
-    {
-        binaryResult[n] = ((nibbles[2 * n] << 4) + (nibbles[2 * n + 1]));
-    }
+std::vector<uint8_t> createAdpcm4BitFromRawTimeLimited(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline)
+{
+    return encodeTimeLimited(raw, deadline, expandAdpcm4Nibbles);
+}
 
-    binaryResult.insert(binaryResult.begin(), raw[0]);
 
-    return binaryResult;
+std::vector<uint8_t> createAdpcm4BitFromRawTrellis(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed, double diversity, EncodeCheckpoint* checkpoint)
+{
+    return encodeTrellis(raw, maxBranches, seed, diversity, expandAdpcm4Nibbles, checkpoint);
 }
 
 
@@ -363,20 +349,24 @@ struct Best2bit
     CreativeAdpcmDecoder2Bit bestDecoder = CreativeAdpcmDecoder2Bit(0);
 };
 
-std::vector<uint8_t> createAdpcm2BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedSamples)
+template <uint64_t combinedSamples>
+std::vector<uint8_t> createAdpcm2BitFromRaw(const std::vector<uint8_t>& raw)
 {
-    uint64_t squaredSum = 0u;
+    constexpr uint64_t candidateCount = constPow(4, combinedSamples);
 
     CreativeAdpcmDecoder2Bit decoder(raw[0]);
     
     std::vector<uint64_t> result(raw.size() / combinedSamples);
+    ProgressStage progress("Encoding ADPCM2", raw.size());
 
     for (size_t i = 1; i < raw.size() / combinedSamples; ++i)
     {
+        progress.update(i * combinedSamples);
+
         Best2bit bestResults;
 
         // try every possible input for the decoder
-        for (uint64_t n = 0; n < constPow(4, combinedSamples); ++n)
+        for (uint64_t n = 0; n < candidateCount; ++n)
         {
             CreativeAdpcmDecoder2Bit decoderCopy = decoder;
             uint64_t diffSum = 0;
@@ -396,14 +386,8 @@ std::vector<uint8_t> createAdpcm2BitFromRaw(const std::vector<uint8_t>& raw, uin
 
         decoder = bestResults.bestDecoder; 
         result[i-1] = bestResults.bestIndex;
-        squaredSum += bestResults.bestDiff;
-
-
-        // if (i % 10 == 0) printf("%d\n", i);
     }
 
-    // printf("sum: %ld\n", squaredSum);
-
     std::vector<uint8_t> nibbles(result.size() * combinedSamples);
     for (size_t i = 0; i < result.size(); ++i)
     {
@@ -429,3 +413,11 @@ std::vector<uint8_t> createAdpcm2BitFromRaw(const std::vector<uint8_t>& raw, uin
 
     return binaryResult;
 }
+
+
+std::vector<uint8_t> createAdpcm2BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedSamples)
+{
+    return dispatchCombinedLevel(combinedSamples, [&](auto level) {
+        return createAdpcm2BitFromRaw<level()>(raw);
+    });
+}
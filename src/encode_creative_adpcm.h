@@ -1,11 +1,48 @@
 #ifndef ENCODE_CREATIVE_ADPCM_H
+#define ENCODE_CREATIVE_ADPCM_H
 
 #include <vector>
 #include <cstdint>
+#include <chrono>
+
+class EncodeCheckpoint;
+
+/**
+ * @brief Decodes all 16 nibbles from one decoder state. The Expand function of
+ *        DecoderStateSearch and TrellisSearch for the encoders without SIMD.
+ */
+void expandAdpcm4Nibbles(uint8_t accumulator, uint8_t previous, uint8_t target, uint8_t* childAccumulators, uint8_t* childPrevious, uint32_t* squaredDiffs);
 
 std::vector<uint8_t> createAdpcm4BitFromRawOpenMP(const std::vector<uint8_t>& raw, uint64_t combinedNibbles = 5);
-std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedNibbles = 4);
-std::vector<uint8_t> createAdpcm4BitFromRawTrellis(const std::vector<uint8_t>& raw, uint32_t maxBranches);
+/**
+ * @brief Encodes groups of combinedNibbles samples with the combined search. If a checkpoint is
+ *        given, the encode continues after its stored nibbles and stores its progress in it.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedNibbles = 4, EncodeCheckpoint* checkpoint = nullptr);
+
+/**
+ * @brief Encodes with a level per group: level 1 where its average squared error per sample is
+ *        at most maxError, maxLevel where it is higher or where the signal changes faster than
+ *        the decoder can follow. See encodeAdaptiveLevel().
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawAdaptive(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError);
+
+/**
+ * @brief Encodes greedily, then improves the result in windows until the deadline.
+ *        See encodeTimeLimited().
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawTimeLimited(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline);
+
+/**
+ * @brief Encodes using a trellis search that keeps maxBranches branches per sample.
+ *
+ * Branches that reach the same decoder state are merged. The given fraction (diversity) of
+ * the kept branches is chosen randomly instead of by lowest error. The random choice only
+ * depends on seed, so the same input and seed always produce the same output. If a checkpoint
+ * is given, the segments stored in it are not searched again and finished segments are stored in it.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawTrellis(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed = 0, double diversity = 0.5, EncodeCheckpoint* checkpoint = nullptr);
+
 std::vector<uint8_t> createAdpcm2BitFromRaw(const std::vector<uint8_t>& raw, uint64_t combinedSamples = 4);
 
 #endif
@@ -1,4 +1,11 @@
 #include "encode_creative_adpcm_neon.h"
+#include "encode_level_dispatch.h"
+#include "encode_state_search.h"
+#include "encode_trellis.h"
+#include "encode_adaptive_level.h"
+#include "encode_time_limited.h"
+#include "encode_checkpoint.h"
+#include "progress.h"
 
 #include <limits>
 #include <cstddef>
@@ -39,7 +46,8 @@ void calculateAllNibbles(uint8x16_t& previous, uint8x16_t& accumulators)
 }
 
 
-void calculateStepRecursively(const uint8_t *data, uint8_t accumulator, uint8_t previous, size_t squaredDiff, uint64_t history, size_t recursionDepth, BestStep& bestStep)
+template <int Depth>
+void calculateStepRecursively(const uint8_t *data, uint8_t accumulator, uint8_t previous, size_t squaredDiff, uint64_t history, BestStep& bestStep)
 {
     uint8x16_t accumulators = vdupq_n_u8(accumulator);
     uint8x16_t previousValues = vdupq_n_u8(previous);
@@ -48,55 +56,100 @@ void calculateStepRecursively(const uint8_t *data, uint8_t accumulator, uint8_t
 
     uint8x16_t diff = vbslq_u8(vcgtq_u8(previousValues, vdupq_n_u8(*data)), vsubq_u8(previousValues, vdupq_n_u8(*data)), vsubq_u8(vdupq_n_u8(*data), previousValues));
 
-    if (recursionDepth != 0)
+    uint8_t accumulatorArray[16];
+    uint8_t previousArray[16];
+    uint8_t diffArray[16];
+    vst1q_u8(accumulatorArray, accumulators);
+    vst1q_u8(previousArray, previousValues);
+    vst1q_u8(diffArray, diff);
+
+    if constexpr (Depth != 0)
     {
-        for (size_t i = 0; i < 16; ++i)
+        for (uint64_t i = 0; i < 16; ++i)
         {
-            calculateStepRecursively(data + 1, accumulators[i], previousValues[i], squaredDiff + square(diff[i]), history | (i << (4 * recursionDepth)), recursionDepth - 1, bestStep);
+            calculateStepRecursively<Depth - 1>(data + 1, accumulatorArray[i], previousArray[i], squaredDiff + square(diffArray[i]), history | (i << (4 * Depth)), bestStep);
         }
     }
     else
     {
-        for (size_t i = 0; i < 16; ++i)
+        for (uint64_t i = 0; i < 16; ++i)
         {
-            auto currentDiff = squaredDiff + square(diff[i]);
+            auto currentDiff = squaredDiff + square(diffArray[i]);
             if (currentDiff < bestStep.squaredDiff)
             {
                 bestStep.squaredDiff = currentDiff;
-                bestStep.accumulator = accumulators[i];
-                bestStep.previous = previousValues[i];
-                bestStep.history = history | (i << (4 * recursionDepth));
+                bestStep.accumulator = accumulatorArray[i];
+                bestStep.previous = previousArray[i];
+                bestStep.history = history | i;
             }
         }
     }
 }
 
-} // annonymous namespace
+/**
+ * Decodes all 16 nibbles from one decoder state, used by DecoderStateSearch and TrellisSearch.
+ */
+void expandAllNibbles(uint8_t accumulator, uint8_t previous, uint8_t target, uint8_t* childAccumulators, uint8_t* childPrevious, uint32_t* squaredDiffs)
+{
+    uint8x16_t accumulators = vdupq_n_u8(accumulator);
+    uint8x16_t previousValues = vdupq_n_u8(previous);
+    calculateAllNibbles(previousValues, accumulators);
+
+    uint8x16_t diff = vabdq_u8(previousValues, vdupq_n_u8(target));
+    uint16x8_t squaredLow = vmull_u8(vget_low_u8(diff), vget_low_u8(diff));
+    uint16x8_t squaredHigh = vmull_u8(vget_high_u8(diff), vget_high_u8(diff));
+
+    vst1q_u8(childAccumulators, accumulators);
+    vst1q_u8(childPrevious, previousValues);
+    vst1q_u32(squaredDiffs, vmovl_u16(vget_low_u16(squaredLow)));
+    vst1q_u32(squaredDiffs + 4, vmovl_u16(vget_high_u16(squaredLow)));
+    vst1q_u32(squaredDiffs + 8, vmovl_u16(vget_low_u16(squaredHigh)));
+    vst1q_u32(squaredDiffs + 12, vmovl_u16(vget_high_u16(squaredHigh)));
+}
 
-std::vector<uint8_t> createAdpcm4BitFromRawNeon(const std::vector<uint8_t>& raw, [[maybe_unused]] uint64_t combinedNibbles)
+// Below this level the exhaustive search is cheaper than maintaining the state table.
+constexpr int stateSearchMinimumLevel = 4;
+
+template <int CombinedNibbles>
+std::vector<uint8_t> createAdpcm4BitFromRawNeon(const std::vector<uint8_t>& raw, EncodeCheckpoint* checkpoint)
 {
-    uint64_t squaredSum = 0u;
-    std::vector<uint8_t> nibbles;
+    DecoderStateSearch stateSearch;
+
+    auto resumed = resumeSequentialEncode(checkpoint, raw, CombinedNibbles);
+    std::vector<uint8_t> nibbles = std::move(resumed.nibbles);
     nibbles.reserve(raw.size());
 
     BestStep bestStep;
-    bestStep.accumulator = 1;
-    bestStep.previous = raw[0];
+    bestStep.accumulator = resumed.accumulator;
+    bestStep.previous = resumed.previous;
     bestStep.squaredDiff = std::numeric_limits<size_t>::max();
+    ProgressStage progress("Encoding ADPCM4", raw.size());
 
-    for (size_t i = 1; i < raw.size() - combinedNibbles; i += combinedNibbles)
+    for (size_t i = 1 + nibbles.size(); i + CombinedNibbles < raw.size(); i += CombinedNibbles)
     {
-        uint8x16_t accumulators = vdupq_n_u8(bestStep.accumulator);
-        uint8x16_t previous = vdupq_n_u8(bestStep.previous);
-        bestStep.squaredDiff = std::numeric_limits<size_t>::max();
-        calculateStepRecursively(&raw[i], accumulators[0], previous[0], 0, 0, combinedNibbles - 1, bestStep);
+        progress.update(i);
 
-        for (int n = combinedNibbles - 1; n >= 0; --n)
+        if (checkpoint && checkpoint->due())
         {
-            nibbles.push_back((bestStep.history >> (4 * n)) & 0xf);
+            checkpoint->store(0, nibbles);
+        }
+
+        if constexpr (CombinedNibbles >= stateSearchMinimumLevel)
+        {
+            auto result = stateSearch.search(&raw[i], CombinedNibbles, bestStep.accumulator, bestStep.previous, expandAllNibbles,
+                [](uint64_t history, uint64_t nibble, int) { return (history << 4) | nibble; });
+            bestStep = { result.accumulator, result.previous, result.squaredDiff, result.history };
+        }
+        else
+        {
+            bestStep.squaredDiff = std::numeric_limits<size_t>::max();
+            calculateStepRecursively<CombinedNibbles - 1>(&raw[i], bestStep.accumulator, bestStep.previous, 0, 0, bestStep);
         }
 
-        squaredSum += bestStep.squaredDiff;
+        for (int n = CombinedNibbles - 1; n >= 0; --n)
+        {
+            nibbles.push_back((bestStep.history >> (4 * n)) & 0xf);
+        }
     }
 
     std::vector<uint8_t> binaryResult(nibbles.size() / 2);
@@ -111,3 +164,27 @@ std::vector<uint8_t> createAdpcm4BitFromRawNeon(const std::vector<uint8_t>& raw,
 
     return binaryResult;
 }
+
+} // annonymous namespace
+
+std::vector<uint8_t> createAdpcm4BitFromRawNeon(const std::vector<uint8_t>& raw, uint64_t combinedNibbles, EncodeCheckpoint* checkpoint)
+{
+    return dispatchCombinedLevel(combinedNibbles, [&](auto level) {
+        return createAdpcm4BitFromRawNeon<level()>(raw, checkpoint);
+    });
+}
+
+std::vector<uint8_t> createAdpcm4BitFromRawAdaptiveNeon(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError)
+{
+    return encodeAdaptiveLevel(raw, maxLevel, maxError, expandAllNibbles);
+}
+
+std::vector<uint8_t> createAdpcm4BitFromRawTimeLimitedNeon(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline)
+{
+    return encodeTimeLimited(raw, deadline, expandAllNibbles);
+}
+
+std::vector<uint8_t> createAdpcm4BitFromRawTrellisNeon(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed, double diversity, EncodeCheckpoint* checkpoint)
+{
+    return encodeTrellis(raw, maxBranches, seed, diversity, expandAllNibbles, checkpoint);
+}
@@ -3,7 +3,25 @@
 
 #include <vector>
 #include <cstdint>
+#include <chrono>
 
-std::vector<uint8_t> createAdpcm4BitFromRawNeon(const std::vector<uint8_t>& raw, [[maybe_unused]] uint64_t combinedNibbles = 5);
+class EncodeCheckpoint;
+
+std::vector<uint8_t> createAdpcm4BitFromRawNeon(const std::vector<uint8_t>& raw, [[maybe_unused]] uint64_t combinedNibbles = 5, EncodeCheckpoint* checkpoint = nullptr);
+
+/**
+ * Same as createAdpcm4BitFromRawAdaptive(), the children of the searched decoder states are calculated using NEON.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawAdaptiveNeon(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError);
+
+/**
+ * Same as createAdpcm4BitFromRawTimeLimited(), the children of the searched decoder states are calculated using NEON.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawTimeLimitedNeon(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline);
+
+/**
+ * Same as createAdpcm4BitFromRawTrellis(), the children of the trellis branches are calculated using NEON.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawTrellisNeon(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed = 0, double diversity = 0.5, EncodeCheckpoint* checkpoint = nullptr);
 
 #endif
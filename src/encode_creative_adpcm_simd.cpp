@@ -1,8 +1,22 @@
 #include "encode_creative_adpcm_simd.h"
 
+#include "decode_creative_adpcm.h"
+#include "encode_level_dispatch.h"
+#include "encode_state_search.h"
+#include "encode_trellis.h"
+#include "encode_adaptive_level.h"
+#include "encode_time_limited.h"
+#include "encode_checkpoint.h"
+#include "progress.h"
+#include "execution_context.h"
+
 #include "vectorclass.h"
 
 #include <limits>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
 
 struct BestStep
 {
@@ -36,7 +50,8 @@ void calculateAllNibbles(Vec16uc& previous, Vec16uc& accumulators)
 }
 
 
-void calculateStepRecursively(const uint8_t *data, uint8_t accumulator, uint8_t previous, size_t squaredDiff, uint64_t history, size_t recursionDepth, BestStep& bestStep)
+template <int Depth>
+void calculateStepRecursively(const uint8_t *data, uint8_t accumulator, uint8_t previous, size_t squaredDiff, uint64_t history, BestStep& bestStep)
 {
     Vec16uc accumulators(accumulator);
     Vec16uc previousValues(previous);
@@ -45,53 +60,100 @@ void calculateStepRecursively(const uint8_t *data, uint8_t accumulator, uint8_t
 
     Vec16uc diff = select(previousValues > *data, previousValues - (*data), (*data) - previousValues);
 
-    if (recursionDepth != 0)
+    uint8_t accumulatorArray[16];
+    uint8_t previousArray[16];
+    uint8_t diffArray[16];
+    accumulators.store(accumulatorArray);
+    previousValues.store(previousArray);
+    diff.store(diffArray);
+
+    if constexpr (Depth != 0)
     {
-        for (size_t i = 0; i < 16; ++i)
+        for (uint64_t i = 0; i < 16; ++i)
         {
-            calculateStepRecursively(data + 1, accumulators[i], previousValues[i], squaredDiff + square(diff[i]), history | (i << (4 * recursionDepth)), recursionDepth - 1, bestStep);
+            calculateStepRecursively<Depth - 1>(data + 1, accumulatorArray[i], previousArray[i], squaredDiff + square(diffArray[i]), history | (i << (4 * Depth)), bestStep);
         }
     }
     else
     {
-        for (size_t i = 0; i < 16; ++i)
+        for (uint64_t i = 0; i < 16; ++i)
         {
-            auto currentDiff = squaredDiff + square(diff[i]);
+            auto currentDiff = squaredDiff + square(diffArray[i]);
             if (currentDiff < bestStep.squaredDiff)
             {
                 bestStep.squaredDiff = currentDiff;
-                bestStep.accumulator = accumulators[i];
-                bestStep.previous = previousValues[i];
-                bestStep.history = history | (i << (4 * recursionDepth));
+                bestStep.accumulator = accumulatorArray[i];
+                bestStep.previous = previousArray[i];
+                bestStep.history = history | i;
             }
         }
     }
 }
 
-std::vector<uint8_t> createAdpcm4BitFromRawSIMD(const std::vector<uint8_t>& raw, [[maybe_unused]] uint64_t combinedNibbles)
+namespace { // annonymous namespace
+
+/**
+ * Decodes all 16 nibbles from one decoder state, used by DecoderStateSearch and TrellisSearch.
+ */
+void expandAllNibbles(uint8_t accumulator, uint8_t previous, uint8_t target, uint8_t* childAccumulators, uint8_t* childPrevious, uint32_t* squaredDiffs)
 {
-    uint64_t squaredSum = 0u;
-    std::vector<uint8_t> nibbles;
+    Vec16uc accumulators(accumulator);
+    Vec16uc previousValues(previous);
+    calculateAllNibbles(previousValues, accumulators);
+
+    Vec16uc diff = select(previousValues > target, previousValues - target, target - previousValues);
+    Vec16us diff16 = extend(diff);
+
+    accumulators.store(childAccumulators);
+    previousValues.store(childPrevious);
+    Vec16ui(extend(diff16 * diff16)).store(squaredDiffs);
+}
+
+} // annonymous namespace
+
+// Below this level the exhaustive search is cheaper than maintaining the state table.
+constexpr int stateSearchMinimumLevel = 4;
+
+template <int CombinedNibbles>
+std::vector<uint8_t> createAdpcm4BitFromRawSIMD(const std::vector<uint8_t>& raw, EncodeCheckpoint* checkpoint)
+{
+    DecoderStateSearch stateSearch;
+
+    auto resumed = resumeSequentialEncode(checkpoint, raw, CombinedNibbles);
+    std::vector<uint8_t> nibbles = std::move(resumed.nibbles);
     nibbles.reserve(raw.size());
 
     BestStep bestStep;
-    bestStep.accumulator = 1;
-    bestStep.previous = raw[0];
+    bestStep.accumulator = resumed.accumulator;
+    bestStep.previous = resumed.previous;
     bestStep.squaredDiff = std::numeric_limits<size_t>::max();
+    ProgressStage progress("Encoding ADPCM4", raw.size());
 
-    for (size_t i = 1; i < raw.size() - combinedNibbles; i += combinedNibbles)
+    for (size_t i = 1 + nibbles.size(); i + CombinedNibbles < raw.size(); i += CombinedNibbles)
     {
-        Vec16uc accumulators(bestStep.accumulator);
-        Vec16uc previous(bestStep.previous);
-        bestStep.squaredDiff = std::numeric_limits<size_t>::max();
-        calculateStepRecursively(&raw[i], accumulators[0], previous[0], 0, 0, combinedNibbles - 1, bestStep);
+        progress.update(i);
 
-        for (int n = combinedNibbles - 1; n >= 0; --n)
+        if (checkpoint && checkpoint->due())
         {
-            nibbles.push_back((bestStep.history >> (4 * n)) & 0xf);
+            checkpoint->store(0, nibbles);
         }
 
-        squaredSum += bestStep.squaredDiff;
+        if constexpr (CombinedNibbles >= stateSearchMinimumLevel)
+        {
+            auto result = stateSearch.search(&raw[i], CombinedNibbles, bestStep.accumulator, bestStep.previous, expandAllNibbles,
+                [](uint64_t history, uint64_t nibble, int) { return (history << 4) | nibble; });
+            bestStep = { result.accumulator, result.previous, result.squaredDiff, result.history };
+        }
+        else
+        {
+            bestStep.squaredDiff = std::numeric_limits<size_t>::max();
+            calculateStepRecursively<CombinedNibbles - 1>(&raw[i], bestStep.accumulator, bestStep.previous, 0, 0, bestStep);
+        }
+
+        for (int n = CombinedNibbles - 1; n >= 0; --n)
+        {
+            nibbles.push_back((bestStep.history >> (4 * n)) & 0xf);
+        }
     }
 
     std::vector<uint8_t> binaryResult(nibbles.size() / 2);
@@ -106,3 +168,323 @@ std::vector<uint8_t> createAdpcm4BitFromRawSIMD(const std::vector<uint8_t>& raw,
 
     return binaryResult;
 }
+
+std::vector<uint8_t> createAdpcm4BitFromRawSIMD(const std::vector<uint8_t>& raw, uint64_t combinedNibbles, EncodeCheckpoint* checkpoint)
+{
+    return dispatchCombinedLevel(combinedNibbles, [&](auto level) {
+        return createAdpcm4BitFromRawSIMD<level()>(raw, checkpoint);
+    });
+}
+
+std::vector<uint8_t> createAdpcm4BitFromRawAdaptiveSIMD(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError)
+{
+    return encodeAdaptiveLevel(raw, maxLevel, maxError, expandAllNibbles);
+}
+
+std::vector<uint8_t> createAdpcm4BitFromRawTimeLimitedSIMD(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline)
+{
+    return encodeTimeLimited(raw, deadline, expandAllNibbles);
+}
+
+std::vector<uint8_t> createAdpcm4BitFromRawTrellisSIMD(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed, double diversity, EncodeCheckpoint* checkpoint)
+{
+    return encodeTrellis(raw, maxBranches, seed, diversity, expandAllNibbles, checkpoint);
+}
+
+
+/*
+ * Batch encoding
+ *
+ * Instead of using the vector lanes for the 16 candidate nibbles of one stream, every lane
+ * holds an independent stream. All lanes follow the same nibble sequence through the
+ * exhaustive search, so one vector operation advances the search of all streams at once.
+ * The number of lanes follows the widest byte vector of the target instruction set.
+ * From stateSearchMinimumLevel on the state table search of every single lane is faster
+ * than the exhaustive search of all lanes, so the lanes are searched one after another.
+ */
+namespace { // annonymous namespace
+
+#if INSTRSET >= 10
+using LaneVector = Vec64uc;
+#elif INSTRSET >= 8
+using LaneVector = Vec32uc;
+#else
+using LaneVector = Vec16uc;
+#endif
+
+constexpr int laneCount = LaneVector::size();
+constexpr int laneBlocks = laneCount / 16;     // 32 bit costs are kept in blocks of 16 lanes
+
+using LaneCosts = std::array<Vec16ui, laneBlocks>;
+
+void splitLanes(const Vec16uc& value, Vec16uc* parts)
+{
+    parts[0] = value;
+}
+
+#if INSTRSET >= 8
+void splitLanes(const Vec32uc& value, Vec16uc* parts)
+{
+    splitLanes(value.get_low(), parts);
+    splitLanes(value.get_high(), parts + 1);
+}
+#endif
+
+#if INSTRSET >= 10
+void splitLanes(const Vec64uc& value, Vec16uc* parts)
+{
+    splitLanes(value.get_low(), parts);
+    splitLanes(value.get_high(), parts + 2);
+}
+#endif
+
+/**
+ * Decodes the same nibble in every lane.
+ */
+void decodeNibbleLanes(uint8_t nibble, LaneVector& previous, LaneVector& accumulators)
+{
+    uint8_t data = nibble & 7;
+    LaneVector delta = accumulators * LaneVector(data) + (accumulators >> 1);
+
+    previous = (nibble & 8) ? add_saturated(previous, delta) : sub_saturated(previous, delta);
+
+    if (data == 0)
+    {
+        accumulators = select(accumulators > 1, accumulators >> 1, accumulators);
+    }
+    else if (data >= 5)
+    {
+        accumulators = select(accumulators < 8, accumulators << 1, accumulators);
+    }
+}
+
+struct LaneSearch
+{
+    const LaneVector* targets;
+    int levels;
+    LaneCosts bestCost;
+    LaneCosts bestHistory;
+};
+
+void searchLanes(LaneSearch& search, int depth, const LaneVector& accumulators, const LaneVector& previous, const LaneCosts& cost, uint32_t history)
+{
+    const LaneVector& target = search.targets[depth];
+    int shift = 4 * (search.levels - 1 - depth);
+
+    for (uint8_t nibble = 0; nibble < 16; ++nibble)
+    {
+        LaneVector childAccumulators = accumulators;
+        LaneVector childPrevious = previous;
+        decodeNibbleLanes(nibble, childPrevious, childAccumulators);
+
+        LaneVector diff = sub_saturated(childPrevious, target) | sub_saturated(target, childPrevious);
+        Vec16uc parts[laneBlocks];
+        splitLanes(diff, parts);
+
+        LaneCosts childCost;
+        for (int block = 0; block < laneBlocks; ++block)
+        {
+            Vec16us diff16 = extend(parts[block]);
+            childCost[block] = cost[block] + extend(diff16 * diff16);
+        }
+
+        uint32_t childHistory = history | (nibble << shift);
+        if (depth + 1 < search.levels)
+        {
+            searchLanes(search, depth + 1, childAccumulators, childPrevious, childCost, childHistory);
+        }
+        else
+        {
+            for (int block = 0; block < laneBlocks; ++block)
+            {
+                Vec16ib better = childCost[block] < search.bestCost[block];
+                search.bestCost[block] = select(better, childCost[block], search.bestCost[block]);
+                search.bestHistory[block] = select(better, Vec16ui(childHistory), search.bestHistory[block]);
+            }
+        }
+    }
+}
+
+struct Lane
+{
+    int64_t stream = -1;
+    size_t position = 0;
+    uint8_t accumulator = 1;
+    uint8_t previous = 0;
+    std::vector<uint8_t> nibbles;
+};
+
+std::vector<uint8_t> mergeNibbles(const std::vector<uint8_t>& nibbles, uint8_t first)
+{
+    std::vector<uint8_t> binaryResult(nibbles.size() / 2);
+
+    // merge nibbles into bytes
+    for (size_t n = 0; n < nibbles.size() / 2; ++n)
+    {
+        binaryResult[n] = ((nibbles[2 * n] << 4) + (nibbles[2 * n + 1]));
+    }
+
+    binaryResult.insert(binaryResult.begin(), first);
+
+    return binaryResult;
+}
+
+} // annonymous namespace
+
+std::vector<std::vector<uint8_t>> createAdpcm4BitBatchSIMD(const std::vector<std::vector<uint8_t>>& raws, uint64_t combinedNibbles)
+{
+    if (combinedNibbles < 1 || combinedNibbles > 8)
+    {
+        throw std::runtime_error("Level must be between 1 and 8");
+    }
+    for (auto& raw : raws)
+    {
+        if (raw.empty())
+        {
+            throw std::runtime_error("Cannot encode empty sample data");
+        }
+    }
+
+    int levels = static_cast<int>(combinedNibbles);
+    std::vector<std::vector<uint8_t>> results(raws.size());
+    std::atomic<size_t> nextStream = 0;
+
+    size_t totalSamples = 0;
+    for (auto& raw : raws)
+    {
+        totalSamples += raw.size();
+    }
+    ProgressStage progress("Encoding ADPCM4", totalSamples);
+
+    #pragma omp parallel num_threads(ExecutionContext::threads())
+    {
+        std::array<Lane, laneCount> lanes;
+        std::array<std::array<uint8_t, laneCount>, 8> targetValues = {};
+        std::array<uint8_t, laneCount> accumulatorValues;
+        std::array<uint8_t, laneCount> previousValues;
+        std::array<uint32_t, laneCount> historyValues;
+        LaneVector targets[8];
+        DecoderStateSearch stateSearch;
+
+        // assigns the next stream that needs encoding to the lane, finishes streams without any full group
+        auto assignStream = [&](Lane& lane)
+        {
+            lane.stream = -1;
+            while (true)
+            {
+                size_t stream = nextStream++;
+                if (stream >= raws.size())
+                {
+                    return;
+                }
+                const auto& raw = raws[stream];
+                if (1 + combinedNibbles < raw.size())
+                {
+                    lane.stream = stream;
+                    lane.position = 1;
+                    lane.accumulator = 1;
+                    lane.previous = raw[0];
+                    lane.nibbles.clear();
+                    return;
+                }
+                results[stream] = mergeNibbles({}, raw[0]);
+            }
+        };
+
+        for (auto& lane : lanes)
+        {
+            assignStream(lane);
+        }
+
+        while (std::any_of(lanes.begin(), lanes.end(), [](const Lane& lane) { return lane.stream >= 0; }))
+        {
+            size_t activeLanes = std::count_if(lanes.begin(), lanes.end(), [](const Lane& lane) { return lane.stream >= 0; });
+            if (!progress.add(activeLanes * combinedNibbles))
+            {
+                break;
+            }
+
+            if (levels >= stateSearchMinimumLevel)
+            {
+                // the state table search of a single stream is faster than the exhaustive search of all lanes
+                for (int l = 0; l < laneCount; ++l)
+                {
+                    const Lane& lane = lanes[l];
+                    if (lane.stream >= 0)
+                    {
+                        auto result = stateSearch.search(&raws[lane.stream][lane.position], levels, lane.accumulator, lane.previous, expandAllNibbles,
+                            [](uint64_t history, uint64_t nibble, int) { return (history << 4) | nibble; });
+                        historyValues[l] = static_cast<uint32_t>(result.history);
+                    }
+                }
+            }
+            else
+            {
+                for (int l = 0; l < laneCount; ++l)
+                {
+                    const Lane& lane = lanes[l];
+                    accumulatorValues[l] = lane.accumulator;
+                    previousValues[l] = lane.previous;
+                    for (int d = 0; d < levels; ++d)
+                    {
+                        targetValues[d][l] = lane.stream >= 0 ? raws[lane.stream][lane.position + d] : 0;
+                    }
+                }
+                for (int d = 0; d < levels; ++d)
+                {
+                    targets[d].load(targetValues[d].data());
+                }
+
+                LaneSearch search;
+                search.targets = targets;
+                search.levels = levels;
+                search.bestCost.fill(Vec16ui(std::numeric_limits<uint32_t>::max()));
+                search.bestHistory.fill(Vec16ui(0));
+                LaneCosts cost;
+                cost.fill(Vec16ui(0));
+                searchLanes(search,
+                    0,
+                    LaneVector().load(accumulatorValues.data()),
+                    LaneVector().load(previousValues.data()),
+                    cost,
+                    0);
+
+                for (int block = 0; block < laneBlocks; ++block)
+                {
+                    search.bestHistory[block].store(historyValues.data() + 16 * block);
+                }
+            }
+
+            for (int l = 0; l < laneCount; ++l)
+            {
+                Lane& lane = lanes[l];
+                if (lane.stream < 0)
+                {
+                    continue;
+                }
+
+                // replay the best nibbles to get the decoder state for the next group
+                CreativeAdpcmDecoder4Bit decoder(lane.previous, lane.accumulator);
+                for (int n = levels - 1; n >= 0; --n)
+                {
+                    uint8_t nibble = (historyValues[l] >> (4 * n)) & 0xf;
+                    decoder.decodeNibble(nibble);
+                    lane.nibbles.push_back(nibble);
+                }
+                lane.accumulator = decoder.accumulator();
+                lane.previous = decoder.previous();
+                lane.position += combinedNibbles;
+
+                const auto& raw = raws[lane.stream];
+                if (lane.position >= raw.size() - combinedNibbles)
+                {
+                    results[lane.stream] = mergeNibbles(lane.nibbles, raw[0]);
+                    assignStream(lane);
+                }
+            }
+        }
+    }
+    progress.throwIfCancelled();
+
+    return results;
+}
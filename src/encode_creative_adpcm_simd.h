@@ -5,7 +5,34 @@
 
 #include <vector>
 #include <cstdint>
+#include <chrono>
 
-std::vector<uint8_t> createAdpcm4BitFromRawSIMD(const std::vector<uint8_t>& raw, [[maybe_unused]] uint64_t combinedNibbles = 5);
+class EncodeCheckpoint;
+
+std::vector<uint8_t> createAdpcm4BitFromRawSIMD(const std::vector<uint8_t>& raw, [[maybe_unused]] uint64_t combinedNibbles = 5, EncodeCheckpoint* checkpoint = nullptr);
+
+/**
+ * Same as createAdpcm4BitFromRawAdaptive(), the children of the searched decoder states are calculated using SIMD.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawAdaptiveSIMD(const std::vector<uint8_t>& raw, uint64_t maxLevel, double maxError);
+
+/**
+ * Same as createAdpcm4BitFromRawTimeLimited(), the children of the searched decoder states are calculated using SIMD.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawTimeLimitedSIMD(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline);
+
+/**
+ * Same as createAdpcm4BitFromRawTrellis(), the children of the trellis branches are calculated using SIMD.
+ */
+std::vector<uint8_t> createAdpcm4BitFromRawTrellisSIMD(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed = 0, double diversity = 0.5, EncodeCheckpoint* checkpoint = nullptr);
+
+/**
+ * Encodes many independent streams with the same result as calling
+ * createAdpcm4BitFromRawSIMD() for every stream. Below level 4 every SIMD lane
+ * processes its own stream, so this is much faster for large numbers of short clips.
+ * From level 4 on every stream uses the state table search of the single stream
+ * encoder and only the threads work on different streams.
+ */
+std::vector<std::vector<uint8_t>> createAdpcm4BitBatchSIMD(const std::vector<std::vector<uint8_t>>& raws, uint64_t combinedNibbles = 5);
 
 #endif
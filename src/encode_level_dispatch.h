@@ -0,0 +1,32 @@
+#ifndef ENCODE_LEVEL_DISPATCH_H
+#define ENCODE_LEVEL_DISPATCH_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+/**
+ * Calls function with std::integral_constant<int, level>, so the combined search
+ * of the encoders can be instantiated for every supported level. This allows the
+ * compiler to unroll the search completely and to use constant loop bounds.
+ *
+ * Levels 1 to 8 are supported.
+ */
+template <typename Function>
+auto dispatchCombinedLevel(uint64_t level, Function&& function)
+{
+    switch (level)
+    {
+        case 1: return function(std::integral_constant<int, 1>());
+        case 2: return function(std::integral_constant<int, 2>());
+        case 3: return function(std::integral_constant<int, 3>());
+        case 4: return function(std::integral_constant<int, 4>());
+        case 5: return function(std::integral_constant<int, 5>());
+        case 6: return function(std::integral_constant<int, 6>());
+        case 7: return function(std::integral_constant<int, 7>());
+        case 8: return function(std::integral_constant<int, 8>());
+        default: throw std::runtime_error("Level must be between 1 and 8");
+    }
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef ENCODE_STATE_SEARCH_H
+#define ENCODE_STATE_SEARCH_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+
+/**
+ * Number of different 4bit decoder states.
+ */
+constexpr size_t decoderStateCount = 1024;
+
+/**
+ * Index of a 4bit decoder state (accumulator, previous value) between 0 and 1023.
+ */
+inline uint16_t decoderStateIndex(uint8_t accumulator, uint8_t previous)
+{
+    // accumulator is 1, 2, 4 or 8
+    static constexpr uint8_t accumulatorIndex[9] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+    return (accumulatorIndex[accumulator] << 8) | previous;
+}
+
+/**
+ * Search for the best nibble sequence of one combined step of the 4bit ADPCM encoder
+ * using a transposition table per depth.
+ *
+ * Many nibble sequences lead to the same decoder state (accumulator, previous value)
+ * at the same depth. Their continuations are identical, so only the sequence with the
+ * lowest error so far has to be expanded further. As the accumulator can only be
+ * 1, 2, 4 or 8 there are at most 1024 states per depth, instead of 16^depth sequences.
+ *
+ * If two sequences reach a state with the same error the one with the smaller history
+ * value is kept, so the result is identical to an exhaustive search that visits the
+ * sequences in order of their history value and keeps the first best one.
+ */
+class DecoderStateSearch
+{
+public:
+    struct Result
+    {
+        uint64_t squaredDiff;
+        uint64_t history;
+        uint8_t accumulator;
+        uint8_t previous;
+    };
+
+    DecoderStateSearch()
+    {
+        m_current.reserve(stateCount);
+        m_next.reserve(stateCount);
+        m_present.fill(false);
+    }
+
+    /**
+     * @param data The target samples, levels values are used.
+     * @param levels Number of nibbles to search.
+     * @param expand Function (accumulator, previous, target, childAccumulators[16], childPrevious[16], squaredDiffs[16])
+     *               that decodes all 16 nibbles from the given state.
+     * @param appendHistory Function (history, nibble, depth) returning the history extended by the nibble.
+     */
+    template <typename Expand, typename AppendHistory>
+    Result search(const uint8_t* data, int levels, uint8_t accumulator, uint8_t previous, Expand&& expand, AppendHistory&& appendHistory)
+    {
+        m_current.clear();
+        m_current.push_back(decoderStateIndex(accumulator, previous));
+        m_entries[m_current.front()] = { 0, 0 };
+
+        uint8_t childAccumulators[16];
+        uint8_t childPrevious[16];
+        uint32_t squaredDiffs[16];
+
+        for (int depth = 0; depth < levels; ++depth)
+        {
+            m_next.clear();
+            for (uint16_t state : m_current)
+            {
+                Entry entry = m_entries[state];
+                expand(stateAccumulator(state), statePrevious(state), data[depth], childAccumulators, childPrevious, squaredDiffs);
+
+                for (uint8_t nibble = 0; nibble < 16; ++nibble)
+                {
+                    uint16_t child = decoderStateIndex(childAccumulators[nibble], childPrevious[nibble]);
+                    uint64_t cost = entry.squaredDiff + squaredDiffs[nibble];
+                    uint64_t history = appendHistory(entry.history, nibble, depth);
+
+                    Entry& childEntry = m_nextEntries[child];
+                    if (!m_present[child])
+                    {
+                        m_present[child] = true;
+                        m_next.push_back(child);
+                        childEntry = { cost, history };
+                    }
+                    else if (cost < childEntry.squaredDiff || (cost == childEntry.squaredDiff && history < childEntry.history))
+                    {
+                        childEntry = { cost, history };
+                    }
+                }
+            }
+
+            for (uint16_t state : m_next)
+            {
+                m_present[state] = false;
+            }
+            std::swap(m_current, m_next);
+            std::swap(m_entries, m_nextEntries);
+        }
+
+        Result best = { std::numeric_limits<uint64_t>::max(), 0, 0, 0 };
+        for (uint16_t state : m_current)
+        {
+            const Entry& entry = m_entries[state];
+            if (entry.squaredDiff < best.squaredDiff || (entry.squaredDiff == best.squaredDiff && entry.history < best.history))
+            {
+                best = { entry.squaredDiff, entry.history, stateAccumulator(state), statePrevious(state) };
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Returns the best sequence of the last search that ends in the given decoder state.
+     * squaredDiff is the maximum value if no sequence reaches this state.
+     */
+    Result resultFor(uint8_t accumulator, uint8_t previous) const
+    {
+        uint16_t state = decoderStateIndex(accumulator, previous);
+        if (std::find(m_current.begin(), m_current.end(), state) == m_current.end())
+        {
+            return { std::numeric_limits<uint64_t>::max(), 0, accumulator, previous };
+        }
+        return { m_entries[state].squaredDiff, m_entries[state].history, accumulator, previous };
+    }
+
+private:
+    static constexpr size_t stateCount = decoderStateCount;
+
+    struct Entry
+    {
+        uint64_t squaredDiff;
+        uint64_t history;
+    };
+
+    static uint8_t stateAccumulator(uint16_t state) { return 1 << (state >> 8); }
+    static uint8_t statePrevious(uint16_t state) { return state & 0xff; }
+
+    std::array<Entry, stateCount> m_entries;
+    std::array<Entry, stateCount> m_nextEntries;
+    std::array<bool, stateCount> m_present;
+    std::vector<uint16_t> m_current;
+    std::vector<uint16_t> m_next;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef ENCODE_TIME_LIMITED_H
+#define ENCODE_TIME_LIMITED_H
+
+#include "decode_creative_adpcm.h"
+#include "encode_state_search.h"
+#include "encode_adaptive_level.h"
+#include "encode_trellis.h"
+#include "execution_context.h"
+#include "progress.h"
+
+#include "omp.h"
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+/**
+ * Number of samples of the windows that are optimized by encodeTimeLimited.
+ * The history of DecoderStateSearch holds at most 16 nibbles.
+ */
+constexpr size_t timeLimitedWindowLength = 16;
+
+// the first encode is the adaptive level search, which costs at most as much as level 2
+constexpr uint64_t timeLimitedInitialLevel = 2;
+constexpr double timeLimitedInitialError = 16;
+
+/**
+ * Encodes raw to 4bit ADPCM and improves the result until the deadline.
+ *
+ * First raw is encoded by the adaptive level search up to level 2, which is always completed.
+ * Then the nibbles are optimized in windows of timeLimitedWindowLength samples. The decoder
+ * states at the window edges are kept, so the windows are independent and searched in
+ * parallel. DecoderStateSearch finds the best nibbles of a window that end in the kept state,
+ * a window is only replaced if this lowers its error. Windows with a higher error are searched
+ * first. Every pass shifts the windows by half of their length, so the edges of one pass are
+ * optimized by the next. Passes continue until the deadline or until a pass finds no improvement.
+ *
+ * The result is valid whenever the deadline is reached, but depends on how far the
+ * optimization got, so it is not reproducible. Expand has the signature of the Expand
+ * function of DecoderStateSearch.
+ */
+template <typename Expand>
+std::vector<uint8_t> encodeTimeLimited(const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline, Expand expand)
+{
+    if (raw.empty())
+    {
+        throw std::runtime_error("Cannot encode empty data");
+    }
+
+    // nibbles[k] encodes raw[k + 1], states[k] is the decoder state after it
+    std::vector<uint8_t> nibbles = searchAdaptiveLevel(raw, timeLimitedInitialLevel, timeLimitedInitialError, expand);
+    size_t count = nibbles.size();
+    std::vector<TrellisDecoderState> states(count);
+    CreativeAdpcmDecoder4Bit stateDecoder(raw[0]);
+    for (size_t k = 0; k < count; ++k)
+    {
+        stateDecoder.decodeNibble(nibbles[k]);
+        states[k] = { stateDecoder.accumulator(), stateDecoder.previous() };
+    }
+
+    auto windowError = [&](size_t begin, TrellisDecoderState entry)
+    {
+        CreativeAdpcmDecoder4Bit decoder(entry.previous, entry.accumulator);
+        uint64_t squaredDiff = 0;
+        for (size_t k = begin; k < begin + timeLimitedWindowLength; ++k)
+        {
+            int diff = decoder.decodeNibble(nibbles[k]) - raw[k + 1];
+            squaredDiff += diff * diff;
+        }
+        return squaredDiff;
+    };
+
+    auto appendHistory = [](uint64_t history, uint64_t nibble, int) { return (history << 4) | nibble; };
+
+    std::vector<std::pair<uint64_t, size_t>> windows;
+
+    bool improved = true;
+    for (size_t pass = 0; improved && std::chrono::steady_clock::now() < deadline; ++pass)
+    {
+        size_t offset = pass % 2 ? timeLimitedWindowLength / 2 : 0;
+        windows.clear();
+        for (size_t begin = offset; begin + timeLimitedWindowLength <= count; begin += timeLimitedWindowLength)
+        {
+            uint64_t error = windowError(begin, begin == 0 ? TrellisDecoderState{ 1, raw[0] } : states[begin - 1]);
+            if (error > 0)
+            {
+                windows.emplace_back(error, begin);
+            }
+        }
+        std::sort(windows.begin(), windows.end(), [](const auto& a, const auto& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+        int64_t windowCount = static_cast<int64_t>(windows.size());
+        improved = false;
+        ProgressStage progress("Improving ADPCM4", windows.size() * timeLimitedWindowLength);
+
+        #pragma omp parallel num_threads(ExecutionContext::threads()) reduction(||:improved)
+        {
+            DecoderStateSearch stateSearch;
+
+            #pragma omp for schedule(dynamic)
+            for (int64_t window = 0; window < windowCount; ++window)
+            {
+                if (std::chrono::steady_clock::now() >= deadline || Progress::cancelled())
+                {
+                    continue;
+                }
+
+                auto [error, begin] = windows[window];
+                size_t last = begin + timeLimitedWindowLength - 1;
+                TrellisDecoderState entry = begin == 0 ? TrellisDecoderState{ 1, raw[0] } : states[begin - 1];
+
+                stateSearch.search(&raw[begin + 1], timeLimitedWindowLength, entry.accumulator, entry.previous, expand, appendHistory);
+                auto best = stateSearch.resultFor(states[last].accumulator, states[last].previous);
+                progress.add(timeLimitedWindowLength);
+                if (best.squaredDiff >= error)
+                {
+                    continue;
+                }
+
+                // the state after the last nibble stays the same, so only the states inside the window change
+                CreativeAdpcmDecoder4Bit decoder(entry.previous, entry.accumulator);
+                for (size_t k = begin; k <= last; ++k)
+                {
+                    nibbles[k] = (best.history >> (4 * (last - k))) & 0xf;
+                    decoder.decodeNibble(nibbles[k]);
+                    if (k < last)
+                    {
+                        states[k] = { decoder.accumulator(), decoder.previous() };
+                    }
+                }
+                improved = true;
+            }
+        }
+        progress.throwIfCancelled();
+    }
+
+    return mergeAdpcm4Nibbles(raw[0], nibbles);
+}
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef ENCODE_TRELLIS_H
+#define ENCODE_TRELLIS_H
+
+#include "decode_creative_adpcm.h"
+#include "encode_state_search.h"
+#include "execution_context.h"
+#include "encode_checkpoint.h"
+#include "progress.h"
+
+#include "omp.h"
+
+#include <vector>
+#include <span>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+struct TrellisDecoderState
+{
+    uint8_t accumulator;
+    uint8_t previous;
+
+    bool operator==(const TrellisDecoderState&) const = default;
+};
+
+struct TrellisPath
+{
+    std::vector<uint8_t> nibbles;
+    std::vector<TrellisDecoderState> states;   // decoder state after each nibble
+};
+
+/**
+ * Decodes the nibbles from state start to build the path.
+ */
+inline TrellisPath decodeTrellisPath(TrellisDecoderState start, std::vector<uint8_t> nibbles)
+{
+    TrellisPath path;
+    path.nibbles = std::move(nibbles);
+
+    CreativeAdpcmDecoder4Bit decoder(start.previous, start.accumulator);
+    path.states.reserve(path.nibbles.size());
+    for (uint8_t nibble : path.nibbles)
+    {
+        decoder.decodeNibble(nibble);
+        path.states.push_back({ decoder.accumulator(), decoder.previous() });
+    }
+    return path;
+}
+
+/**
+ * Trellis search for the 4bit ADPCM encoder.
+ *
+ * The branches are kept as structure of arrays (accumulator, previous, cost) and the
+ * path of every branch is stored as one backpointer (parent index and nibble) per
+ * sample, so no per branch allocations are needed. The 16 children of a branch are
+ * calculated at once by the Expand function, which has the signature
+ * (accumulator, previous, target, childAccumulators[16], childPrevious[16], squaredDiffs[16]).
+ *
+ * Children that reach the same decoder state are merged, so there are never more than
+ * 1024 branches. The best branches are selected in linear time, the given fraction
+ * (diversity) of the branches is chosen randomly from the rest. The result only depends
+ * on the input and the seed.
+ */
+template <typename Expand>
+class TrellisSearch
+{
+public:
+    TrellisSearch(uint32_t maxBranches, double diversity, Expand expand) :
+        m_maxBranches(std::min<uint32_t>(maxBranches, decoderStateCount)),
+        m_expand(expand),
+        m_candidateOfState(decoderStateCount, -1)
+    {
+        m_randomBranches = static_cast<uint32_t>(m_maxBranches * diversity);
+    }
+
+    /**
+     * Runs the trellis over targets starting in state start.
+     *
+     * If mergePath is not empty the search stops as soon as a branch is in the state of
+     * mergePath at the same position. The returned path then ends at this position and
+     * can be continued with the rest of mergePath.
+     */
+    TrellisPath run(std::span<const uint8_t> targets, TrellisDecoderState start, uint64_t seed, std::span<const TrellisDecoderState> mergePath = {})
+    {
+        std::mt19937_64 gen(seed);
+
+        m_backpointers.resize(targets.size() * m_maxBranches);
+        m_accumulators.assign(1, start.accumulator);
+        m_previous.assign(1, start.previous);
+        m_costs.assign(1, 0);
+
+        for (size_t pos = 0; pos < targets.size(); ++pos)
+        {
+            expandBranches(targets[pos]);
+            selectBranches(gen);
+
+            uint16_t* backpointers = &m_backpointers[pos * m_maxBranches];
+            m_accumulators.resize(m_selected.size());
+            m_previous.resize(m_selected.size());
+            m_costs.resize(m_selected.size());
+            for (size_t i = 0; i < m_selected.size(); ++i)
+            {
+                const Candidate& candidate = m_candidates[m_selected[i]];
+                m_accumulators[i] = candidate.accumulator;
+                m_previous[i] = candidate.previous;
+                m_costs[i] = candidate.cost;
+                backpointers[i] = candidate.backpointer;
+            }
+
+            if (!mergePath.empty())
+            {
+                for (size_t i = 0; i < m_selected.size(); ++i)
+                {
+                    if (TrellisDecoderState{ m_accumulators[i], m_previous[i] } == mergePath[pos])
+                    {
+                        return tracePath(start, pos + 1, i);
+                    }
+                }
+            }
+        }
+
+        // branches are sorted, so the first one is the best
+        return tracePath(start, targets.size(), 0);
+    }
+
+private:
+    struct Candidate
+    {
+        uint64_t cost;
+        uint16_t state;
+        uint16_t backpointer;   // parent index << 4 | nibble
+        uint8_t accumulator;
+        uint8_t previous;
+    };
+
+    void expandBranches(uint8_t target)
+    {
+        uint8_t childAccumulators[16];
+        uint8_t childPrevious[16];
+        uint32_t squaredDiffs[16];
+
+        // Children in the same decoder state have identical futures, only the best one is kept.
+        // Branches are visited in a fixed order, so on equal cost the first one wins.
+        m_candidates.clear();
+        for (size_t branch = 0; branch < m_costs.size(); ++branch)
+        {
+            m_expand(m_accumulators[branch], m_previous[branch], target, childAccumulators, childPrevious, squaredDiffs);
+            for (uint8_t nibble = 0; nibble < 16; ++nibble)
+            {
+                uint16_t state = decoderStateIndex(childAccumulators[nibble], childPrevious[nibble]);
+                uint64_t cost = m_costs[branch] + squaredDiffs[nibble];
+                int16_t& candidate = m_candidateOfState[state];
+                if (candidate < 0)
+                {
+                    candidate = static_cast<int16_t>(m_candidates.size());
+                    m_candidates.push_back({ cost, state, static_cast<uint16_t>((branch << 4) | nibble), childAccumulators[nibble], childPrevious[nibble] });
+                }
+                else if (cost < m_candidates[candidate].cost)
+                {
+                    m_candidates[candidate].cost = cost;
+                    m_candidates[candidate].backpointer = static_cast<uint16_t>((branch << 4) | nibble);
+                }
+            }
+        }
+
+        for (const Candidate& candidate : m_candidates)
+        {
+            m_candidateOfState[candidate.state] = -1;
+        }
+    }
+
+    /**
+     * Strict total order by cost, then by decoder state. No two candidates share a
+     * decoder state, so the selection does not depend on the standard library.
+     */
+    bool candidateLess(uint16_t a, uint16_t b) const
+    {
+        const Candidate& ca = m_candidates[a];
+        const Candidate& cb = m_candidates[b];
+        return ca.cost < cb.cost || (ca.cost == cb.cost && ca.state < cb.state);
+    }
+
+    template <typename Generator>
+    void selectBranches(Generator& gen)
+    {
+        auto less = [this](uint16_t a, uint16_t b) { return candidateLess(a, b); };
+
+        m_selected.clear();
+        if (m_candidates.size() <= m_maxBranches)
+        {
+            for (size_t i = 0; i < m_candidates.size(); ++i)
+            {
+                m_selected.push_back(static_cast<uint16_t>(i));
+            }
+        }
+        else
+        {
+            uint32_t bestBranches = m_maxBranches - m_randomBranches;
+
+            // find the worst of the best branches in linear time, then split the candidates
+            // in creation order, so the random choice below sees the same pool everywhere
+            m_pool.clear();
+            if (bestBranches > 0)
+            {
+                m_order.resize(m_candidates.size());
+                for (size_t i = 0; i < m_candidates.size(); ++i)
+                {
+                    m_order[i] = static_cast<uint16_t>(i);
+                }
+                std::nth_element(m_order.begin(), m_order.begin() + (bestBranches - 1), m_order.end(), less);
+                uint16_t pivot = m_order[bestBranches - 1];
+
+                for (size_t i = 0; i < m_candidates.size(); ++i)
+                {
+                    if (less(pivot, static_cast<uint16_t>(i)))
+                    {
+                        m_pool.push_back(static_cast<uint16_t>(i));
+                    }
+                    else
+                    {
+                        m_selected.push_back(static_cast<uint16_t>(i));
+                    }
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < m_candidates.size(); ++i)
+                {
+                    m_pool.push_back(static_cast<uint16_t>(i));
+                }
+            }
+
+            // std::mt19937_64 produces the same sequence on every platform, the mapping to
+            // indices is done here because the standard distributions are implementation defined.
+            for (size_t slot = 0; slot < m_randomBranches; ++slot)
+            {
+                size_t pick = slot + gen() % (m_pool.size() - slot);
+                std::swap(m_pool[slot], m_pool[pick]);
+                m_selected.push_back(m_pool[slot]);
+            }
+        }
+
+        // the order of the branches defines the tie breaking of the next sample, so make it canonical
+        std::sort(m_selected.begin(), m_selected.end(), less);
+    }
+
+    TrellisPath tracePath(TrellisDecoderState start, size_t length, size_t branch) const
+    {
+        std::vector<uint8_t> nibbles(length);
+        for (size_t pos = length; pos-- > 0;)
+        {
+            uint16_t backpointer = m_backpointers[pos * m_maxBranches + branch];
+            nibbles[pos] = backpointer & 0xf;
+            branch = backpointer >> 4;
+        }
+        return decodeTrellisPath(start, std::move(nibbles));
+    }
+
+    uint32_t m_maxBranches;
+    uint32_t m_randomBranches;
+    Expand m_expand;
+
+    std::vector<uint8_t> m_accumulators;
+    std::vector<uint8_t> m_previous;
+    std::vector<uint64_t> m_costs;
+    std::vector<uint16_t> m_backpointers;
+
+    std::vector<Candidate> m_candidates;
+    std::vector<int16_t> m_candidateOfState;
+    std::vector<uint16_t> m_order;
+    std::vector<uint16_t> m_pool;
+    std::vector<uint16_t> m_selected;
+};
+
+/**
+ * Number of samples of the segments that are searched in parallel.
+ * The output depends on this value, but not on the number of threads.
+ */
+constexpr size_t trellisSegmentLength = 16384;
+
+/**
+ * Encodes raw using TrellisSearch.
+ *
+ * The samples are split into segments of trellisSegmentLength that are searched in parallel.
+ * Every segment but the first starts speculatively in state (1, last sample of previous
+ * segment). Afterwards the segments are joined in order: if the real entry state of a
+ * segment differs from the speculative one, the segment is searched again from the real
+ * state until a branch merges with the speculative path, which is then continued unchanged.
+ *
+ * The speculative paths are stored in the checkpoint, if one is given, and the segments already
+ * stored in it are not searched again.
+ */
+template <typename Expand>
+std::vector<uint8_t> encodeTrellis(const std::vector<uint8_t>& raw, uint32_t maxBranches, uint64_t seed, double diversity, Expand expand, EncodeCheckpoint* checkpoint = nullptr)
+{
+    if (raw.empty())
+    {
+        throw std::runtime_error("Cannot encode empty data");
+    }
+
+    if (maxBranches == 0)
+    {
+        throw std::runtime_error("Trellis needs at least one branch");
+    }
+
+    if (diversity < 0 || diversity > 1)
+    {
+        throw std::runtime_error("Trellis diversity must be between 0 and 1");
+    }
+
+    std::span<const uint8_t> targets = std::span<const uint8_t>(raw).subspan(1);
+    int64_t segmentCount = (targets.size() + trellisSegmentLength - 1) / trellisSegmentLength;
+
+    auto segmentTargets = [&](int64_t segment) {
+        size_t begin = segment * trellisSegmentLength;
+        return targets.subspan(begin, std::min(trellisSegmentLength, targets.size() - begin));
+    };
+    auto segmentSeed = [&](int64_t segment) {
+        return seed + 0x9e3779b97f4a7c15ull * segment;
+    };
+
+    std::vector<TrellisDecoderState> speculativeStarts(segmentCount);
+    std::vector<TrellisPath> paths(segmentCount);
+    ProgressStage progress("Encoding ADPCM4", targets.size());
+
+    #pragma omp parallel num_threads(ExecutionContext::threads())
+    {
+        TrellisSearch<Expand> search(maxBranches, diversity, expand);
+
+        #pragma omp for schedule(dynamic)
+        for (int64_t segment = 0; segment < segmentCount; ++segment)
+        {
+            if (Progress::cancelled())
+            {
+                continue;
+            }
+
+            speculativeStarts[segment] = { 1, raw[segment * trellisSegmentLength] };
+            auto stored = checkpoint ? checkpoint->segment(segment) : std::nullopt;
+            if (stored && stored->size() == segmentTargets(segment).size())
+            {
+                paths[segment] = decodeTrellisPath(speculativeStarts[segment], std::move(*stored));
+                progress.add(paths[segment].nibbles.size());
+                continue;
+            }
+
+            paths[segment] = search.run(segmentTargets(segment), speculativeStarts[segment], segmentSeed(segment));
+            if (checkpoint)
+            {
+                checkpoint->store(segment, paths[segment].nibbles);
+            }
+            progress.add(paths[segment].nibbles.size());
+        }
+    }
+    progress.throwIfCancelled();
+
+    if (checkpoint)
+    {
+        checkpoint->write();
+    }
+
+    TrellisSearch<Expand> search(maxBranches, diversity, expand);
+    std::vector<uint8_t> nibbles;
+    nibbles.reserve(targets.size());
+    TrellisDecoderState state = { 1, raw[0] };
+
+    for (int64_t segment = 0; segment < segmentCount; ++segment)
+    {
+        const TrellisPath& speculative = paths[segment];
+        size_t joined = 0;
+        if (state != speculativeStarts[segment])
+        {
+            auto path = search.run(segmentTargets(segment), state, segmentSeed(segment), speculative.states);
+            nibbles.insert(nibbles.end(), path.nibbles.begin(), path.nibbles.end());
+            joined = path.nibbles.size();
+            state = path.states.back();
+        }
+
+        nibbles.insert(nibbles.end(), speculative.nibbles.begin() + joined, speculative.nibbles.end());
+        if (joined < speculative.nibbles.size())
+        {
+            state = speculative.states.back();
+        }
+    }
+
+    std::vector<uint8_t> binaryResult(nibbles.size() / 2);
+
+    // merge nibbles into bytes
+    for (size_t n = 0; n < nibbles.size() / 2; ++n)
+    {
+        binaryResult[n] = ((nibbles[2 * n] << 4) + (nibbles[2 * n + 1]));
+    }
+
+    binaryResult.insert(binaryResult.begin(), raw[0]);
+
+    return binaryResult;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include "execution_context.h"
+
+#include "omp.h"
+
+#include <stdexcept>
+#include <cstdlib>
+#include <sstream>
+#include <algorithm>
+
+#if defined(__linux__)
+    #include <sched.h>
+#elif defined(_WIN32)
+    #include <windows.h>
+#endif
+
+namespace { // annonymous namespace
+
+ExecutionSettings g_settings;
+int g_threads = 0;    // 0 = not configured, use the OpenMP default
+
+void setCpuAffinity(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+    {
+        return;
+    }
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu >= CPU_SETSIZE)
+        {
+            throw std::runtime_error("CPU number " + std::to_string(cpu) + " is too large");
+        }
+        CPU_SET(cpu, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        throw std::runtime_error("Could not set CPU affinity");
+    }
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus)
+    {
+        if (cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8))
+        {
+            throw std::runtime_error("CPU number " + std::to_string(cpu) + " is too large");
+        }
+        mask |= DWORD_PTR(1) << cpu;
+    }
+    if (!SetProcessAffinityMask(GetCurrentProcess(), mask))
+    {
+        throw std::runtime_error("Could not set CPU affinity");
+    }
+#else
+    throw std::runtime_error("Setting the CPU affinity is not supported on this platform");
+#endif
+}
+
+int parseInt(const std::string& text)
+{
+    size_t end = 0;
+    int value = 0;
+    try
+    {
+        value = std::stoi(text, &end);
+    }
+    catch (...)
+    {
+        end = 0;
+    }
+    if (end == 0 || end != text.size() || value < 0)
+    {
+        throw std::runtime_error("Invalid number \"" + text + "\"");
+    }
+    return value;
+}
+
+} // annonymous namespace
+
+
+std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        auto dash = range.find('-');
+        if (dash == std::string::npos)
+        {
+            cpus.push_back(parseInt(range));
+        }
+        else
+        {
+            int first = parseInt(range.substr(0, dash));
+            int last = parseInt(range.substr(dash + 1));
+            if (last < first)
+            {
+                throw std::runtime_error("Invalid CPU range \"" + range + "\"");
+            }
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+
+void ExecutionContext::configure(const ExecutionSettings& settings)
+{
+    // what OpenMP uses without configuration, e.g. from OMP_NUM_THREADS
+    static const int defaultThreads = omp_get_max_threads();
+
+    if (settings.threads < 0)
+    {
+        throw std::runtime_error("Number of threads must not be negative");
+    }
+
+    setCpuAffinity(settings.cpus);
+
+    g_settings = settings;
+    if (settings.threads > 0)
+    {
+        g_threads = settings.threads;
+    }
+    else if (!settings.cpus.empty())
+    {
+        g_threads = static_cast<int>(settings.cpus.size());
+    }
+    else
+    {
+        g_threads = defaultThreads;
+    }
+
+    // also applies to parallel regions that do not ask threads()
+    omp_set_num_threads(g_threads);
+#if _OPENMP >= 200805
+    omp_set_max_active_levels(settings.nested ? 2 : 1);
+#else
+    omp_set_nested(settings.nested);
+#endif
+}
+
+
+ExecutionSettings ExecutionContext::settingsFromEnvironment(const ExecutionSettings& defaults)
+{
+    ExecutionSettings settings = defaults;
+
+    if (const char* threads = std::getenv("VOCTOOL_THREADS"))
+    {
+        settings.threads = parseInt(threads);
+    }
+
+    if (const char* cpus = std::getenv("VOCTOOL_CPUS"))
+    {
+        settings.cpus = parseCpuList(cpus);
+    }
+
+    return settings;
+}
+
+
+int ExecutionContext::threads()
+{
+    return g_threads > 0 ? g_threads : omp_get_max_threads();
+}
+
+
+const ExecutionSettings& ExecutionContext::settings()
+{
+    return g_settings;
+}
@@ -0,0 +1,54 @@
+#ifndef EXECUTION_CONTEXT_H
+#define EXECUTION_CONTEXT_H
+
+#include <vector>
+#include <string>
+
+/**
+ * @brief Settings for all parallel stages of the library.
+ */
+struct ExecutionSettings
+{
+    int threads = 0;            ///< Number of threads per parallel stage, 0 = one per available CPU.
+    std::vector<int> cpus;      ///< CPUs the process is restricted to, empty = no restriction.
+    bool nested = false;        ///< Allow parallel stages inside parallel stages to start additional threads.
+};
+
+/**
+ * @brief Process wide threading configuration.
+ *
+ * Every parallel region of the library uses threads() as its number of threads,
+ * so running several processes side by side does not oversubscribe the machine
+ * when each of them is configured with its share of the CPUs.
+ */
+class ExecutionContext
+{
+public:
+    /**
+     * @brief Applies the settings to the whole process. Must be called before
+     *        any parallel stage runs, as the CPU affinity is inherited by the
+     *        worker threads when they are created.
+     */
+    static void configure(const ExecutionSettings& settings);
+
+    /**
+     * @brief Reads the settings from the environment variables VOCTOOL_THREADS
+     *        (number of threads) and VOCTOOL_CPUS (list of CPUs, e.g. "0-3,8").
+     *        Unset variables keep the value of defaults.
+     */
+    static ExecutionSettings settingsFromEnvironment(const ExecutionSettings& defaults = {});
+
+    /**
+     * @brief Number of threads a parallel stage should use.
+     */
+    static int threads();
+
+    static const ExecutionSettings& settings();
+};
+
+/**
+ * @brief Parses a list of CPUs like "0-3,8,10-11".
+ */
+std::vector<int> parseCpuList(const std::string& list);
+
+#endif
@@ -3,6 +3,71 @@
 #include <cstdio>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
+
+#if defined(_WIN32)
+    #include <io.h>
+    #include <fcntl.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace { // annonymous namespace
+
+// where "-" writes to, differs from stdout after redirectMessagesToStderr()
+FILE* g_standardOutput = stdout;
+
+void setBinaryMode([[maybe_unused]] FILE* file)
+{
+#if defined(_WIN32)
+    _setmode(_fileno(file), _O_BINARY);
+#endif
+}
+
+} // annonymous namespace
+
+
+bool isStandardStream(const std::string& filename)
+{
+    return filename == "-";
+}
+
+
+std::shared_ptr<FILE> openFile(const std::string& filename, const char* mode)
+{
+    if (!isStandardStream(filename))
+    {
+        return std::shared_ptr<FILE>(fopen(filename.c_str(), mode), [](FILE* file) { if (file) {fclose(file);} });
+    }
+
+    FILE* file = strchr(mode, 'r') ? stdin : g_standardOutput;
+    setBinaryMode(file);
+    return std::shared_ptr<FILE>(file, [](FILE* file) { fflush(file); });
+}
+
+
+void redirectMessagesToStderr()
+{
+    if (g_standardOutput != stdout)
+    {
+        return;
+    }
+
+    fflush(stdout);
+#if defined(_WIN32)
+    FILE* output = _fdopen(_dup(_fileno(stdout)), "wb");
+    bool redirected = output && _dup2(_fileno(stderr), _fileno(stdout)) == 0;
+#else
+    FILE* output = fdopen(dup(fileno(stdout)), "wb");
+    bool redirected = output && dup2(fileno(stderr), fileno(stdout)) >= 0;
+#endif
+    if (!redirected)
+    {
+        throw std::runtime_error("Could not redirect messages to stderr");
+    }
+    g_standardOutput = output;
+}
+
 
 std::vector<uint8_t> loadFile(const std::string& filename)
 {
@@ -23,13 +88,14 @@ std::vector<uint8_t> loadFile(const std::string& filename)
 
 void storeFile(const std::string& filename, const std::vector<uint8_t>& data)
 {
-    FILE* fp = fopen(filename.c_str(), "wb");
-    if (!fp)
+    auto file = openFile(filename, "wb");
+    if (!file)
     {
         throw std::runtime_error("Could not open file: " +  filename);
     }
 
-    fwrite(&data[0], data.size(), 1, fp);
-
-    fclose(fp);
-}
\ No newline at end of file
+    if (!data.empty() && fwrite(&data[0], data.size(), 1, file.get()) != 1)
+    {
+        throw std::runtime_error("Could not write file: " +  filename);
+    }
+}
@@ -4,9 +4,29 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <cstdio>
+#include <memory>
+
+/**
+ * @brief True for the file name "-", which stands for stdin as input and stdout as output.
+ */
+bool isStandardStream(const std::string& filename);
+
+/**
+ * @brief Opens a file like fopen(). "-" opens stdin or stdout depending on the mode, in
+ *        binary mode. The standard streams are only flushed, not closed, when the pointer
+ *        is released. Returns an empty pointer if the file cannot be opened.
+ */
+std::shared_ptr<FILE> openFile(const std::string& filename, const char* mode);
+
+/**
+ * @brief Sends everything printed to stdout from now on to stderr. Only files opened as "-"
+ *        by openFile() still go to the original stdout, so messages cannot end up in the
+ *        output when it is piped into another program.
+ */
+void redirectMessagesToStderr();
 
 std::vector<uint8_t> loadFile(const std::string& filename);
 void storeFile(const std::string& filename, const std::vector<uint8_t>& data);
 
 #endif
-
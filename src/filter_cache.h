@@ -0,0 +1,49 @@
+#ifndef FILTER_CACHE_H
+#define FILTER_CACHE_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief Designed filters by their parameters.
+ *
+ * A process that resamples many clips with the same rates, like the batch and server
+ * modes, designs every filter only once. The cache is cleared when it holds maxFilters
+ * filters.
+ */
+template <typename Filter, size_t maxFilters = 32>
+class FilterCache
+{
+public:
+    template <typename Design>
+    std::shared_ptr<const Filter> get(const std::vector<double>& parameters, Design design)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_filters.find(parameters);
+            if (found != m_filters.end())
+            {
+                return found->second;
+            }
+        }
+
+        // designed without the lock, so other threads can use the cached filters meanwhile
+        auto filter = std::make_shared<const Filter>(design());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_filters.size() >= maxFilters)
+        {
+            m_filters.clear();
+        }
+        m_filters.emplace(parameters, filter);
+        return filter;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::map<std::vector<double>, std::shared_ptr<const Filter>> m_filters;
+};
+
+#endif
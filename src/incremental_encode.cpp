@@ -0,0 +1,251 @@
+#include "incremental_encode.h"
+#include "encode_creative_adpcm.h"
+#include "encode_adaptive_level.h"
+#include "encode_state_search.h"
+#include "decode_creative_adpcm.h"
+#include "progress.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <unordered_map>
+#include <stdexcept>
+
+namespace { // annonymous namespace
+
+constexpr size_t minimumChunkLength = 1024;
+constexpr size_t maximumChunkLength = 16384;
+
+// a boundary is on average every 4096 samples after the minimum length
+constexpr uint64_t boundaryMask = 0xfff;
+
+// random values of the gear hash, from splitmix64 so they are the same everywhere
+std::array<uint64_t, 256> createGearTable()
+{
+    std::array<uint64_t, 256> table;
+    uint64_t state = 0;
+    for (uint64_t& value : table)
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}
+
+/**
+ * Splits the samples into chunks. The gear hash only depends on the last 64 samples, so a
+ * boundary is found at the same samples no matter where the chunk started.
+ */
+std::vector<std::pair<size_t, size_t>> findChunks(const uint8_t* data, size_t count)
+{
+    static const auto gear = createGearTable();
+
+    std::vector<std::pair<size_t, size_t>> chunks;
+    size_t begin = 0;
+    uint64_t hash = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        hash = (hash << 1) + gear[data[i]];
+        size_t length = i + 1 - begin;
+        if ((length >= minimumChunkLength && (hash & boundaryMask) == 0) || length == maximumChunkLength)
+        {
+            chunks.emplace_back(begin, length);
+            begin = i + 1;
+            hash = 0;
+        }
+    }
+
+    if (begin < count)
+    {
+        chunks.emplace_back(begin, count - begin);
+    }
+    return chunks;
+}
+
+} // annonymous namespace
+
+
+uint64_t hashSamples(const uint8_t* data, size_t length)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+
+IncrementalEncodeResult createAdpcm4BitIncremental(
+    const std::vector<uint8_t>& raw,
+    uint64_t level,
+    const EncodeIndex& previousIndex,
+    const std::vector<uint8_t>& previousEncoded)
+{
+    if (raw.empty())
+    {
+        throw std::runtime_error("Cannot encode empty data");
+    }
+
+    if (level < 1 || level > 8)
+    {
+        throw std::runtime_error("Level must be between 1 and 8");
+    }
+
+    // the previous nibbles can only be used if they were encoded with the same level
+    std::vector<uint8_t> previousNibbles;
+    std::unordered_multimap<uint64_t, const EncodeIndexChunk*> previousChunks;
+    if (previousIndex.level == level && !previousEncoded.empty() && previousIndex.dataHash == hashSamples(previousEncoded.data(), previousEncoded.size()))
+    {
+        for (size_t i = 1; i < previousEncoded.size(); ++i)
+        {
+            previousNibbles.push_back(previousEncoded[i] >> 4);
+            previousNibbles.push_back(previousEncoded[i] & 0xf);
+        }
+        for (const EncodeIndexChunk& chunk : previousIndex.chunks)
+        {
+            if (chunk.begin < previousNibbles.size())
+            {
+                previousChunks.emplace(chunk.hash, &chunk);
+            }
+        }
+    }
+
+    IncrementalEncodeResult result;
+    result.index.level = level;
+    result.reusedSamples = 0;
+
+    // nibbles[k] encodes raw[k + 1]
+    const uint8_t* targets = &raw[1];
+    std::vector<uint8_t> nibbles(raw.size() - 1);
+    TrellisDecoderState state = { 1, raw[0] };
+
+    DecoderStateSearch stateSearch;
+    auto appendHistory = [](uint64_t history, uint64_t nibble, int) { return (history << 4) | nibble; };
+
+    std::vector<TrellisDecoderState> previousStates;
+    ProgressStage progress("Encoding ADPCM4", raw.size());
+    for (auto [begin, length] : findChunks(targets, nibbles.size()))
+    {
+        uint64_t hash = hashSamples(targets + begin, length);
+        result.index.chunks.push_back({ begin, length, hash, state });
+
+        // prefer an unchanged chunk that was entered in the same state
+        const EncodeIndexChunk* previous = nullptr;
+        auto [first, last] = previousChunks.equal_range(hash);
+        for (auto it = first; it != last; ++it)
+        {
+            if (it->second->length == length && (!previous || it->second->entry == state))
+            {
+                previous = it->second;
+            }
+        }
+
+        // an odd last nibble of the previous encode was not stored, then the chunk can only be
+        // copied up to its last complete group and the rest is searched again
+        size_t available = previous ? std::min(length, previousNibbles.size() - previous->begin) : 0;
+        size_t reusable = available == length ? length : available - available % level;
+
+        // decoder states of the previous encode after each nibble of the chunk
+        previousStates.clear();
+        if (previous)
+        {
+            CreativeAdpcmDecoder4Bit decoder(previous->entry.previous, previous->entry.accumulator);
+            for (size_t i = 0; i < available; ++i)
+            {
+                decoder.decodeNibble(previousNibbles[previous->begin + i]);
+                previousStates.push_back({ decoder.accumulator(), decoder.previous() });
+            }
+        }
+
+        for (size_t position = 0; position < length;)
+        {
+            if (position < reusable && state == (position == 0 ? previous->entry : previousStates[position - 1]))
+            {
+                // same input and same state, so the search would find the previous nibbles again
+                std::copy_n(previousNibbles.begin() + previous->begin + position, reusable - position, nibbles.begin() + begin + position);
+                result.reusedSamples += reusable - position;
+                state = previousStates[reusable - 1];
+                position = reusable;
+                continue;
+            }
+
+            progress.update(begin + position);
+            size_t groupLength = std::min<size_t>(level, length - position);
+            auto best = stateSearch.search(targets + begin + position, static_cast<int>(groupLength), state.accumulator, state.previous, expandAdpcm4Nibbles, appendHistory);
+            for (size_t n = 0; n < groupLength; ++n)
+            {
+                nibbles[begin + position + n] = (best.history >> (4 * (groupLength - 1 - n))) & 0xf;
+            }
+            state = { best.accumulator, best.previous };
+            position += groupLength;
+        }
+    }
+
+    result.encoded = mergeAdpcm4Nibbles(raw[0], nibbles);
+    result.index.dataHash = hashSamples(result.encoded.data(), result.encoded.size());
+    return result;
+}
+
+
+EncodeIndex readEncodeIndex(const std::string& filename)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open index file: " + filename);
+    }
+
+    EncodeIndex index;
+    std::string magic;
+    int version = 0;
+    std::string levelKey, hashKey, chunksKey;
+    size_t chunkCount = 0;
+    file >> magic >> version >> levelKey >> index.level >> hashKey >> index.dataHash >> chunksKey >> chunkCount;
+    if (!file || magic != "voctool-index" || version != 1 || levelKey != "level" || hashKey != "data-hash" || chunksKey != "chunks")
+    {
+        throw std::runtime_error("Invalid index file: " + filename);
+    }
+
+    for (size_t i = 0; i < chunkCount; ++i)
+    {
+        EncodeIndexChunk chunk;
+        unsigned accumulator = 0, previous = 0;
+        file >> chunk.begin >> chunk.length >> chunk.hash >> accumulator >> previous;
+        if (!file || accumulator > 255 || previous > 255)
+        {
+            throw std::runtime_error("Invalid index file: " + filename);
+        }
+        chunk.entry = { static_cast<uint8_t>(accumulator), static_cast<uint8_t>(previous) };
+        index.chunks.push_back(chunk);
+    }
+    return index;
+}
+
+
+void writeEncodeIndex(const std::string& filename, const EncodeIndex& index)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open index file: " + filename);
+    }
+
+    file << "voctool-index 1\n";
+    file << "level " << index.level << "\n";
+    file << "data-hash " << index.dataHash << "\n";
+    file << "chunks " << index.chunks.size() << "\n";
+    for (const EncodeIndexChunk& chunk : index.chunks)
+    {
+        file << chunk.begin << " " << chunk.length << " " << chunk.hash << " "
+             << static_cast<unsigned>(chunk.entry.accumulator) << " " << static_cast<unsigned>(chunk.entry.previous) << "\n";
+    }
+
+    if (!file)
+    {
+        throw std::runtime_error("Could not write index file: " + filename);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef INCREMENTAL_ENCODE_H
+#define INCREMENTAL_ENCODE_H
+
+#include "encode_trellis.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/**
+ * @brief A chunk of the samples encoded by createAdpcm4BitIncremental().
+ *
+ * Positions count the encoded samples, i.e. without the reference byte.
+ */
+struct EncodeIndexChunk
+{
+    size_t begin;
+    size_t length;
+    uint64_t hash;                  ///< hash of the input samples of the chunk
+    TrellisDecoderState entry;      ///< decoder state before the first sample of the chunk
+};
+
+/**
+ * @brief Describes how a file was encoded, so it can be encoded again incrementally.
+ */
+struct EncodeIndex
+{
+    uint64_t level;
+    uint64_t dataHash;              ///< hash of the encoded sample data the index belongs to
+    std::vector<EncodeIndexChunk> chunks;
+};
+
+struct IncrementalEncodeResult
+{
+    std::vector<uint8_t> encoded;
+    EncodeIndex index;
+    size_t reusedSamples;           ///< samples taken from the previous encode without searching
+};
+
+/**
+ * @brief Encodes raw to 4bit ADPCM in content defined chunks, reusing the nibbles of a
+ *        previous encode for chunks that did not change.
+ *
+ * The chunk boundaries depend only on the nearby samples, so after an edit the chunks
+ * behind it are found again even if they moved. A chunk is searched with the combined
+ * search in groups of level samples starting at the chunk begin. If the input of a chunk
+ * is unchanged and the decoder enters it in the same state as before, the previous nibbles
+ * are copied. If only the state differs, the chunk is searched until the decoder state
+ * matches the previous encode at a group boundary, from there on the nibbles are copied.
+ *
+ * The result is identical to encoding without a previous encode. previousEncoded is the
+ * sample data previousIndex was written for, both may be empty.
+ */
+IncrementalEncodeResult createAdpcm4BitIncremental(
+    const std::vector<uint8_t>& raw,
+    uint64_t level,
+    const EncodeIndex& previousIndex = {},
+    const std::vector<uint8_t>& previousEncoded = {});
+
+uint64_t hashSamples(const uint8_t* data, size_t length);
+
+EncodeIndex readEncodeIndex(const std::string& filename);
+void writeEncodeIndex(const std::string& filename, const EncodeIndex& index);
+
+#endif
@@ -0,0 +1,289 @@
+#include "json_lines.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <stdexcept>
+
+namespace { // annonymous namespace
+
+class JsonReader
+{
+public:
+    explicit JsonReader(const std::string& text) :
+        m_text(text)
+    {
+    }
+
+    void skipWhitespace()
+    {
+        while (m_position < m_text.size() && (m_text[m_position] == ' ' || m_text[m_position] == '\t' || m_text[m_position] == '\r' || m_text[m_position] == '\n'))
+        {
+            ++m_position;
+        }
+    }
+
+    bool atEnd() const
+    {
+        return m_position >= m_text.size();
+    }
+
+    char peek()
+    {
+        skipWhitespace();
+        if (atEnd())
+        {
+            fail("unexpected end");
+        }
+        return m_text[m_position];
+    }
+
+    void expect(char c)
+    {
+        if (peek() != c)
+        {
+            fail(std::string("expected '") + c + "'");
+        }
+        ++m_position;
+    }
+
+    std::string readString()
+    {
+        expect('"');
+        std::string value;
+        while (true)
+        {
+            if (atEnd())
+            {
+                fail("unterminated string");
+            }
+            char c = m_text[m_position++];
+            if (c == '"')
+            {
+                return value;
+            }
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                fail("control character in string");
+            }
+            if (c != '\\')
+            {
+                value += c;
+                continue;
+            }
+
+            if (atEnd())
+            {
+                fail("unterminated string");
+            }
+            char escape = m_text[m_position++];
+            switch (escape)
+            {
+            case '"': value += '"'; break;
+            case '\\': value += '\\'; break;
+            case '/': value += '/'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u': appendUtf8(value, readCodePoint()); break;
+            default: fail("invalid escape sequence");
+            }
+        }
+    }
+
+    // number, true, false or null as written
+    std::string readLiteral()
+    {
+        skipWhitespace();
+        size_t start = m_position;
+        while (m_position < m_text.size() && std::string("+-.eE0123456789truefalsn").find(m_text[m_position]) != std::string::npos)
+        {
+            ++m_position;
+        }
+        std::string literal = m_text.substr(start, m_position - start);
+        if (literal.empty())
+        {
+            fail("invalid value");
+        }
+        if (literal != "true" && literal != "false" && literal != "null" && !isNumber(literal))
+        {
+            fail("invalid value \"" + literal + "\"");
+        }
+        return literal;
+    }
+
+    [[noreturn]] void fail(const std::string& message) const
+    {
+        throw std::runtime_error("Invalid JSON at position " + std::to_string(m_position) + ": " + message);
+    }
+
+private:
+    static bool isNumber(const std::string& literal)
+    {
+        if (literal.find_first_not_of("+-.eE0123456789") != std::string::npos)
+        {
+            return false;   // e.g. nan, which std::stod() would accept
+        }
+        size_t end = 0;
+        try
+        {
+            std::stod(literal, &end);
+        }
+        catch (...)
+        {
+            return false;
+        }
+        return end == literal.size() && literal[0] != '+' && literal[0] != '.';
+    }
+
+    uint32_t readHex()
+    {
+        if (m_position + 4 > m_text.size())
+        {
+            fail("truncated unicode escape");
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char c = m_text[m_position++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else fail("invalid unicode escape");
+        }
+        return value;
+    }
+
+    uint32_t readCodePoint()
+    {
+        uint32_t value = readHex();
+        if (value >= 0xd800 && value < 0xdc00)
+        {
+            // surrogate pair
+            if (m_text.compare(m_position, 2, "\\u") != 0)
+            {
+                fail("missing low surrogate");
+            }
+            m_position += 2;
+            uint32_t low = readHex();
+            if (low < 0xdc00 || low >= 0xe000)
+            {
+                fail("invalid low surrogate");
+            }
+            value = 0x10000 + ((value - 0xd800) << 10) + (low - 0xdc00);
+        }
+        return value;
+    }
+
+    static void appendUtf8(std::string& text, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            text += static_cast<char>(codePoint);
+        }
+        else if (codePoint < 0x800)
+        {
+            text += static_cast<char>(0xc0 | (codePoint >> 6));
+            text += static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+        else if (codePoint < 0x10000)
+        {
+            text += static_cast<char>(0xe0 | (codePoint >> 12));
+            text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            text += static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+        else
+        {
+            text += static_cast<char>(0xf0 | (codePoint >> 18));
+            text += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f));
+            text += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f));
+            text += static_cast<char>(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    const std::string& m_text;
+    size_t m_position = 0;
+};
+
+} // annonymous namespace
+
+
+std::map<std::string, std::string> parseJsonObject(const std::string& text)
+{
+    JsonReader reader(text);
+    std::map<std::string, std::string> object;
+
+    reader.expect('{');
+    if (reader.peek() == '}')
+    {
+        reader.expect('}');
+    }
+    else
+    {
+        while (true)
+        {
+            std::string key = reader.readString();
+            reader.expect(':');
+
+            char next = reader.peek();
+            if (next == '{' || next == '[')
+            {
+                reader.fail("nested values are not supported");
+            }
+            std::string value = next == '"' ? reader.readString() : reader.readLiteral();
+            if (next == '"' || value != "null")
+            {
+                object[key] = value;
+            }
+            else
+            {
+                object.erase(key);
+            }
+
+            if (reader.peek() == '}')
+            {
+                reader.expect('}');
+                break;
+            }
+            reader.expect(',');
+        }
+    }
+
+    reader.skipWhitespace();
+    if (!reader.atEnd())
+    {
+        reader.fail("unexpected text after the object");
+    }
+    return object;
+}
+
+
+std::string toJsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"': quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned char>(c));
+                quoted += escape;
+            }
+            else
+            {
+                quoted += c;
+            }
+        }
+    }
+    return quoted + "\"";
+}
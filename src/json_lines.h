@@ -0,0 +1,21 @@
+#ifndef JSON_LINES_H
+#define JSON_LINES_H
+
+#include <map>
+#include <string>
+
+/**
+ * @brief Parses a flat JSON object like {"id": "1", "level": 5, "input": "a.wav"}.
+ *
+ * Strings are returned without quotes and escapes, numbers and booleans as they are
+ * written. Keys with the value null are left out. Nested objects and arrays are not
+ * supported and throw std::runtime_error like any other syntax error.
+ */
+std::map<std::string, std::string> parseJsonObject(const std::string& text);
+
+/**
+ * @brief Quotes and escapes text as a JSON string.
+ */
+std::string toJsonString(const std::string& text);
+
+#endif
@@ -14,9 +14,32 @@
 #include "detect_file_format.h"
 #include "write_wave.h"
 #include "compare_audio.h"
+#include "execution_context.h"
+#include "silence_detection.h"
+#include "repeat_detection.h"
+#include "adaptive_format.h"
+#include "incremental_encode.h"
+#include "encode_checkpoint.h"
+#include "progress.h"
+#include "json_lines.h"
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <map>
+#include <optional>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <csignal>
+
+#if defined(_WIN32)
+    #include <io.h>
+    #define isatty _isatty
+    #define fileno _fileno
+#else
+    #include <unistd.h>
+#endif
 
 std::map <std::string, VocSampleFormat> compressionFormats =
 {
@@ -25,6 +48,9 @@ std::map <std::string, VocSampleFormat> compressionFormats =
     {"ADPCM2", VOC_FORMAT_ADPCM_2BIT},
 };
 
+// chooses one of the compression formats per block
+const std::string adaptiveCompression = "ADAPTIVE";
+
 std::string vocSampleFormatToString(VocSampleFormat format)
 {
     for (auto& elem : compressionFormats)
@@ -41,6 +67,7 @@ std::string vocSampleFormatToString(VocSampleFormat format)
 enum class AdpcmEncoderAlgorithm
 {
     combined,
+    parallel,
     trellis
 };
 
@@ -53,6 +80,10 @@ AdpcmEncoderAlgorithm getAdpcmEncoderAlgorithm(const clp::CommandLineParser& par
         {
             return AdpcmEncoderAlgorithm::combined;
         }
+        else if (algoStr == "parallel")
+        {
+            return AdpcmEncoderAlgorithm::parallel;
+        }
         else if (algoStr == "trellis")
         {
             return AdpcmEncoderAlgorithm::trellis;
@@ -69,26 +100,79 @@ AdpcmEncoderAlgorithm getAdpcmEncoderAlgorithm(const clp::CommandLineParser& par
 }
 
 
-int convertWaveToVoc(const clp::CommandLineParser& parser)
+enum class Resampler
+{
+    linear,
+    sinc
+};
+
+Resampler getResampler(const clp::CommandLineParser& parser)
+{
+    std::string resamplerStr = parser.getValue<std::string>("resampler");
+    if (resamplerStr == "linear")
+    {
+        return Resampler::linear;
+    }
+    else if (resamplerStr == "sinc")
+    {
+        return Resampler::sinc;
+    }
+    throw std::runtime_error("invalid resampler");
+}
+
+
+/**
+ * Returns the compression format to be used for the whole file, or no value for adaptive compression.
+ */
+std::optional<VocSampleFormat> getCompressionFormat(const clp::CommandLineParser& parser)
 {
-    VocSampleFormat format;
     try
     {
-        format = compressionFormats.at(parser.getValue<std::string>("compression"));
+        std::string compression = parser.getValue<std::string>("compression");
+        if (compression == adaptiveCompression)
+        {
+            return std::nullopt;
+        }
+        return compressionFormats.at(compression);
     }
     catch (...)
     {
-        printf("invalid compression format\n");
-        return 1;
+        throw std::runtime_error("invalid compression format");
     }
+}
 
+
+/**
+ * Loads a WAVE file as mono and applies resampling and normalization as requested on the command line.
+ */
+WaveFileMono loadPreparedWaveFile(const clp::CommandLineParser& parser, const std::string& filename)
+{
     auto targetSampleRate = parser.getValueOptional<int32_t>("frequency");
-    auto filename = parser.getValue<std::string>("input");
     auto waveFile = loadWaveFileToMono(filename.c_str());
 
-    printf("Creating file %s, ", parser.getValue<std::string>("output").c_str());
+    // VOC files have 8-bit samples, a higher attenuation would only make the filters longer
+    double attenuation = parser.getValueOptional<double>("attenuation").value_or(attenuationForBitDepth(8));
 
-    if (targetSampleRate.has_value() && *targetSampleRate != waveFile.sampleRate)
+    if (targetSampleRate.has_value() && getResampler(parser) == Resampler::sinc)
+    {
+        // The VOC header stores an integer time constant, so resample to the rate the
+        // file is actually played back with. The header is still written from the
+        // requested frequency, which leads to the same time constant.
+        double playbackRate = vocPlaybackFrequency(*targetSampleRate);
+        if (playbackRate != waveFile.sampleRate)
+        {
+            printf("resampling from %d Hz to %.2f Hz, ", waveFile.sampleRate, playbackRate);
+            waveFile.data = resampleSinc(
+                waveFile.data,
+                waveFile.sampleRate,
+                playbackRate,
+                parser.getValueOptional<double>("cutoff"),
+                parser.getValueOptional<double>("transition"),
+                attenuation);
+        }
+        waveFile.sampleRate = *targetSampleRate;
+    }
+    else if (targetSampleRate.has_value() && *targetSampleRate != waveFile.sampleRate)
     {
         printf("resampling from %d Hz to %d Hz, ", waveFile.sampleRate, *targetSampleRate);
         // resample
@@ -97,7 +181,8 @@ int convertWaveToVoc(const clp::CommandLineParser& parser)
             waveFile.sampleRate,
             *targetSampleRate,
             parser.getValueOptional<double>("cutoff"),
-            parser.getValueOptional<double>("transition"));
+            parser.getValueOptional<double>("transition"),
+            attenuation);
         waveFile.sampleRate = *targetSampleRate;
     }
 
@@ -107,61 +192,505 @@ int convertWaveToVoc(const clp::CommandLineParser& parser)
         normalize(waveFile.data, parser.getValue<float>("normalize"));
     }
 
-    auto raw = toUint8Vector(waveFile.data);
+    return waveFile;
+}
 
-    std::vector<uint8_t> encodedSampleData;
 
+std::vector<uint8_t> encodeSamples(const clp::CommandLineParser& parser, VocSampleFormat format, const std::vector<uint8_t>& raw, std::chrono::steady_clock::time_point deadline, EncodeCheckpoint* checkpoint = nullptr)
+{
     AdpcmEncoderAlgorithm algorithm = getAdpcmEncoderAlgorithm(parser);
 
     switch (format)
     {
     case VOC_FORMAT_ADPCM_4BIT:
     {
-        printf("Output format: ADPCM 4-bit\n");
-        if (algorithm == AdpcmEncoderAlgorithm::combined)
+        if (parser.hasValue("time-limit"))
         {
 #if defined(__x86_64__)
-            encodedSampleData = createAdpcm4BitFromRawSIMD(raw, parser.getValue<uint64_t>("level"));
+            return createAdpcm4BitFromRawTimeLimitedSIMD(raw, deadline);
 #elif defined(__aarch64__)
-            encodedSampleData = createAdpcm4BitFromRawNeon(raw, parser.getValue<uint64_t>("level"));
+            return createAdpcm4BitFromRawTimeLimitedNeon(raw, deadline);
 #else
-            encodedSampleData = createAdpcm4BitFromRaw(raw, parser.getValue<uint64_t>("level"));
+            return createAdpcm4BitFromRawTimeLimited(raw, deadline);
 #endif
         }
-        else if (algorithm == AdpcmEncoderAlgorithm::trellis)
+        if (algorithm == AdpcmEncoderAlgorithm::trellis)
         {
-            encodedSampleData = createAdpcm4BitFromRawTrellis(raw, parser.getValue<uint32_t>("level"));
+            auto maxBranches = parser.getValue<uint32_t>("level");
+            auto seed = parser.getValue<uint64_t>("seed");
+            auto diversity = parser.getValue<double>("diversity");
+#if defined(__x86_64__)
+            return createAdpcm4BitFromRawTrellisSIMD(raw, maxBranches, seed, diversity, checkpoint);
+#elif defined(__aarch64__)
+            return createAdpcm4BitFromRawTrellisNeon(raw, maxBranches, seed, diversity, checkpoint);
+#else
+            return createAdpcm4BitFromRawTrellis(raw, maxBranches, seed, diversity, checkpoint);
+#endif
         }
-        auto decodedSampleData = decodeAdpcm4(
-            encodedSampleData.front(),
-            std::span<uint8_t>(encodedSampleData).subspan(1));
-        
-        auto difference = computeAudioDifference(raw, decodedSampleData, waveFile.sampleRate);
-        printf("  Average difference after encoding and decoding: %.2f\n", difference.averageDifference);
-        printf("  Max difference after encoding and decoding: %.2f\n", difference.maxDifference);
-
-        break;
+        if (algorithm == AdpcmEncoderAlgorithm::parallel)
+        {
+            return createAdpcm4BitFromRawOpenMP(raw, parser.getValue<uint64_t>("level"));
+        }
+        if (parser.hasValue("level-error"))
+        {
+            auto maxError = parser.getValue<double>("level-error");
+#if defined(__x86_64__)
+            return createAdpcm4BitFromRawAdaptiveSIMD(raw, parser.getValue<uint64_t>("level"), maxError);
+#elif defined(__aarch64__)
+            return createAdpcm4BitFromRawAdaptiveNeon(raw, parser.getValue<uint64_t>("level"), maxError);
+#else
+            return createAdpcm4BitFromRawAdaptive(raw, parser.getValue<uint64_t>("level"), maxError);
+#endif
+        }
+#if defined(__x86_64__)
+        return createAdpcm4BitFromRawSIMD(raw, parser.getValue<uint64_t>("level"), checkpoint);
+#elif defined(__aarch64__)
+        return createAdpcm4BitFromRawNeon(raw, parser.getValue<uint64_t>("level"), checkpoint);
+#else
+        return createAdpcm4BitFromRaw(raw, parser.getValue<uint64_t>("level"), checkpoint);
+#endif
     }
     case VOC_FORMAT_ADPCM_2BIT:
     {
-        printf("Output format: ADPCM 2-bit\n");
-        encodedSampleData = createAdpcm2BitFromRaw(raw, parser.getValue<uint64_t>("level"));
-        break;
+        return createAdpcm2BitFromRaw(raw, parser.getValue<uint64_t>("level"));
     }
     case VOC_FORMAT_PCM_8BIT:
     {
-        printf("Output format: PCM 8-bit\n");
-        encodedSampleData = raw;
-        break;
+        return raw;
+    }
+    default:
+    {
+        throw std::runtime_error("compression format not implemented");
+    }
+    }
+}
+
+
+/**
+ * Creates the checkpoint of an encode if --checkpoint or --resume is given. Only the
+ * combined and trellis ADPCM4 encoders of a whole file support checkpoints.
+ */
+std::unique_ptr<EncodeCheckpoint> createCheckpoint(const clp::CommandLineParser& parser, std::optional<VocSampleFormat> format, const std::vector<uint8_t>& raw)
+{
+    if (!parser.hasValue("checkpoint") && !parser.hasValue("resume"))
+    {
+        return {};
+    }
+
+    AdpcmEncoderAlgorithm algorithm = getAdpcmEncoderAlgorithm(parser);
+    if (format != VOC_FORMAT_ADPCM_4BIT || algorithm == AdpcmEncoderAlgorithm::parallel || parser.hasValue("level-error") || parser.hasValue("time-limit") ||
+        parser.hasValue("silence") || parser.hasValue("repeat") || parser.hasValue("index"))
+    {
+        throw std::runtime_error("Checkpoints can only be used with the combined and trellis ADPCM4 encoders, without level error, time limit, index, silence and repeat detection");
+    }
+
+    if (parser.getValue<double>("checkpoint-interval") < 0)
+    {
+        throw std::runtime_error("Checkpoint interval must not be negative");
+    }
+
+    // the encoders for different instruction sets break ties differently
+#if defined(__x86_64__)
+    std::string settings = "SIMD ";
+#elif defined(__aarch64__)
+    std::string settings = "NEON ";
+#else
+    std::string settings = "scalar ";
+#endif
+    if (algorithm == AdpcmEncoderAlgorithm::trellis)
+    {
+        settings += "trellis " + parser.getValue<std::string>("level") + " " + parser.getValue<std::string>("seed") + " " + parser.getValue<std::string>("diversity");
+    }
+    else
+    {
+        settings += "combined " + parser.getValue<std::string>("level");
+    }
+
+    auto filename = parser.getValueOptional<std::string>("checkpoint").value_or(parser.getValueOptional<std::string>("resume").value_or(""));
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(parser.getValue<double>("checkpoint-interval")));
+    auto checkpoint = std::make_unique<EncodeCheckpoint>(filename, settings, raw, interval);
+
+    if (parser.hasValue("resume"))
+    {
+        checkpoint->resume(parser.getValue<std::string>("resume"));
+        printf("  Resuming with %zu of %zu samples encoded\n", checkpoint->storedNibbles(), raw.size());
+    }
+    return checkpoint;
+}
+
+
+/**
+ * Encodes the samples into one ADPCM4 block in content defined chunks. If the index file and
+ * the output file of an earlier run exist, the chunks that did not change are taken from the
+ * output file instead of being searched again. The index is updated for the next run.
+ */
+std::vector<VocBlock> encodeIncremental(const clp::CommandLineParser& parser, std::optional<VocSampleFormat> format, const std::vector<uint8_t>& raw)
+{
+    if (format != VOC_FORMAT_ADPCM_4BIT || getAdpcmEncoderAlgorithm(parser) != AdpcmEncoderAlgorithm::combined ||
+        parser.hasValue("level-error") || parser.hasValue("time-limit") || parser.hasValue("silence") || parser.hasValue("repeat"))
+    {
+        throw std::runtime_error("The index can only be used with the combined ADPCM4 encoder, without level error, time limit, silence and repeat detection");
+    }
+
+    auto indexFilename = parser.getValue<std::string>("index");
+    auto outputFilename = parser.getValue<std::string>("output");
+    if (isStandardStream(outputFilename))
+    {
+        throw std::runtime_error("The index needs an output file, it cannot be used with stdout");
+    }
+
+    EncodeIndex previousIndex = {};
+    std::vector<uint8_t> previousEncoded;
+    if (std::filesystem::exists(indexFilename) && std::filesystem::exists(outputFilename))
+    {
+        previousIndex = readEncodeIndex(indexFilename);
+        auto previousFile = readVocFile(outputFilename);
+        if (previousFile.blocks.size() == 1 && previousFile.blocks[0].type == VOC_BLOCK_SOUND && previousFile.blocks[0].sampleFormat == VOC_FORMAT_ADPCM_4BIT)
+        {
+            previousEncoded = std::move(previousFile.blocks[0].sampleData);
+        }
+    }
+
+    auto result = createAdpcm4BitIncremental(raw, parser.getValue<uint64_t>("level"), previousIndex, previousEncoded);
+    printf("  Incremental: reused %zu of %zu samples\n", result.reusedSamples, raw.size());
+
+    writeEncodeIndex(indexFilename, result.index);
+    return { createSoundBlock(VOC_FORMAT_ADPCM_4BIT, result.encoded) };
+}
+
+
+/**
+ * Encodes the samples into VOC blocks. If silence detection is requested, silent runs
+ * become silence blocks. If repeat detection is requested, repeated segments are encoded
+ * once and stored with repeat blocks. Only the remaining samples are encoded, either in
+ * the given format or, without a format, in the smallest format per block that meets the
+ * maximum error.
+ */
+std::vector<VocBlock> encodeBlocks(const clp::CommandLineParser& parser, std::optional<VocSampleFormat> format, const std::vector<uint8_t>& raw, uint32_t sampleRate, EncodeCheckpoint* checkpoint = nullptr)
+{
+    if (parser.hasValue("index"))
+    {
+        return encodeIncremental(parser, format, raw);
+    }
+
+    // all parts of the file share the time limit, parts encoded after the deadline only get the first fast encode
+    auto deadline = std::chrono::steady_clock::now();
+    if (parser.hasValue("time-limit"))
+    {
+        if (parser.getValue<double>("time-limit") < 0)
+        {
+            throw std::runtime_error("Time limit must not be negative");
+        }
+        deadline += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(parser.getValue<double>("time-limit")));
+    }
+
+    FormatEncoder encode = [&](VocSampleFormat sampleFormat, const std::vector<uint8_t>& samples) { return encodeSamples(parser, sampleFormat, samples, deadline, checkpoint); };
+
+    // blocks that decode to exactly the given samples
+    BlockEncoder encodeExact = [&](const std::vector<uint8_t>& samples) -> std::vector<VocBlock>
+    {
+        if (format.has_value())
+        {
+            return createExactSoundBlocks(*format, samples, [&](const std::vector<uint8_t>& input) { return encode(*format, input); });
+        }
+
+        auto blockLength = static_cast<size_t>(parser.getValue<double>("block-length") * sampleRate / 1000);
+        return createAdaptiveBlocks(samples, std::max<size_t>(blockLength, 1), parser.getValue<double>("max-error"), sampleRate, encode);
+    };
+
+    size_t repeatedSamples = 0;
+    size_t repeatRuns = 0;
+    BlockEncoder encodeWithRepeats = [&](const std::vector<uint8_t>& samples) -> std::vector<VocBlock>
+    {
+        if (!parser.hasValue("repeat"))
+        {
+            if (format.has_value())
+            {
+                return { createSoundBlock(*format, encode(*format, samples)) };
+            }
+            return encodeExact(samples);
+        }
+
+        int tolerance = parser.getValue<int>("repeat-tolerance");
+        if (tolerance < 0 || tolerance > 255)
+        {
+            throw std::runtime_error("Repeat tolerance must be between 0 and 255");
+        }
+        auto minimumLength = static_cast<size_t>(parser.getValue<double>("repeat") * sampleRate / 1000);
+
+        auto repeats = findRepeats(samples, minimumLength, static_cast<uint8_t>(tolerance));
+        for (const RepeatRun& run : repeats)
+        {
+            repeatedSamples += (run.count - 1) * run.length;
+        }
+        repeatRuns += repeats.size();
+        return createBlocksWithRepeats(samples, repeats, encodeExact);
+    };
+
+    std::vector<VocBlock> blocks;
+    if (parser.hasValue("silence"))
+    {
+        int threshold = parser.getValue<int>("silence");
+        if (threshold < 0 || threshold > 127)
+        {
+            throw std::runtime_error("Silence threshold must be between 0 and 127");
+        }
+        auto minimumLength = static_cast<size_t>(parser.getValue<double>("silence-length") * sampleRate / 1000);
+
+        auto silence = findSilence(raw, static_cast<uint8_t>(threshold), minimumLength);
+        size_t silentSamples = 0;
+        for (const SilenceRun& run : silence)
+        {
+            silentSamples += run.length;
+        }
+        printf("  Silence: %zu of %zu samples in %zu runs\n", silentSamples, raw.size(), silence.size());
+
+        blocks = createBlocksWithSilence(raw, silence, encodeWithRepeats);
+    }
+    else
+    {
+        blocks = encodeWithRepeats(raw);
+    }
+
+    if (parser.hasValue("repeat"))
+    {
+        printf("  Repeats: %zu of %zu samples in %zu runs\n", repeatedSamples, raw.size(), repeatRuns);
+    }
+    return blocks;
+}
+
+
+/**
+ * VOC files encoded by earlier jobs of the server mode, by their samples and the options
+ * that change the encoding. The cache is cleared when it gets larger than maxBytes.
+ */
+class EncodeCache
+{
+public:
+    const std::vector<uint8_t>* find(const std::string& key)
+    {
+        auto found = m_files.find(key);
+        if (found == m_files.end())
+        {
+            return nullptr;
+        }
+        ++m_hits;
+        return &found->second;
+    }
+
+    void insert(const std::string& key, std::vector<uint8_t> vocData)
+    {
+        if (m_bytes + vocData.size() > maxBytes)
+        {
+            m_files.clear();
+            m_bytes = 0;
+        }
+        m_bytes += vocData.size();
+        m_files[key] = std::move(vocData);
+    }
+
+    size_t hits() const
+    {
+        return m_hits;
+    }
+
+    static std::string key(const clp::CommandLineParser& parser, const std::vector<uint8_t>& raw, uint32_t sampleRate)
+    {
+        std::string key = std::to_string(hashSamples(raw.data(), raw.size())) + " " + std::to_string(raw.size()) + " " + std::to_string(sampleRate);
+        for (const char* name : { "compression", "level", "level-error", "max-error", "block-length", "silence", "silence-length", "repeat", "repeat-tolerance", "algorithm", "seed", "diversity" })
+        {
+            key += std::string(" ") + name + "=" + parser.getValueOptional<std::string>(name).value_or("-");
+        }
+        return key;
+    }
+
+private:
+    static constexpr size_t maxBytes = 256 * 1024 * 1024;
+
+    std::map<std::string, std::vector<uint8_t>> m_files;
+    size_t m_bytes = 0;
+    size_t m_hits = 0;
+};
+
+
+int convertWaveToVoc(const clp::CommandLineParser& parser, EncodeCache* cache = nullptr)
+{
+    std::optional<VocSampleFormat> format;
+    try
+    {
+        format = getCompressionFormat(parser);
     }
-    case VOC_FORMAT_ADPCM_3BIT:
+    catch (...)
+    {
+        printf("invalid compression format\n");
+        return 1;
+    }
+
+    auto filename = parser.getValue<std::string>("input");
+
+    printf("Creating file %s, ", parser.getValue<std::string>("output").c_str());
+
+    auto waveFile = loadPreparedWaveFile(parser, filename);
+    auto raw = toUint8Vector(waveFile.data);
+
+    switch (format.value_or(VOC_FORMAT_ADPCM_4BIT))
     {
+    case VOC_FORMAT_ADPCM_4BIT:
+        printf(format.has_value() ? "Output format: ADPCM 4-bit\n" : "Output format: adaptive\n");
+        break;
+    case VOC_FORMAT_ADPCM_2BIT:
+        printf("Output format: ADPCM 2-bit\n");
+        break;
+    case VOC_FORMAT_PCM_8BIT:
+        printf("Output format: PCM 8-bit\n");
+        break;
+    default:
         printf("compression format not implemented\n");
         return 1;
     }
+
+    // the time limited encoder does not always produce the same output, the index and checkpoints have to be written
+    std::string cacheKey;
+    if (cache && !parser.hasValue("time-limit") && !parser.hasValue("index") && !parser.hasValue("checkpoint") && !parser.hasValue("resume"))
+    {
+        cacheKey = EncodeCache::key(parser, raw, waveFile.sampleRate);
+        if (auto cached = cache->find(cacheKey))
+        {
+            printf("  Same input and options as an earlier job, using its result\n");
+            storeFile(parser.getValue<std::string>("output"), *cached);
+            return 0;
+        }
+    }
+
+    auto checkpoint = createCheckpoint(parser, format, raw);
+    std::vector<VocBlock> blocks;
+    try
+    {
+        blocks = encodeBlocks(parser, format, raw, waveFile.sampleRate, checkpoint.get());
+    }
+    catch (const OperationCancelled&)
+    {
+        // keep what was encoded so far for --resume
+        if (checkpoint)
+        {
+            checkpoint->write();
+        }
+        throw;
+    }
+
+    if (!format.has_value())
+    {
+        std::map<VocSampleFormat, size_t> samplesPerFormat;
+        for (const VocBlock& block : blocks)
+        {
+            if (block.type == VOC_BLOCK_SOUND)
+            {
+                samplesPerFormat[block.sampleFormat] += vocBlockSampleCount(block);
+            }
+        }
+        printf("  Samples per format: ADPCM2 %zu, ADPCM4 %zu, PCM %zu\n",
+            samplesPerFormat[VOC_FORMAT_ADPCM_2BIT],
+            samplesPerFormat[VOC_FORMAT_ADPCM_4BIT],
+            samplesPerFormat[VOC_FORMAT_PCM_8BIT]);
     }
-    std::vector<uint8_t> vocData = createVocFile(waveFile.sampleRate, encodedSampleData, format);
+
+    if (format.value_or(VOC_FORMAT_ADPCM_4BIT) == VOC_FORMAT_ADPCM_4BIT)
+    {
+        VocFile encoded = { 0, 1, 10, VOC_FORMAT_ADPCM_4BIT, {}, blocks };
+        auto decodedSampleData = decodeToPcm(encoded).sampleData;
+
+        auto difference = computeAudioDifference(raw, decodedSampleData, waveFile.sampleRate);
+        printf("  Average difference after encoding and decoding: %.2f\n", difference.averageDifference);
+        printf("  Max difference after encoding and decoding: %.2f\n", difference.maxDifference);
+    }
+
+    std::vector<uint8_t> vocData = createVocFile(waveFile.sampleRate, blocks);
     storeFile(parser.getValue<std::string>("output"), vocData);
+
+    if (checkpoint)
+    {
+        checkpoint->remove();
+    }
+    if (!cacheKey.empty())
+    {
+        cache->insert(cacheKey, std::move(vocData));
+    }
+    return 0;
+}
+
+
+/**
+ * Converts all WAVE files listed in the batch file using the same options.
+ * ADPCM4 files are encoded together, one file per SIMD lane.
+ */
+int convertBatch(const clp::CommandLineParser& parser)
+{
+    if (parser.hasValue("index") || parser.hasValue("checkpoint") || parser.hasValue("resume"))
+    {
+        throw std::runtime_error("The index and checkpoints cannot be used in batch mode");
+    }
+
+    std::optional<VocSampleFormat> format = getCompressionFormat(parser);
+
+    auto batchFilename = parser.getValue<std::string>("batch");
+    std::ifstream batchFile(batchFilename);
+    if (!batchFile.is_open())
+    {
+        throw std::runtime_error("Could not open batch file: " + batchFilename);
+    }
+
+    std::vector<std::pair<std::string, std::string>> jobs;
+    std::string line;
+    while (std::getline(batchFile, line))
+    {
+        std::istringstream lineStream(line);
+        std::string input, output;
+        if (!(lineStream >> input))
+        {
+            continue; // empty line
+        }
+        if (!(lineStream >> output))
+        {
+            throw std::runtime_error("Missing output file for input " + input + " in batch file");
+        }
+        jobs.emplace_back(input, output);
+    }
+
+    std::vector<std::vector<uint8_t>> raws;
+    std::vector<uint32_t> sampleRates;
+    for (auto& job : jobs)
+    {
+        printf("Loading file %s, ", job.first.c_str());
+        auto waveFile = loadPreparedWaveFile(parser, job.first);
+        printf("\n");
+        raws.push_back(toUint8Vector(waveFile.data));
+        sampleRates.push_back(waveFile.sampleRate);
+    }
+
+    std::vector<std::vector<VocBlock>> encoded;
+#if defined(__x86_64__)
+    if (format == VOC_FORMAT_ADPCM_4BIT && getAdpcmEncoderAlgorithm(parser) == AdpcmEncoderAlgorithm::combined && !parser.hasValue("level-error") && !parser.hasValue("time-limit") && !parser.hasValue("silence") && !parser.hasValue("repeat"))
+    {
+        printf("Encoding %zu files in batch mode\n", raws.size());
+        for (auto& sampleData : createAdpcm4BitBatchSIMD(raws, parser.getValue<uint64_t>("level")))
+        {
+            encoded.push_back({ createSoundBlock(*format, std::move(sampleData)) });
+        }
+    }
+#endif
+    if (encoded.empty())
+    {
+        for (size_t i = 0; i < raws.size(); ++i)
+        {
+            encoded.push_back(encodeBlocks(parser, format, raws[i], sampleRates[i]));
+        }
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        printf("Creating file %s\n", jobs[i].second.c_str());
+        storeFile(jobs[i].second, createVocFile(sampleRates[i], encoded[i]));
+    }
     return 0;
 }
 
@@ -189,45 +718,286 @@ int convertVocToWave(const clp::CommandLineParser& parser)
 }
 
 
+void configureExecution(const clp::CommandLineParser& parser)
+{
+    // command line parameters take precedence over the environment
+    ExecutionSettings settings = ExecutionContext::settingsFromEnvironment();
+    if (parser.hasValue("threads"))
+    {
+        settings.threads = parser.getValue<int>("threads");
+    }
+    if (parser.hasValue("cpus"))
+    {
+        settings.cpus = parseCpuList(parser.getValue<std::string>("cpus"));
+    }
+    ExecutionContext::configure(settings);
+}
+
+
+/**
+ * Shows the progress of the stages on stderr. On a terminal the progress is a single line
+ * that is removed when the stage finishes, "lines" writes one line per report for programs
+ * that read the progress.
+ */
+void configureProgress(const clp::CommandLineParser& parser)
+{
+    auto mode = parser.getValue<std::string>("progress");
+    if (mode == "off" || (mode == "auto" && !isatty(fileno(stderr))))
+    {
+        return;
+    }
+
+    if (mode == "auto")
+    {
+        Progress::setCallback([](const ProgressInfo& info)
+        {
+            if (info.finished)
+            {
+                fprintf(stderr, "\r\033[K");
+                return;
+            }
+            fprintf(stderr, "\r\033[K  %s: %.0f%%, %.0f samples/s, %.0f s left", info.stage, 100.0 * info.done / std::max<size_t>(info.total, 1), info.samplesPerSecond, std::max(info.secondsLeft, 0.0));
+        });
+    }
+    else if (mode == "lines")
+    {
+        Progress::setCallback([](const ProgressInfo& info)
+        {
+            fprintf(stderr, "progress stage=\"%s\" done=%zu total=%zu samples_per_second=%.0f seconds_left=%.1f finished=%d\n",
+                info.stage, info.done, info.total, info.samplesPerSecond, info.secondsLeft, info.finished ? 1 : 0);
+        }, std::chrono::seconds(1));
+    }
+    else
+    {
+        throw std::runtime_error("Invalid progress mode \"" + mode + "\"");
+    }
+
+    fflush(stderr);
+}
+
+
+void handleInterrupt(int)
+{
+    // the stages stop at their next progress update, a second Ctrl+C terminates immediately
+    Progress::cancel();
+    std::signal(SIGINT, SIG_DFL);
+}
+
+
+clp::CommandLineParser createParser()
+{
+    clp::CommandLineParser parser(
+        "Program to convert WAVE files into VOC files including optional ADPCM compression.\n"
+        "Conversion from VOC to WAVE is also supported.\n"
+        "File is converted to mono. If a frequency is give then the file is also resampled\n"
+        "to the given frequency. Otherwise the sample frequency of the WAVE file is kept.\n\n"
+        "Compression formats:\n"
+        "  PCM      - unsigned integer 8-bit per sample\n"
+        "  ADPCM4   - ADPCM 4-bit per sample\n"
+        "  ADPCM2   - ADPCM 2-bit per sample\n"
+        "  ADAPTIVE - PCM, ADPCM4 or ADPCM2 per block\n");
+    parser.addParameter("input", "i", "Name of the input file, - for stdin. Required unless batch mode is used.", clp::ParameterRequired::no);
+    parser.addParameter("output", "o", "Name of the output file, - for stdout. Messages are written to stderr then. Required unless batch mode is used.", clp::ParameterRequired::no);
+    parser.addParameter("frequency", "f", "Frequency of output file in hertz", clp::ParameterRequired::no);
+    parser.addParameter("compression", "c", "Compression to be used. Options: PCM, ADPCM4, ADPCM2, ADAPTIVE (smallest format per block that meets the maximum error)", clp::ParameterRequired::no, "ADPCM4");
+    parser.addParameter("normalize", "n", "Normalize audio to given fraction, e.g. 0.9", clp::ParameterRequired::no);
+    parser.addParameter("level", "l", "Level of compression. Must be integer between 1 and 8. 1 = lowest quality but fast. Bigger values than 5 probably make no sense and are terribly slow.", clp::ParameterRequired::no, "4");
+    parser.addParameter("level-error", "e", "Adaptive level for the combined ADPCM4 encoder: every group of samples is encoded with level 1 and only searched again with the given level if its average squared error is above this value or the signal changes faster than the decoder can follow, e.g. 16. Default is the given level everywhere.", clp::ParameterRequired::no);
+    parser.addParameter("time-limit", "m", "Time limit for the ADPCM4 encoding of a file in seconds, e.g. 2.5. The file is encoded quickly first and then improved until the time is up, instead of using the level and algorithm.", clp::ParameterRequired::no);
+    parser.addParameter("index", "x", "Index file for incremental encoding with the combined ADPCM4 encoder. If the index and the output file of an earlier run exist, only the parts of the input that changed are encoded again. The output differs from encoding without an index.", clp::ParameterRequired::no);
+    parser.addParameter("checkpoint", "k", "Write the progress of the combined or trellis ADPCM4 encoder to this file, so an interrupted encode can be continued with --resume. The file is removed when the output file is written.", clp::ParameterRequired::no);
+    parser.addParameter("resume", "u", "Continue an interrupted encode from this checkpoint file. The input and the encoder options must be the same as before. New checkpoints are written to the same file unless --checkpoint is given.", clp::ParameterRequired::no);
+    parser.addParameter("checkpoint-interval", "w", "Time between two checkpoints in seconds.", clp::ParameterRequired::no, "60");
+    parser.addParameter("cutoff", "C", "Cutoff frequency for lowpass filter in Hz. Default is half of sampling frequency.", clp::ParameterRequired::no);
+    parser.addParameter("transition", "T", "Transition bandwidth for lowpass filter in Hz. Default is 1/10 of sampling frequency.", clp::ParameterRequired::no);
+    parser.addParameter("attenuation", "A", "Stopband attenuation of the resampling filters in dB. Default is 49.92 dB, the dynamic range of 8-bit samples. The filters use a Kaiser window designed for this attenuation, so the resampled output differs from versions that used a Blackman window. Higher values need longer filters.", clp::ParameterRequired::no);
+    parser.addParameter("resampler", "r", "Resampler to be used, options are: sinc (band-limited, resamples to the exact playback rate of the VOC file) and linear (lowpass filter and linear interpolation to the given frequency)", clp::ParameterRequired::no, "sinc");
+    parser.addParameter("silence", "S", "Store runs of samples that differ by at most this value from the zero line as silence blocks instead of encoding them, e.g. 2. Default is no silence detection.", clp::ParameterRequired::no);
+    parser.addParameter("silence-length", "L", "Minimum length of a run of silence in milliseconds.", clp::ParameterRequired::no, "100");
+    parser.addParameter("repeat", "R", "Store segments of at least this many milliseconds that are directly repeated only once, using VOC repeat blocks. Default is no repeat detection.", clp::ParameterRequired::no);
+    parser.addParameter("repeat-tolerance", "D", "Maximum difference of samples that still count as repeated.", clp::ParameterRequired::no, "0");
+    parser.addParameter("max-error", "E", "Adaptive compression: maximum average squared difference of the samples of a block after encoding and decoding.", clp::ParameterRequired::no, "32");
+    parser.addParameter("block-length", "B", "Adaptive compression: length of the blocks the format is chosen for in milliseconds.", clp::ParameterRequired::no, "20");
+    parser.addParameter("algorithm", "a", "ADPCM encoder to be used, options are: combined (default), parallel (combined search with the candidates of every group split between all cores, only up to level 3, from level 4 on the faster single core search of combined is used) and trellis", clp::ParameterRequired::no, "combined");
+    parser.addParameter("seed", "s", "Seed for the random branch selection of the trellis encoder. The same seed always produces the same output.", clp::ParameterRequired::no, "0");
+    parser.addParameter("diversity", "d", "Fraction of trellis branches that are chosen randomly instead of by lowest error, between 0 and 1.", clp::ParameterRequired::no, "0.5");
+    parser.addParameter("threads", "t", "Number of threads used by every parallel stage. Default is one per available CPU, can also be set with the environment variable VOCTOOL_THREADS.", clp::ParameterRequired::no);
+    parser.addParameter("cpus", "P", "Restrict the process to the given CPUs, e.g. 0-3,8. Can also be set with the environment variable VOCTOOL_CPUS.", clp::ParameterRequired::no);
+    parser.addParameter("progress", "g", "Progress display on stderr, options are: auto (on a terminal), lines (one line per second for other programs) and off", clp::ParameterRequired::no, "auto");
+    parser.addParameter("batch", "b", "Batch mode. Name of a text file with one \"input output\" pair of file names per line. All WAVE files are converted using the same options.", clp::ParameterRequired::no);
+    parser.addParameter("jobs", "j", "Server mode. Name of a file with one job per line, - for stdin. A job is a JSON object with option names as keys, e.g. {\"id\": \"1\", \"input\": \"a.wav\", \"output\": \"a.voc\", \"level\": 5}. The other options are the defaults for all jobs. One JSON result with the time of the job is written per line to stdout.", clp::ParameterRequired::no);
+    return parser;
+}
+
+
+/**
+ * Converts the input file to the output file. The type of conversion depends on the input file.
+ */
+int convertFile(const clp::CommandLineParser& parser, EncodeCache* cache = nullptr)
+{
+    if (!parser.hasValue("input") || !parser.hasValue("output"))
+    {
+        printf("Parameters \"input\" and \"output\" are required.\n");
+        return 1;
+    }
+
+    auto detectedFormat = detectFileFormat(parser.getValue<std::string>("input"));
+
+    if (detectedFormat == FileFormat::WAV)
+    {
+        return convertWaveToVoc(parser, cache);
+    }
+    else if (detectedFormat == FileFormat::VOC)
+    {
+        return convertVocToWave(parser);
+    }
+    else
+    {
+        printf("Input file is not a WAVE or VOC file\n");
+        return 1;
+    }
+}
+
+
+/**
+ * Server mode: runs the jobs of the jobs file one after the other in this process until the
+ * end of the file, so the OpenMP threads, the resampling filters and the files encoded by
+ * earlier jobs are reused. The options of a job are added to the options of the command line.
+ * The result of every job is written to stdout as a JSON line like
+ * {"id": "1", "ok": true, "seconds": 0.052, "cached": false}, with an "error" if it failed.
+ * Everything else the jobs print goes to stderr.
+ */
+int serveJobs(const clp::CommandLineParser& parser, const std::vector<std::string>& arguments)
+{
+    // the parser has checked that the arguments are pairs of option and value
+    std::vector<std::string> defaults;
+    for (size_t i = 0; i + 1 < arguments.size(); i += 2)
+    {
+        if (arguments[i] != "-j" && arguments[i] != "--jobs")
+        {
+            defaults.push_back(arguments[i]);
+            defaults.push_back(arguments[i + 1]);
+        }
+    }
+
+    auto jobsFilename = parser.getValue<std::string>("jobs");
+    std::ifstream jobsFile;
+    if (jobsFilename != "-")
+    {
+        jobsFile.open(jobsFilename);
+        if (!jobsFile.is_open())
+        {
+            throw std::runtime_error("Could not open jobs file: " + jobsFilename);
+        }
+    }
+    std::istream& jobs = jobsFilename == "-" ? std::cin : jobsFile;
+
+    redirectMessagesToStderr();
+    auto results = openFile("-", "w");
+
+    EncodeCache cache;
+    std::string line;
+    size_t lineNumber = 0;
+    int status = 0;
+    while (status == 0 && std::getline(jobs, line))
+    {
+        ++lineNumber;
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::string id = std::to_string(lineNumber);
+        std::optional<std::string> error;
+        size_t hits = cache.hits();
+        try
+        {
+            auto job = parseJsonObject(line);
+            if (job.count("id"))
+            {
+                id = job["id"];
+                job.erase("id");
+            }
+
+            std::vector<std::string> jobArguments = defaults;
+            for (const auto& [name, value] : job)
+            {
+                if (name == "jobs" || name == "batch" || name == "threads" || name == "cpus" || name == "progress")
+                {
+                    throw std::runtime_error("Option \"" + name + "\" cannot be set per job");
+                }
+                jobArguments.push_back("--" + name);
+                jobArguments.push_back(value);
+            }
+
+            clp::CommandLineParser jobParser = parser;
+            jobParser.parseArguments(jobArguments);
+            if (isStandardStream(jobParser.getValueOptional<std::string>("input").value_or("")) || isStandardStream(jobParser.getValueOptional<std::string>("output").value_or("")))
+            {
+                throw std::runtime_error("Jobs cannot use stdin or stdout");
+            }
+            if (int exitCode = convertFile(jobParser, &cache); exitCode != 0)
+            {
+                error = "Failed with exit code " + std::to_string(exitCode);
+            }
+        }
+        catch (const OperationCancelled& e)
+        {
+            error = e.what();
+            status = 130;
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+        }
+        fflush(stdout);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(results.get(), "{\"id\": %s, \"ok\": %s, \"seconds\": %.6f, \"cached\": %s%s}\n",
+            toJsonString(id).c_str(),
+            error ? "false" : "true",
+            seconds,
+            cache.hits() > hits ? "true" : "false",
+            error ? (", \"error\": " + toJsonString(*error)).c_str() : "");
+        fflush(results.get());
+    }
+
+    return status;
+}
+
+
 int main(int argc, char* argv[])
 {
     try
     {
-        clp::CommandLineParser parser(
-            "Program to convert WAVE files into VOC files including optional ADPCM compression.\n"
-            "Conversion from VOC to WAVE is also supported.\n"
-            "File is converted to mono. If a frequency is give then the file is also resampled\n"
-            "to the given frequency. Otherwise the sample frequency of the WAVE file is kept.\n\n"
-            "Compression formats:\n"
-            "  PCM    - unsigned integer 8-bit per sample\n"
-            "  ADPCM4 - ADPCM 4-bit per sample\n"
-            "  ADPCM2 - ADPCM 2-bit per sample\n");
-        parser.addParameter("input", "i", "Name of the input file", clp::ParameterRequired::yes);
-        parser.addParameter("output", "o", "Name of the output file", clp::ParameterRequired::yes);
-        parser.addParameter("frequency", "f", "Frequency of output file in hertz", clp::ParameterRequired::no);
-        parser.addParameter("compression", "c", "Compression to be used. Options: PCM, ADPCM4, ADPCM2", clp::ParameterRequired::no, "ADPCM4");
-        parser.addParameter("normalize", "n", "Normalize audio to given fraction, e.g. 0.9", clp::ParameterRequired::no);
-        parser.addParameter("level", "l", "Level of compression. Must be integer. 1 = lowest quality but fast. Bigger values than 5 probably make no sense and are terribly slow.", clp::ParameterRequired::no, "4");
-        parser.addParameter("cutoff", "C", "Cutoff frequency for lowpass filter in Hz. Default is half of sampling frequency.", clp::ParameterRequired::no);
-        parser.addParameter("transition", "T", "Transition bandwidth for lowpass filter in Hz. Default is 1/10 of sampling frequency.", clp::ParameterRequired::no);
-        parser.addParameter("algorithm", "a", "ADPCM encoder to be used, options are: combined (default) and trellis", clp::ParameterRequired::no, "combined");
+        clp::CommandLineParser parser = createParser();
         parser.parse(argc, argv);
-
-        auto detectedFormat = detectFileFormat(parser.getValue<std::string>("input"));
-
-        if (detectedFormat == FileFormat::WAV)
+        if (parser.hasValue("output") && isStandardStream(parser.getValue<std::string>("output")))
         {
-            return convertWaveToVoc(parser);
+            redirectMessagesToStderr();
         }
-        else if (detectedFormat == FileFormat::VOC)
+
+        configureExecution(parser);
+        configureProgress(parser);
+        std::signal(SIGINT, handleInterrupt);
+
+        if (parser.hasValue("batch"))
         {
-            return convertVocToWave(parser);
+            return convertBatch(parser);
         }
-        else
+
+        if (parser.hasValue("jobs"))
         {
-            printf("Input file is not a WAVE or VOC file\n");
-            return 1;
+            return serveJobs(parser, std::vector<std::string>(argv + 1, argv + argc));
         }
+
+        return convertFile(parser);
+    }
+    catch (const OperationCancelled&)
+    {
+        printf("\nCancelled\n");
+        return 130;
     }
     catch (const std::exception &e)
     {
@@ -0,0 +1,134 @@
+#include "progress.h"
+
+#include <mutex>
+#include <algorithm>
+#include <exception>
+
+namespace { // annonymous namespace
+
+std::mutex g_callbackMutex;
+ProgressCallback g_callback;
+std::chrono::steady_clock::duration g_interval;
+std::chrono::steady_clock::time_point g_nextReport;
+std::atomic<bool> g_reporting = false;
+
+// lock free, so cancel() can be called from a signal handler
+std::atomic<bool> g_cancelled = false;
+static_assert(std::atomic<bool>::is_always_lock_free);
+
+} // annonymous namespace
+
+
+void Progress::setCallback(ProgressCallback callback, std::chrono::steady_clock::duration interval)
+{
+    std::lock_guard lock(g_callbackMutex);
+    g_callback = std::move(callback);
+    g_interval = interval;
+    g_nextReport = std::chrono::steady_clock::now();
+    g_reporting = static_cast<bool>(g_callback);
+}
+
+
+void Progress::cancel()
+{
+    g_cancelled = true;
+}
+
+
+void Progress::reset()
+{
+    g_cancelled = false;
+}
+
+
+bool Progress::cancelled()
+{
+    return g_cancelled;
+}
+
+
+ProgressStage::ProgressStage(const char* name, size_t total) :
+    m_name(name),
+    m_total(total),
+    m_start(std::chrono::steady_clock::now())
+{
+    if (g_cancelled)
+    {
+        throw OperationCancelled();
+    }
+}
+
+
+ProgressStage::~ProgressStage()
+{
+    // a stage that is left by an exception did not finish
+    if (std::uncaught_exceptions() == 0)
+    {
+        try
+        {
+            report(m_total, true);
+        }
+        catch (...)
+        {
+        }
+    }
+}
+
+
+bool ProgressStage::add(size_t samples)
+{
+    size_t done = m_done.fetch_add(samples) + samples;
+    report(done, false);
+    return !g_cancelled;
+}
+
+
+void ProgressStage::throwIfCancelled() const
+{
+    if (g_cancelled)
+    {
+        throw OperationCancelled();
+    }
+}
+
+
+void ProgressStage::updateNow(size_t done)
+{
+    m_done = done;
+    m_nextUpdate = done + progressUpdateSamples;
+    throwIfCancelled();
+    report(done, false);
+}
+
+
+void ProgressStage::report(size_t done, bool finished)
+{
+    if (!g_reporting)
+    {
+        return;
+    }
+
+    // a thread that finds the callback busy skips its report, only the final one waits
+    std::unique_lock lock(g_callbackMutex, std::defer_lock);
+    if (finished)
+    {
+        lock.lock();
+    }
+    else if (!lock.try_lock())
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!g_callback || (!finished && (now < g_nextReport || now < m_start + g_interval)) || (finished && !m_reported))
+    {
+        return;
+    }
+    g_nextReport = now + g_interval;
+    m_reported = true;
+
+    double seconds = std::chrono::duration<double>(now - m_start).count();
+    double samplesPerSecond = seconds > 0 ? done / seconds : 0;
+    double secondsLeft = samplesPerSecond > 0 ? (m_total - std::min(done, m_total)) / samplesPerSecond : -1;
+    g_callback({ m_name, std::min(done, m_total), m_total, samplesPerSecond, secondsLeft, finished });
+}
@@ -0,0 +1,121 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+
+/**
+ * @brief State of a running stage, passed to the progress callback.
+ */
+struct ProgressInfo
+{
+    const char* stage;              ///< Name of the stage, e.g. "Resampling".
+    size_t done;                    ///< Samples processed so far.
+    size_t total;                   ///< Samples of the whole stage.
+    double samplesPerSecond;        ///< Throughput since the stage started.
+    double secondsLeft;             ///< Estimate from the throughput, negative if unknown.
+    bool finished;                  ///< True for the last report of the stage.
+};
+
+using ProgressCallback = std::function<void(const ProgressInfo&)>;
+
+/**
+ * @brief Thrown by the stages after Progress::cancel() was called.
+ */
+class OperationCancelled : public std::runtime_error
+{
+public:
+    OperationCancelled() : std::runtime_error("Operation cancelled") {}
+};
+
+/**
+ * @brief Process wide progress reporting and cancellation.
+ *
+ * Like ExecutionContext this is configured once for the process, so the encoders,
+ * resamplers and decoders report their progress without a callback parameter on
+ * every function.
+ */
+class Progress
+{
+public:
+    /**
+     * @brief Sets the callback for all stages. It is called at most once per interval while
+     *        a stage runs and once when a reported stage finishes, so short stages are not
+     *        reported. It may be called from any thread, but never concurrently. An empty
+     *        callback disables the reports.
+     */
+    static void setCallback(ProgressCallback callback, std::chrono::steady_clock::duration interval = std::chrono::milliseconds(200));
+
+    /**
+     * @brief Asks the running stages to stop, they throw OperationCancelled. Only sets
+     *        a flag, so it can be called from a signal handler.
+     */
+    static void cancel();
+
+    /**
+     * @brief Clears an earlier cancel(), so the next operation can run.
+     */
+    static void reset();
+
+    static bool cancelled();
+};
+
+/**
+ * @brief Number of samples between two updates of a sequential stage. Small enough for a
+ *        smooth display and a fast reaction to cancel(), large enough to not slow down
+ *        the inner loops of the encoders.
+ */
+constexpr size_t progressUpdateSamples = 4096;
+
+/**
+ * @brief Reports the progress of one stage, e.g. encoding a file, and checks for cancellation.
+ *
+ * Sequential loops call update() with their position in every iteration, it only does
+ * work every progressUpdateSamples samples. Parallel loops call add() once per block of
+ * work, it never throws, so it can be used inside OpenMP regions.
+ */
+class ProgressStage
+{
+public:
+    ProgressStage(const char* name, size_t total);
+    ~ProgressStage();
+
+    ProgressStage(const ProgressStage&) = delete;
+    ProgressStage& operator=(const ProgressStage&) = delete;
+
+    /**
+     * @brief Sets the number of processed samples. Throws OperationCancelled if cancelled.
+     *        Only for stages that run on one thread.
+     */
+    void update(size_t done)
+    {
+        if (done >= m_nextUpdate)
+        {
+            updateNow(done);
+        }
+    }
+
+    /**
+     * @brief Adds processed samples, thread safe.
+     * @return false if the stage is cancelled, call throwIfCancelled() after the parallel region.
+     */
+    bool add(size_t samples);
+
+    void throwIfCancelled() const;
+
+private:
+    void updateNow(size_t done);
+    void report(size_t done, bool finished);
+
+    const char* m_name;
+    size_t m_total;
+    std::chrono::steady_clock::time_point m_start;
+    std::atomic<size_t> m_done = 0;
+    size_t m_nextUpdate = progressUpdateSamples;
+    bool m_reported = false;        // stages that end before their first report are not reported at all
+};
+
+#endif
@@ -1,11 +1,13 @@
 #include "read_wave.h"
+#include "file_tools.h"
 
 #include <stdexcept>
 #include <cstring>
 #include <iostream>
 #include <memory>
 #include <sstream>
-#include "resampling.h"
+#include <algorithm>
+#include <limits>
 
 void safeRead(void* buffer, size_t size, size_t count, FILE* file)
 {
@@ -16,223 +18,429 @@ void safeRead(void* buffer, size_t size, size_t count, FILE* file)
 }
 
 
-WaveFileHeader readWaveFileHeader(FILE* file)
+uint16_t readUint16(FILE* file)
 {
-    WaveFileHeader header;
-    safeRead(header.chunkId.data(), 4, 1, file);
-    if (memcmp(header.chunkId.data(), "RIFF", 4) != 0)
+    uint8_t bytes[2];
+    safeRead(bytes, 2, 1, file);
+    return bytes[0] | (bytes[1] << 8);
+}
+
+
+uint32_t readUint32(FILE* file)
+{
+    uint8_t bytes[4];
+    safeRead(bytes, 4, 1, file);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+
+uint64_t readUint64(FILE* file)
+{
+    uint64_t low = readUint32(file);
+    uint64_t high = readUint32(file);
+    return low | (high << 32);
+}
+
+
+/**
+ * Skips the given number of bytes. Seeking is used if possible, otherwise
+ * the data is read and discarded, so this also works on pipes.
+ */
+void skipBytes(FILE* file, uint64_t count)
+{
+    // fseek only takes a long, which is 32 bit on some platforms
+    const uint64_t maxSeek = 1u << 30;
+    while (count > 0)
     {
-        throw std::runtime_error("Invalid file format, expected RIFF chunk.");
+        uint64_t step = std::min(count, maxSeek);
+        if (fseek(file, static_cast<long>(step), SEEK_CUR) != 0)
+        {
+            break;
+        }
+        count -= step;
     }
 
-    safeRead(&header.chunkSize, 4, 1, file);
-    safeRead(header.format.data(), 4, 1, file);
-    if (memcmp(header.format.data(), "WAVE", 4) != 0)
+    uint8_t buffer[4096];
+    while (count > 0)
     {
-        throw std::runtime_error("Invalid file format, expected WAVE chunk.");
+        size_t step = static_cast<size_t>(std::min<uint64_t>(count, sizeof(buffer)));
+        safeRead(buffer, step, 1, file);
+        count -= step;
     }
+}
+
 
-    safeRead(header.subChunk1Id.data(), 4, 1, file);
-    if (memcmp(header.subChunk1Id.data(), "fmt ", 4) != 0)
+/**
+ * Skips a chunk of the given size including the pad byte of odd sized chunks.
+ */
+void skipChunk(FILE* file, uint64_t chunkSize, uint64_t alreadyRead)
+{
+    if (alreadyRead > chunkSize)
     {
-        throw std::runtime_error("Invalid file format, expected fmt");
+        throw std::runtime_error("Invalid file format, chunk too small.");
     }
+    skipBytes(file, chunkSize - alreadyRead + (chunkSize & 1));
+}
 
-    safeRead(&header.subChunk1Size, 4, 1, file);
-    safeRead(&header.audioFormat, 2, 1, file);
-    safeRead(&header.numChannels, 2, 1, file);
-    safeRead(&header.sampleRate, 4, 1, file);
-    safeRead(&header.byteRate, 4, 1, file);
-    safeRead(&header.bytesPerSample, 2, 1, file);
-    safeRead(&header.bitsPerSample, 2, 1, file);
 
-    return header;
+std::string readChunkId(FILE* file)
+{
+    std::array<char, 4> chunkId;
+    safeRead(chunkId.data(), 4, 1, file);
+    return std::string(chunkId.data(), chunkId.size());
 }
 
 
-std::vector<uint8_t> readWaveDataChunk(FILE* file)
+// GUID of KSDATAFORMAT_SUBTYPE_PCM without the leading format code
+const std::array<uint8_t, 14> extensibleGuidSuffix = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+
+
+/**
+ * Reads the content of a "fmt " chunk into the given header. For WAVE_FORMAT_EXTENSIBLE
+ * the audio format is replaced by the format code from the sub format GUID.
+ */
+void readFormatChunk(FILE* file, uint32_t chunkSize, WaveFileHeader& header)
 {
-    uint32_t subChunk2Size;
-    safeRead(&subChunk2Size, 4, 1, file);
+    if (chunkSize < 16)
+    {
+        throw std::runtime_error("Invalid file format, fmt chunk too small.");
+    }
 
-    std::vector<uint8_t> data(subChunk2Size);
-    safeRead(data.data(), subChunk2Size, 1, file);
+    memcpy(header.subChunk1Id.data(), "fmt ", 4);
+    header.subChunk1Size = chunkSize;
+    header.audioFormat = readUint16(file);
+    header.numChannels = readUint16(file);
+    header.sampleRate = readUint32(file);
+    header.byteRate = readUint32(file);
+    header.bytesPerSample = readUint16(file);
+    header.bitsPerSample = readUint16(file);
+    uint64_t bytesRead = 16;
 
-    return data;
+    if (header.audioFormat == WAVE_FORMAT_EXTENSIBLE)
+    {
+        if (chunkSize < 40)
+        {
+            throw std::runtime_error("Invalid file format, extensible fmt chunk too small.");
+        }
+
+        [[maybe_unused]] uint16_t extensionSize = readUint16(file);
+        [[maybe_unused]] uint16_t validBitsPerSample = readUint16(file);
+        [[maybe_unused]] uint32_t channelMask = readUint32(file);
+        uint16_t subFormat = readUint16(file);
+        std::array<uint8_t, 14> guidSuffix;
+        safeRead(guidSuffix.data(), guidSuffix.size(), 1, file);
+        bytesRead = 40;
+
+        if (guidSuffix != extensibleGuidSuffix)
+        {
+            throw std::runtime_error("Unsupported sub format GUID in extensible WAVE file.");
+        }
+
+        header.audioFormat = subFormat;
+    }
+
+    skipChunk(file, chunkSize, bytesRead);
 }
 
 
-std::string readChunkId(FILE* file)
+WaveReader::WaveReader(const std::string& filename) :
+    m_file(openFile(filename, "rb"))
 {
-    std::array<char, 4> chunkId;
-    safeRead(chunkId.data(), 4, 1, file);
-    return std::string(chunkId.data(), chunkId.size());
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to open file");
+    }
+
+    readChunks();
 }
 
 
-WaveFile loadWaveFile(const std::string& filename)
+void WaveReader::readChunks()
 {
-    auto file = std::shared_ptr<FILE>(
-        fopen(filename.c_str(), "rb"),
-        [](FILE* file) { if (file) {fclose(file);} });
-    if (!file)
+    FILE* file = m_file.get();
+
+    safeRead(m_header.chunkId.data(), 4, 1, file);
+    bool isRf64 =
+        memcmp(m_header.chunkId.data(), "RF64", 4) == 0 ||
+        memcmp(m_header.chunkId.data(), "BW64", 4) == 0;
+    if (memcmp(m_header.chunkId.data(), "RIFF", 4) != 0 && !isRf64)
     {
-        throw std::runtime_error("Failed to open file");
+        throw std::runtime_error("Invalid file format, expected RIFF chunk.");
     }
 
-    WaveFileHeader header = readWaveFileHeader(file.get());
+    m_header.chunkSize = readUint32(file);
+    safeRead(m_header.format.data(), 4, 1, file);
+    if (memcmp(m_header.format.data(), "WAVE", 4) != 0)
+    {
+        throw std::runtime_error("Invalid file format, expected WAVE chunk.");
+    }
 
-    std::vector<uint8_t> data;
+    bool haveFormat = false;
+    bool haveDs64 = false;
+    bool haveDataPosition = false;
+    uint64_t ds64DataSize = 0;
+    fpos_t dataPosition;
 
-    while (!feof(file.get()))
+    while (true)
     {
         std::string chunkId;
         try
         {
-            chunkId = readChunkId(file.get());
+            chunkId = readChunkId(file);
         }
         catch (...)
         {
             break;
         }
 
-        if (chunkId == "data")
+        uint32_t chunkSize = readUint32(file);
+
+        if (chunkId == "ds64")
+        {
+            if (chunkSize < 24)
+            {
+                throw std::runtime_error("Invalid file format, ds64 chunk too small.");
+            }
+            [[maybe_unused]] uint64_t riffSize = readUint64(file);
+            ds64DataSize = readUint64(file);
+            [[maybe_unused]] uint64_t sampleCount = readUint64(file);
+            haveDs64 = true;
+            skipChunk(file, chunkSize, 24);
+        }
+        else if (chunkId == "fmt ")
         {
-            data = readWaveDataChunk(file.get());
+            readFormatChunk(file, chunkSize, m_header);
+            haveFormat = true;
+        }
+        else if (chunkId == "data")
+        {
+            m_sizeKnown = true;
+            m_dataSize = chunkSize;
+            if (chunkSize == 0xffffffff)
+            {
+                if (isRf64 && haveDs64)
+                {
+                    m_dataSize = ds64DataSize;
+                }
+                else
+                {
+                    // size was not written, e.g. by a streaming writer, so read until end of file
+                    m_sizeKnown = false;
+                    m_dataSize = 0;
+                }
+            }
+            m_dataRemaining = m_dataSize;
+
+            if (haveFormat)
+            {
+                return;
+            }
+
+            // data chunk before fmt chunk, remember position and continue searching
+            if (!m_sizeKnown || fgetpos(file, &dataPosition) != 0)
+            {
+                throw std::runtime_error("Invalid file format, data chunk before fmt chunk.");
+            }
+            haveDataPosition = true;
+            skipChunk(file, m_dataSize, 0);
         }
         else
         {
-            // skip chunk
-            uint32_t chunkSize;
-            safeRead(&chunkSize, 4, 1, file.get());
-            fseek(file.get(), chunkSize, SEEK_CUR);
+            skipChunk(file, chunkSize, 0);
+        }
+
+        if (haveFormat && haveDataPosition)
+        {
+            if (fsetpos(file, &dataPosition) != 0)
+            {
+                throw std::runtime_error("Failed to seek to data chunk.");
+            }
+            return;
         }
     }
 
+    if (!haveFormat)
+    {
+        throw std::runtime_error("Invalid file format, expected fmt");
+    }
 
-    WaveFile waveFile;
-    waveFile.header = header;
-    waveFile.rawData = std::move(data);
-    return waveFile;
+    // no data chunk, so there are no samples
+    m_dataSize = 0;
+    m_dataRemaining = 0;
 }
 
 
-WaveFileMono loadWaveFileToMono(const std::string& filename)
+uint64_t WaveReader::frameCount() const
 {
-    auto waveFile = loadWaveFile(filename.c_str());
-    std::vector<double> output;
+    if (!m_sizeKnown || m_header.bytesPerSample == 0)
+    {
+        return 0;
+    }
+    return m_dataSize / m_header.bytesPerSample;
+}
+
 
-    if (waveFile.header.audioFormat == WAVE_FORMAT_PCM)
+size_t WaveReader::readRaw(uint8_t* buffer, size_t maxBytes)
+{
+    if (!m_sizeKnown)
     {
-        switch(waveFile.header.bitsPerSample)
-        {
-            case 32:
-            case 24:
-            case 16:
-            {
-                std::vector<int32_t> samples;
-                size_t bytesPerSample = waveFile.header.bitsPerSample / 8;
-                samples.reserve(waveFile.rawData.size() / bytesPerSample);
-                for (size_t i = 0; i < waveFile.rawData.size(); i += bytesPerSample)
-                {
-                    int32_t sample = 0;
-                    int32_t shift = 4 - bytesPerSample;
-                    for (size_t n = 0; n < bytesPerSample; ++n)
-                    {
-                        sample |= waveFile.rawData[i + n] << ( (n + shift) * 8);
-                    }
-                    samples.push_back(sample);
-                }
-                output = toDoubleVector(samples);
-                break;
-            }
+        return fread(buffer, 1, maxBytes, m_file.get());
+    }
 
-            case 8:
-            {
-                // as 8bit samples are unsigned we cannot handle them in the general case above
-                output = toDoubleVector(waveFile.rawData);
-                break;
-            }
+    size_t count = static_cast<size_t>(std::min<uint64_t>(maxBytes, m_dataRemaining));
+    if (count == 0)
+    {
+        return 0;
+    }
+    safeRead(buffer, count, 1, m_file.get());
+    m_dataRemaining -= count;
+    return count;
+}
 
-            default:
-            {   
-                std::stringstream ss;
-                ss << "Unsupported bits per sample: " << waveFile.header.bitsPerSample;
-                throw std::runtime_error(ss.str());
-            }
+
+size_t WaveReader::readMonoFrames(std::vector<double>& output, size_t maxFrames)
+{
+    size_t bytesPerSample = m_header.bitsPerSample / 8;
+    size_t numChannels = m_header.numChannels;
+
+    if (m_header.audioFormat == WAVE_FORMAT_PCM)
+    {
+        if (m_header.bitsPerSample != 8 && m_header.bitsPerSample != 16 &&
+            m_header.bitsPerSample != 24 && m_header.bitsPerSample != 32)
+        {
+            std::stringstream ss;
+            ss << "Unsupported bits per sample: " << m_header.bitsPerSample;
+            throw std::runtime_error(ss.str());
         }
     }
-    else if (waveFile.header.audioFormat == WAVE_FORMAT_IEEE_FLOAT)
+    else if (m_header.audioFormat == WAVE_FORMAT_IEEE_FLOAT)
     {
-        switch(waveFile.header.bitsPerSample)
+        if (m_header.bitsPerSample != 32 && m_header.bitsPerSample != 64)
         {
-            case 32:
-            case 64:
-            {
-                std::vector<double> samples;
-                size_t bytesPerSample = waveFile.header.bitsPerSample / 8;
-                samples.reserve(waveFile.rawData.size() / bytesPerSample);
-                if (bytesPerSample == 4)
-                {
-                    for (size_t i = 0; i < waveFile.rawData.size(); i += bytesPerSample)
-                    {
-                        float sample;
-                        memcpy(&sample, &waveFile.rawData[i], bytesPerSample);
-                        samples.push_back(sample);
-                    }
-                }
-                else if (bytesPerSample == 8)
-                {
-                    for (size_t i = 0; i < waveFile.rawData.size(); i += bytesPerSample)
-                    {
-                        double sample;
-                        memcpy(&sample, &waveFile.rawData[i], bytesPerSample);
-                        samples.push_back((float)sample);
-                    }   
-                }
-                else
-                {
-                    throw std::runtime_error("Unsupported bits per sample float");
-                }
-                output = std::move(samples);
-                break;
-            }
-            
-            default:
-            {
-                std::stringstream ss;
-                ss << "Unsupported bits per sample float: " << waveFile.header.bitsPerSample;
-                throw std::runtime_error(ss.str());
-            }
+            std::stringstream ss;
+            ss << "Unsupported bits per sample float: " << m_header.bitsPerSample;
+            throw std::runtime_error(ss.str());
         }
     }
     else
     {
         std::stringstream ss;
-        ss << "Unsupported audio format: " << waveFile.header.audioFormat;
+        ss << "Unsupported audio format: " << m_header.audioFormat;
         throw std::runtime_error(ss.str());
     }
 
-    if (waveFile.header.numChannels > 1)
+    if (numChannels == 0)
+    {
+        throw std::runtime_error("Invalid number of channels: 0");
+    }
+
+    size_t bytesPerFrame = bytesPerSample * numChannels;
+    m_buffer.resize(maxFrames * bytesPerFrame);
+
+    // read whole frames only, a trailing partial frame is ignored
+    size_t bytesRead = 0;
+    while (bytesRead < m_buffer.size())
+    {
+        size_t count = readRaw(m_buffer.data() + bytesRead, m_buffer.size() - bytesRead);
+        if (count == 0)
+        {
+            break;
+        }
+        bytesRead += count;
+    }
+    size_t frames = bytesRead / bytesPerFrame;
+
+    auto sampleAt = [&](size_t index) -> double
     {
-        // merge float samples to mono
-        for (size_t i = 0; i < output.size(); i += waveFile.header.numChannels)
+        const uint8_t* bytes = &m_buffer[index * bytesPerSample];
+        if (m_header.audioFormat == WAVE_FORMAT_IEEE_FLOAT)
         {
+            if (bytesPerSample == 4)
+            {
+                float sample;
+                memcpy(&sample, bytes, bytesPerSample);
+                return sample;
+            }
+            double sample;
+            memcpy(&sample, bytes, bytesPerSample);
+            return (float)sample;
+        }
+
+        if (bytesPerSample == 1)
+        {
+            // as 8bit samples are unsigned we cannot handle them in the general case below
+            return std::clamp((bytes[0] - 128.0) / 128.0, -1.0, 1.0);
+        }
+
+        uint32_t sample = 0;
+        size_t shift = 4 - bytesPerSample;
+        for (size_t n = 0; n < bytesPerSample; ++n)
+        {
+            sample |= (uint32_t)bytes[n] << ((n + shift) * 8);
+        }
+        return std::clamp((int32_t)sample / (double)std::numeric_limits<int32_t>::max(), -1.0, 1.0);
+    };
+
+    output.reserve(output.size() + frames);
+    for (size_t i = 0; i < frames; ++i)
+    {
+        if (numChannels == 1)
+        {
+            output.push_back(sampleAt(i));
+        }
+        else
+        {
+            // merge float samples to mono
             float sample = 0;
-            for (size_t j = 0; j < waveFile.header.numChannels; ++j)
+            for (size_t j = 0; j < numChannels; ++j)
             {
-                sample += output[i + j];
+                sample += sampleAt(i * numChannels + j);
             }
-            sample /= waveFile.header.numChannels;
-            output[i / waveFile.header.numChannels] = sample;
+            sample /= numChannels;
+            output.push_back(sample);
         }
+    }
 
-        // remove unused samples
-        output.resize(output.size() / waveFile.header.numChannels);
+    return frames;
+}
+
+
+WaveFile loadWaveFile(const std::string& filename)
+{
+    WaveReader reader(filename);
+
+    std::vector<uint8_t> data(static_cast<size_t>(reader.dataSize()));
+    reader.readRaw(data.data(), data.size());
+
+    // files with unknown data size are read until the end
+    uint8_t buffer[4096];
+    while (size_t count = reader.readRaw(buffer, sizeof(buffer)))
+    {
+        data.insert(data.end(), buffer, buffer + count);
+    }
+
+    WaveFile waveFile;
+    waveFile.header = reader.header();
+    waveFile.rawData = std::move(data);
+    return waveFile;
+}
+
+
+WaveFileMono loadWaveFileToMono(const std::string& filename)
+{
+    WaveReader reader(filename);
+
+    // the data chunk is converted in blocks, so the raw data is never held in memory as a whole
+    const size_t framesPerBlock = 65536;
+    std::vector<double> output;
+    output.reserve(static_cast<size_t>(reader.frameCount()));
+    while (reader.readMonoFrames(output, framesPerBlock) > 0)
+    {
     }
 
     WaveFileMono waveFileMono;
-    waveFileMono.sampleRate = waveFile.header.sampleRate;
+    waveFileMono.sampleRate = reader.header().sampleRate;
     waveFileMono.data = std::move(output);
     return waveFileMono;
 }
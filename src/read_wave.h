@@ -3,13 +3,16 @@
 
 #include <vector>
 #include <cstdint>
+#include <cstdio>
 #include <array>
 #include <string>
+#include <memory>
 
 enum WaveAudioFormat : uint16_t
 {
     WAVE_FORMAT_PCM = 1,
-    WAVE_FORMAT_IEEE_FLOAT = 3
+    WAVE_FORMAT_IEEE_FLOAT = 3,
+    WAVE_FORMAT_EXTENSIBLE = 0xFFFE
 };
 
 #ifdef _MSC_VER
@@ -46,6 +49,61 @@ struct WaveFile
     std::vector<uint8_t> rawData;
 };
 
+/**
+ * @brief Streaming reader for RIFF, RF64 and BW64 WAVE files.
+ *
+ * The constructor walks the chunk list until both the "fmt " and the "data" chunk
+ * have been found. Chunks may appear in any order, unknown chunks are skipped.
+ * 64-bit sizes from a "ds64" chunk are used for RF64 files. For WAVE_FORMAT_EXTENSIBLE
+ * files the audioFormat of the header is replaced by the format of the sub format GUID,
+ * so users of the header only ever see WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT.
+ *
+ * The sample data itself is not loaded by the constructor, it is read in blocks
+ * using readRaw() or readMonoFrames().
+ */
+class WaveReader
+{
+public:
+    explicit WaveReader(const std::string& filename);
+
+    const WaveFileHeader& header() const { return m_header; }
+
+    /**
+     * @brief Size of the data chunk in bytes. Is 0 if the size is unknown.
+     */
+    uint64_t dataSize() const { return m_dataSize; }
+
+    /**
+     * @brief Number of frames (samples per channel) in the data chunk. Is 0 if the size is unknown.
+     */
+    uint64_t frameCount() const;
+
+    /**
+     * @brief Reads up to maxBytes bytes of raw sample data.
+     *
+     * @return The number of bytes read. 0 is returned at the end of the data chunk.
+     */
+    size_t readRaw(uint8_t* buffer, size_t maxBytes);
+
+    /**
+     * @brief Reads up to maxFrames frames, converts them to mono double samples and
+     *        appends them to output.
+     *
+     * @return The number of frames read. 0 is returned at the end of the data chunk.
+     */
+    size_t readMonoFrames(std::vector<double>& output, size_t maxFrames);
+
+private:
+    void readChunks();
+
+    std::shared_ptr<FILE> m_file;
+    WaveFileHeader m_header;
+    uint64_t m_dataSize = 0;
+    uint64_t m_dataRemaining = 0;
+    bool m_sizeKnown = true;
+    std::vector<uint8_t> m_buffer;
+};
+
 WaveFile loadWaveFile(const std::string& filename);
 
 struct WaveFileMono
@@ -0,0 +1,143 @@
+#include "repeat_detection.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace { // annonymous namespace
+
+// true if all samples of the two ranges differ by at most tolerance
+bool similar(const uint8_t* a, const uint8_t* b, size_t length, uint8_t tolerance)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (std::abs(a[i] - b[i]) > tolerance)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // annonymous namespace
+
+
+std::vector<RepeatRun> findRepeats(const std::vector<uint8_t>& raw, size_t minimumLength, uint8_t tolerance)
+{
+    size_t window = std::max<size_t>(minimumLength, 1);
+    if (raw.size() < 2 * window)
+    {
+        return {};
+    }
+
+    // Samples are quantized so copies within the tolerance usually get the same hash.
+    // Copies that cross a quantization step are missed, but never wrongly accepted.
+    int shift = 0;
+    while ((1 << shift) <= tolerance)
+    {
+        ++shift;
+    }
+
+    // polynomial rolling hash modulo 2^64 over all windows
+    const uint64_t base = 0x100000001b3ull;
+    uint64_t basePower = 1;
+    for (size_t i = 1; i < window; ++i)
+    {
+        basePower *= base;
+    }
+
+    std::vector<uint64_t> hashes(raw.size() - window + 1);
+    uint64_t hash = 0;
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        if (i >= window)
+        {
+            hash -= ((raw[i - window] >> shift) + 1) * basePower;
+        }
+        hash = hash * base + ((raw[i] >> shift) + 1);
+        if (i + 1 >= window)
+        {
+            hashes[i + 1 - window] = hash;
+        }
+    }
+
+    // Position i is compared with the last earlier window with the same hash that does
+    // not overlap it. That window starts the shortest instance of at least minimumLength.
+    std::vector<RepeatRun> runs;
+    std::unordered_map<uint64_t, size_t> lastWindow;
+    size_t searchStart = 0;
+    size_t i = 0;
+    while (i < hashes.size())
+    {
+        if (i >= searchStart + window)
+        {
+            lastWindow[hashes[i - window]] = i - window;
+        }
+
+        auto found = lastWindow.find(hashes[i]);
+        if (found != lastWindow.end())
+        {
+            size_t begin = found->second;
+            size_t length = i - begin;
+            uint32_t count = 1;
+            while (count < 0xffff
+                && begin + (count + 1) * length <= raw.size()
+                && similar(&raw[begin], &raw[begin + count * length], length, tolerance))
+            {
+                ++count;
+            }
+
+            if (count >= 2)
+            {
+                runs.push_back({ begin, length, count });
+                searchStart = begin + count * length;
+                i = searchStart;
+                lastWindow.clear();
+                continue;
+            }
+        }
+        ++i;
+    }
+    return runs;
+}
+
+
+std::vector<VocBlock> createBlocksWithRepeats(
+    const std::vector<uint8_t>& raw,
+    const std::vector<RepeatRun>& repeats,
+    const BlockEncoder& encode)
+{
+    std::vector<VocBlock> blocks;
+    auto appendSound = [&](size_t begin, size_t end)
+    {
+        auto encoded = encode(std::vector<uint8_t>(raw.begin() + begin, raw.begin() + end));
+        blocks.insert(blocks.end(), std::make_move_iterator(encoded.begin()), std::make_move_iterator(encoded.end()));
+    };
+
+    size_t position = 0;
+    for (const RepeatRun& run : repeats)
+    {
+        if (run.begin < position || run.begin + run.count * run.length > raw.size())
+        {
+            throw std::runtime_error("Repeat runs must be sorted and inside of the samples");
+        }
+
+        if (run.begin > position)
+        {
+            appendSound(position, run.begin);
+        }
+
+        blocks.push_back(createRepeatStartBlock(run.count));
+        appendSound(run.begin, run.begin + run.length);
+        blocks.push_back(createRepeatEndBlock());
+        position = run.begin + run.count * run.length;
+    }
+
+    if (position < raw.size())
+    {
+        appendSound(position, raw.size());
+    }
+    return blocks;
+}
@@ -0,0 +1,37 @@
+#ifndef REPEAT_DETECTION_H
+#define REPEAT_DETECTION_H
+
+#include "voc_format.h"
+
+#include <vector>
+#include <cstdint>
+
+struct RepeatRun
+{
+    size_t begin;
+    size_t length;      ///< length of one instance
+    uint32_t count;     ///< number of consecutive instances, at least 2
+};
+
+/**
+ * @brief Finds segments of at least minimumLength samples that are directly followed by
+ *        copies of themselves. Samples of a copy may differ by at most tolerance.
+ *
+ * Candidates are found with a rolling hash over windows of minimumLength quantized samples,
+ * every candidate is verified against the original samples before it is used.
+ */
+std::vector<RepeatRun> findRepeats(const std::vector<uint8_t>& raw, size_t minimumLength, uint8_t tolerance);
+
+/**
+ * @brief Creates VOC blocks for raw. Each repeat run is encoded once between a repeat start
+ *        and a repeat end block, all other samples are encoded in between.
+ *
+ * encode must return blocks that decode to exactly the samples they replace, e.g. by
+ * createExactSoundBlocks, so the repeats do not shift the following sound.
+ */
+std::vector<VocBlock> createBlocksWithRepeats(
+    const std::vector<uint8_t>& raw,
+    const std::vector<RepeatRun>& repeats,
+    const BlockEncoder& encode);
+
+#endif
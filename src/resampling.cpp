@@ -1,10 +1,15 @@
 #include "resampling.h"
+#include "execution_context.h"
+#include "progress.h"
+#include "filter_cache.h"
 
 #include <stdint.h>
 #include <limits>
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <stdexcept>
+#include <numeric>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -20,6 +25,119 @@ std::vector<double> blackmanWindow(size_t length)
     return output;
 }
 
+// modified Bessel function of the first kind and order zero, from its power series
+double besselI0(double x)
+{
+    double sum = 1;
+    double term = 1;
+    for (int k = 1; term > sum * 1e-16; ++k)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/**
+ * @brief Window of the windowed-sinc lowpass filters, which also defines their length.
+ *
+ * Without a stopband attenuation the Blackman window with a length of
+ * 4 * sampleRate / transitionBandwidth is used. Otherwise a Kaiser window is designed
+ * for the attenuation in dB, so the filter only gets as many taps as the attenuation needs.
+ */
+class FilterWindow
+{
+public:
+    explicit FilterWindow(std::optional<double> stopbandAttenuation)
+    {
+        if (!stopbandAttenuation.has_value())
+        {
+            return;
+        }
+
+        double attenuation = *stopbandAttenuation;
+        if (!(attenuation > 0))
+        {
+            throw std::runtime_error("Stopband attenuation must be positive!");
+        }
+        m_attenuation = attenuation;
+
+        // Kaiser's empirical formulas for the window shape and the filter length
+        double beta = 0;
+        if (attenuation > 50)
+        {
+            beta = 0.1102 * (attenuation - 8.7);
+        }
+        else if (attenuation >= 21)
+        {
+            beta = 0.5842 * pow(attenuation - 21, 0.4) + 0.07886 * (attenuation - 21);
+        }
+        m_kaiserBeta = beta;
+        m_kaiserWidth = attenuation > 21 ? (attenuation - 7.95) / 14.36 : 0.922;
+    }
+
+    /**
+     * @brief Odd number of taps for a transition band of the given width.
+     */
+    size_t length(double sampleRate, double transitionBandwidth) const
+    {
+        size_t length = m_kaiserBeta.has_value()
+            ? static_cast<size_t>(std::ceil(m_kaiserWidth * sampleRate / transitionBandwidth)) + 1
+            : static_cast<size_t>(4 * sampleRate / transitionBandwidth);
+        if (length % 2 == 0) ++length;  // ensure length is odd
+        return length;
+    }
+
+    std::vector<double> values(size_t length) const
+    {
+        if (!m_kaiserBeta.has_value())
+        {
+            return blackmanWindow(length);
+        }
+
+        std::vector<double> output;
+        output.reserve(length);
+        double half = (length - 1) / 2.0;
+        for (size_t i = 0; i < length; ++i)
+        {
+            output.push_back(at(i - half, length));
+        }
+        return output;
+    }
+
+    /**
+     * @brief Value of the window at distance x (in samples) from its center.
+     */
+    double at(double x, size_t length) const
+    {
+        double half = (length - 1) / 2.0;
+        if (!m_kaiserBeta.has_value())
+        {
+            return 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2.0 * M_PI * x / half);
+        }
+
+        double ratio = x / half;
+        if (std::abs(ratio) > 1)
+        {
+            return 0;
+        }
+        return besselI0(*m_kaiserBeta * sqrt(1 - ratio * ratio)) / besselI0(*m_kaiserBeta);
+    }
+
+    /**
+     * @brief Stopband attenuation the window was designed for, 0 for the Blackman window.
+     */
+    double attenuation() const
+    {
+        return m_attenuation;
+    }
+
+private:
+    double m_attenuation = 0;
+    std::optional<double> m_kaiserBeta;
+    double m_kaiserWidth = 0;   // filter length in multiples of sampleRate / transitionBandwidth
+};
+
 std::vector<double> sinc(double sampleRate, double cutoffFrequency, size_t length)
 {
     std::vector<double> output;
@@ -89,21 +207,19 @@ void normalize(std::vector<double>& input, double fraction)
  * @param sampleRate The sample rate of the input signal in Hz.
  * @param cutoffFrequency The cutoff frequency of the filter in Hz.
  * @param transitionBandwidth The transition bandwidth of the filter in Hz.
+ * @param window The window, which also defines the length of the filter.
  * 
  * The created filter needs to be applied to the signal to be filtered using convolution.
  */
-std::vector<double> createLowpassFilter(double sampleRate, double cutoffFrequency, double transitionBandwidth)
+std::vector<double> createLowpassFilter(double sampleRate, double cutoffFrequency, double transitionBandwidth, const FilterWindow& window)
 {
-    // calculate filter length
-    size_t length = static_cast<size_t>(4 * sampleRate / transitionBandwidth);
-    if (length % 2 == 0) ++length;  // ensure length is odd
+    size_t length = window.length(sampleRate, transitionBandwidth);
 
     // generate sinc
     std::vector<double> mySinc = sinc(sampleRate, cutoffFrequency, length);
 
     // multiply with window
-    std::vector<double> window = blackmanWindow(length);
-    std::vector<double> sincWindowed = multiplyVectors(mySinc, window);
+    std::vector<double> sincWindowed = multiplyVectors(mySinc, window.values(length));
 
     normalizeSumToOne(sincWindowed);
     return sincWindowed;
@@ -184,7 +300,14 @@ std::vector<int32_t> toInt32Vector(const std::vector<double>& input)
 }
 
 
-std::vector<double> convolution(const std::vector<double>& input, const std::vector<double>& kernel)
+/**
+ * Number of output samples per parallel task of convolution() and resample().
+ * Every output sample only depends on the input, so the blocks are independent
+ * and the result does not depend on the number of threads.
+ */
+constexpr int64_t parallelBlockSize = 8192;
+
+void checkConvolutionKernel(const std::vector<double>& input, const std::vector<double>& kernel)
 {
     if (kernel.size() > input.size())
     {
@@ -195,33 +318,351 @@ std::vector<double> convolution(const std::vector<double>& input, const std::vec
     {
         throw std::runtime_error("Kernel size must be odd!");
     }
+}
 
-    std::vector<double> output;
-    output.reserve(input.size() + kernel.size() - 1);
-    for (size_t i = 0; i < input.size() + kernel.size() - 1; ++i)
+std::vector<double> convolution(const std::vector<double>& input, const std::vector<double>& kernel)
+{
+    checkConvolutionKernel(input, kernel);
+
+    // Only the samples that are kept after trimming the full convolution to the input size
+    // are calculated. The kernel taps are summed in the same order as in the full convolution.
+    size_t trimSize = kernel.size() / 2;
+    std::vector<double> output(input.size());
+    int64_t blockCount = (static_cast<int64_t>(output.size()) + parallelBlockSize - 1) / parallelBlockSize;
+
+    #pragma omp parallel for schedule(static) num_threads(ExecutionContext::threads())
+    for (int64_t block = 0; block < blockCount; ++block)
     {
-        double sample = 0;
-        for (size_t j = 0; j < kernel.size(); ++j)
+        size_t blockEnd = std::min<size_t>(output.size(), (block + 1) * parallelBlockSize);
+        for (size_t n = block * parallelBlockSize; n < blockEnd; ++n)
         {
-            if (i >= j && i - j < input.size())
+            size_t i = n + trimSize;
+            size_t firstTap = i >= input.size() ? i - (input.size() - 1) : 0;
+            size_t lastTap = std::min(kernel.size() - 1, i);
+
+            double sample = 0;
+            for (size_t j = firstTap; j <= lastTap; ++j)
             {
                 sample += input[i - j] * kernel[j];
             }
+            output[n] = sample;
         }
-        output.push_back(sample);
     }
 
-    // trim size to input size by removing samples from the beginning and end
-    size_t trimSize = kernel.size() / 2;
-    output.erase(output.begin(), output.begin() + trimSize);
-    output.erase(output.end() - trimSize, output.end());
     return output;
 }
 
-std::vector<double> lowPassFilter(const std::vector<double>& input, double sampleRate, double cutoffFrequency, double transitionBandwidth)
+/**
+ * @brief Half-band lowpass filter for decimation by 2 of a signal with the given sample rate.
+ *
+ * The cutoff is at a quarter of the sample rate, the transition band reaches from
+ * stopbandEdge to sampleRate / 2 - stopbandEdge. So everything below stopbandEdge is kept
+ * and nothing aliases below stopbandEdge after decimation. Every other tap of a half-band
+ * filter is zero, only the other taps are returned as (offset from center, coefficient).
+ */
+std::vector<std::pair<int64_t, double>> createHalfBandFilter(double sampleRate, double stopbandEdge, const FilterWindow& filterWindow)
 {
-    auto filter = createLowpassFilter(sampleRate, cutoffFrequency, transitionBandwidth);
-    return convolution(input, filter);
+    double transitionBandwidth = 2 * (sampleRate / 4 - stopbandEdge);
+
+    // same length rule as createLowpassFilter(), but with the center on a tap
+    size_t length = filterWindow.length(sampleRate, transitionBandwidth);
+    int64_t center = static_cast<int64_t>(length / 2);
+
+    std::vector<double> window = filterWindow.values(length);
+    std::vector<std::pair<int64_t, double>> taps;
+    double sum = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        int64_t x = static_cast<int64_t>(i) - center;
+        if (x != 0 && x % 2 == 0)
+        {
+            continue;
+        }
+
+        double value = (x == 0) ? 0.5 : sin(M_PI * x / 2.0) / (M_PI * x);
+        taps.push_back({ x, value * window[i] });
+        sum += taps.back().second;
+    }
+
+    for (auto& tap : taps)
+    {
+        tap.second /= sum;
+    }
+    return taps;
+}
+
+/**
+ * @brief Filters with a half-band filter and keeps every second sample.
+ *
+ * Output sample m is located at input sample 2 * m, only these samples are filtered.
+ */
+std::vector<double> decimateHalfBand(const std::vector<double>& input, const std::vector<std::pair<int64_t, double>>& taps)
+{
+    std::vector<double> output((input.size() + 1) / 2);
+    int64_t inputSize = static_cast<int64_t>(input.size());
+    int64_t blockCount = (static_cast<int64_t>(output.size()) + parallelBlockSize - 1) / parallelBlockSize;
+
+    #pragma omp parallel for schedule(static) num_threads(ExecutionContext::threads())
+    for (int64_t block = 0; block < blockCount; ++block)
+    {
+        int64_t blockEnd = std::min<int64_t>(output.size(), (block + 1) * parallelBlockSize);
+        for (int64_t m = block * parallelBlockSize; m < blockEnd; ++m)
+        {
+            double sample = 0;
+            for (const auto& [offset, coefficient] : taps)
+            {
+                int64_t i = 2 * m - offset;
+                if (i >= 0 && i < inputSize)
+                {
+                    sample += input[i] * coefficient;
+                }
+            }
+            output[m] = sample;
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Value of the windowed sinc of createLowpassFilter() at distance x (in samples)
+ *        from its center, for a filter with the given length.
+ */
+double windowedSinc(double x, double cutoffRatio, size_t length, const FilterWindow& window)
+{
+    double value = (x == 0) ? 2.0 * M_PI * cutoffRatio : sin(2.0 * M_PI * cutoffRatio * x) / x;
+    return value * window.at(x, length);
+}
+
+/**
+ * @brief windowedSinc() sampled at a fixed number of points per input sample.
+ *
+ * Values between the table entries are interpolated linearly, so the kernel can be
+ * evaluated at any position without sin() and cos(). With 1024 entries per sample the
+ * interpolation error is far below the stopband attenuation of the Blackman window.
+ */
+class SincTable
+{
+public:
+    SincTable(double cutoffRatio, size_t length, const FilterWindow& window) :
+        m_half((length - 1) / 2.0)
+    {
+        // zero entries at the end, so the interpolation can always read the next entry
+        size_t entries = static_cast<size_t>(std::ceil(m_half * oversampling)) + 3;
+        std::vector<double> values(entries + 1);
+        for (size_t i = 0; i < entries; ++i)
+        {
+            double x = (double)i / oversampling;
+            values[i] = x < m_half ? windowedSinc(x, cutoffRatio, length, window) : 0;
+        }
+
+        m_entries.resize(entries);
+        for (size_t i = 0; i < entries; ++i)
+        {
+            m_entries[i] = { values[i], values[i + 1] - values[i] };
+        }
+    }
+
+    /**
+     * @brief Filtered input at a fractional position. The kernel is normalized to a sum of one.
+     *
+     * Samples outside of input are treated as zero, positions after the last sample repeat it.
+     */
+    double filterAt(const std::vector<double>& input, double position) const
+    {
+        int64_t size = static_cast<int64_t>(input.size());
+        int64_t index = static_cast<int64_t>(position);
+        double fraction = position - index;
+        if (index >= size - 1)
+        {
+            index = size - 1;
+            fraction = 0;
+        }
+
+        int64_t firstOffset = static_cast<int64_t>(std::ceil(fraction - m_half));
+        int64_t lastOffset = static_cast<int64_t>(std::floor(fraction + m_half));
+
+        // The kernel is used at distance fraction - offset. Up to offset 0 the distances are
+        // fraction, fraction + 1, ..., from offset 1 on they are 1 - fraction, 2 - fraction, ...
+        // So on each side the taps are whole samples apart in the table and share the same
+        // interpolation weight.
+        double right = fraction * oversampling;
+        size_t rightIndex = static_cast<size_t>(right);
+        double rightWeight = right - rightIndex;
+        double left = (1 - fraction) * oversampling;
+        size_t leftIndex = static_cast<size_t>(left);
+        double leftWeight = left - leftIndex;
+
+        double sample = 0;
+        double sum = 0;
+
+        // offset 0, -1, -2, ...
+        const Entry* entry = &m_entries[rightIndex];
+        for (int64_t offset = 0; offset >= firstOffset; --offset, entry += oversampling)
+        {
+            double coefficient = entry->value + rightWeight * entry->slope;
+            sum += coefficient;
+            sample += sampleAt(input, index + offset) * coefficient;
+        }
+
+        // offset 1, 2, 3, ...
+        entry = &m_entries[leftIndex];
+        for (int64_t offset = 1; offset <= lastOffset; ++offset, entry += oversampling)
+        {
+            double coefficient = entry->value + leftWeight * entry->slope;
+            sum += coefficient;
+            sample += sampleAt(input, index + offset) * coefficient;
+        }
+        return sample / sum;
+    }
+
+private:
+    static constexpr int64_t oversampling = 1024;
+
+    static double sampleAt(const std::vector<double>& input, int64_t k)
+    {
+        return (k >= 0 && k < static_cast<int64_t>(input.size())) ? input[k] : 0.0;
+    }
+
+    struct Entry
+    {
+        double value;
+        double slope;   // difference to the next entry
+    };
+
+    double m_half;
+    std::vector<Entry> m_entries;
+};
+
+/**
+ * @brief Lowpass filter that is evaluated at fractional positions of its input.
+ *
+ * The output position i is located at input position i * numerator / denominator.
+ * There are only denominator different fractional parts, so if there are not too many
+ * of them the kernel is calculated once for each of them (polyphase filter). Otherwise
+ * the kernel is interpolated from a SincTable for every output sample.
+ * Samples outside of input are treated as zero.
+ */
+class FractionalLowpass
+{
+public:
+    FractionalLowpass(double cutoffRatio, size_t length, uint64_t numerator, uint64_t denominator, const FilterWindow& window) :
+        m_cutoffRatio(cutoffRatio),
+        m_length(length),
+        m_window(window),
+        m_numerator(numerator),
+        m_denominator(denominator)
+    {
+        if (denominator > maxPhases)
+        {
+            m_table.emplace(cutoffRatio, length, window);
+        }
+        else
+        {
+            m_phases.resize(denominator);
+            for (uint64_t phase = 0; phase < denominator; ++phase)
+            {
+                m_phases[phase] = createKernel((double)phase / denominator);
+            }
+        }
+    }
+
+    double at(const std::vector<double>& input, uint64_t outputIndex) const
+    {
+        uint64_t position = outputIndex * m_numerator;
+        int64_t index = position / m_denominator;
+        uint64_t phase = position % m_denominator;
+
+        // the last input sample is repeated
+        if (index >= static_cast<int64_t>(input.size()) - 1)
+        {
+            index = input.size() - 1;
+            phase = 0;
+        }
+
+        if (m_table.has_value())
+        {
+            return m_table->filterAt(input, index + (double)phase / m_denominator);
+        }
+        return apply(input, index, m_phases[phase]);
+    }
+
+private:
+    static constexpr uint64_t maxPhases = 4096;
+
+    struct Kernel
+    {
+        int64_t firstOffset;
+        std::vector<double> coefficients;
+    };
+
+    Kernel createKernel(double fraction) const
+    {
+        double half = (m_length - 1) / 2.0;
+        Kernel kernel;
+        kernel.firstOffset = static_cast<int64_t>(std::ceil(fraction - half));
+        int64_t lastOffset = static_cast<int64_t>(std::floor(fraction + half));
+
+        for (int64_t offset = kernel.firstOffset; offset <= lastOffset; ++offset)
+        {
+            kernel.coefficients.push_back(windowedSinc(fraction - offset, m_cutoffRatio, m_length, m_window));
+        }
+        normalizeSumToOne(kernel.coefficients);
+        return kernel;
+    }
+
+    static double apply(const std::vector<double>& input, int64_t index, const Kernel& kernel)
+    {
+        int64_t first = index + kernel.firstOffset;
+        int64_t size = static_cast<int64_t>(input.size());
+
+        double sample = 0;
+        for (size_t j = 0; j < kernel.coefficients.size(); ++j)
+        {
+            int64_t k = first + static_cast<int64_t>(j);
+            if (k >= 0 && k < size)
+            {
+                sample += input[k] * kernel.coefficients[j];
+            }
+        }
+        return sample;
+    }
+
+    double m_cutoffRatio;
+    size_t m_length;
+    FilterWindow m_window;
+    uint64_t m_numerator;
+    uint64_t m_denominator;
+    std::vector<Kernel> m_phases;
+    std::optional<SincTable> m_table;
+};
+
+// linear interpolation between the two neighbouring input samples
+double interpolateLinear(double floorSample, double ceilSample, double inputIndex)
+{
+    double inputIndexFraction = inputIndex - (size_t)inputIndex;
+    return ((1.0 - inputIndexFraction) * floorSample + inputIndexFraction * ceilSample);
+}
+
+
+/**
+ * @brief For large ratios the rate is first halved by short half-band filters, as long as
+ *        the band up to the stopband edge survives a halving. The final lowpass filter then
+ *        runs at a lower rate with proportionally fewer taps.
+ *
+ * rate is updated to the rate of the returned signal, which is either input or storage.
+ */
+const std::vector<double>& decimateToStopband(const std::vector<double>& input, double& rate, double stopbandEdge, const FilterWindow& window, std::vector<double>& storage)
+{
+    const std::vector<double>* signal = &input;
+    while (rate / 4 > stopbandEdge && stopbandEdge > 0)
+    {
+        static FilterCache<std::vector<std::pair<int64_t, double>>> cache;
+        auto taps = cache.get({ rate, stopbandEdge, window.attenuation() }, [&]() { return createHalfBandFilter(rate, stopbandEdge, window); });
+        storage = decimateHalfBand(*signal, *taps);
+        signal = &storage;
+        rate /= 2;
+    }
+    return *signal;
 }
 
 
@@ -230,33 +671,146 @@ std::vector<double> resample(
     uint32_t inputSampleRate,
     uint32_t outputSampleRate,
     std::optional<double> cutoffFrequency,
-    std::optional<double> transitionBandwidth)
+    std::optional<double> transitionBandwidth,
+    std::optional<double> stopbandAttenuation)
 {
-    // first lowpass filter signal to prevent aliasing
-    auto input = lowPassFilter(
-        inputData,
-        inputSampleRate,
-        cutoffFrequency.value_or(outputSampleRate / 2.0),
-        transitionBandwidth.value_or(outputSampleRate / 10.0));
-    uint64_t outputSize = (uint64_t)input.size() * (uint64_t)outputSampleRate / (uint64_t)inputSampleRate;
-    // std::cout << "outputSize = " << outputSize << "\n";
+    FilterWindow window(stopbandAttenuation);
+    double cutoff = cutoffFrequency.value_or(outputSampleRate / 2.0);
+    double transition = transitionBandwidth.value_or(outputSampleRate / 10.0);
+    double stopbandEdge = cutoff + transition / 2;
+
+    // the output size is based on the original input, the last output samples repeat the last input sample
+    uint64_t outputSize = (uint64_t)inputData.size() * (uint64_t)outputSampleRate / (uint64_t)inputSampleRate;
     std::vector<double> output(outputSize);
-    // output.reserve(outputSize);
-    for (size_t i = 0; i < outputSize; ++i)
-    {
-        double inputIndex = (double)i * (double)inputSampleRate / (double)outputSampleRate;
-        
-        // do linear interpolation
-        size_t inputIndexFloor = (size_t)inputIndex;
-        size_t inputIndexCeil = inputIndexFloor + 1;
-        double inputIndexFraction = inputIndex - inputIndexFloor;
-        if (inputIndexCeil >= input.size())
+    int64_t blockCount = (static_cast<int64_t>(outputSize) + parallelBlockSize - 1) / parallelBlockSize;
+
+    std::vector<double> decimated;
+    double rate = inputSampleRate;
+    const std::vector<double>& input = decimateToStopband(inputData, rate, stopbandEdge, window, decimated);
+
+    static FilterCache<std::vector<double>> filterCache;
+    auto filter = filterCache.get({ rate, cutoff, transition, window.attenuation() }, [&]() { return createLowpassFilter(rate, cutoff, transition, window); });
+    checkConvolutionKernel(input, *filter);
+
+    if (rate < inputSampleRate)
+    {
+        // Linear interpolation at the reduced rate would damp the upper passband, so the
+        // final lowpass filter is evaluated directly at the output positions.
+        // Output sample i is located at input sample i * inputSampleRate / (outputSampleRate * 2^stages).
+        uint64_t numerator = inputSampleRate;
+        uint64_t denominator = (uint64_t)outputSampleRate * (uint64_t)std::llround(inputSampleRate / rate);
+        uint64_t divisor = std::gcd(numerator, denominator);
+        numerator /= divisor;
+        denominator /= divisor;
+        static FilterCache<FractionalLowpass> lowpassCache;
+        auto lowpass = lowpassCache.get({ cutoff / rate, (double)filter->size(), (double)numerator, (double)denominator, window.attenuation() },
+            [&]() { return FractionalLowpass(cutoff / rate, filter->size(), numerator, denominator, window); });
+        ProgressStage progress("Resampling", outputSize);
+
+        #pragma omp parallel for schedule(static) num_threads(ExecutionContext::threads())
+        for (int64_t block = 0; block < blockCount; ++block)
         {
-            inputIndexCeil = input.size() - 1;
+            if (Progress::cancelled())
+            {
+                continue;
+            }
+            size_t blockEnd = std::min<size_t>(outputSize, (block + 1) * parallelBlockSize);
+            for (size_t i = block * parallelBlockSize; i < blockEnd; ++i)
+            {
+                output[i] = lowpass->at(input, i);
+            }
+            progress.add(blockEnd - block * parallelBlockSize);
         }
-        double sample = ((1.0 - inputIndexFraction) * input[inputIndexFloor] + inputIndexFraction * input[inputIndexCeil]);
+        progress.throwIfCancelled();
+        return output;
+    }
+
+    // lowpass filter signal to prevent aliasing
+    auto filtered = convolution(input, *filter);
+    ProgressStage progress("Resampling", outputSize);
 
-        output[i] = sample;
+    #pragma omp parallel for schedule(static) num_threads(ExecutionContext::threads())
+    for (int64_t block = 0; block < blockCount; ++block)
+    {
+        if (Progress::cancelled())
+        {
+            continue;
+        }
+        size_t blockEnd = std::min<size_t>(outputSize, (block + 1) * parallelBlockSize);
+        for (size_t i = block * parallelBlockSize; i < blockEnd; ++i)
+        {
+            double inputIndex = (double)i * (double)inputSampleRate / (double)outputSampleRate;
+            size_t inputIndexFloor = (size_t)inputIndex;
+            size_t inputIndexCeil = std::min(inputIndexFloor + 1, filtered.size() - 1);
+            output[i] = interpolateLinear(filtered[inputIndexFloor], filtered[inputIndexCeil], inputIndex);
+        }
+        progress.add(blockEnd - block * parallelBlockSize);
     }
+    progress.throwIfCancelled();
     return output;
 }
+
+
+std::vector<double> resampleSinc(
+    const std::vector<double>& inputData,
+    double inputSampleRate,
+    double outputSampleRate,
+    std::optional<double> cutoffFrequency,
+    std::optional<double> transitionBandwidth,
+    std::optional<double> stopbandAttenuation)
+{
+    FilterWindow window(stopbandAttenuation);
+    if (inputSampleRate <= 0 || outputSampleRate <= 0)
+    {
+        throw std::runtime_error("Sample rates must be positive!");
+    }
+
+    // when upsampling the filter has to remove everything above the input band
+    double bandwidth = std::min(inputSampleRate, outputSampleRate);
+    double cutoff = cutoffFrequency.value_or(bandwidth / 2.0);
+    double transition = transitionBandwidth.value_or(bandwidth / 10.0);
+    double stopbandEdge = cutoff + transition / 2;
+
+    uint64_t outputSize = static_cast<uint64_t>(inputData.size() * outputSampleRate / inputSampleRate);
+    std::vector<double> output(outputSize);
+    int64_t blockCount = (static_cast<int64_t>(outputSize) + parallelBlockSize - 1) / parallelBlockSize;
+
+    std::vector<double> decimated;
+    double rate = inputSampleRate;
+    const std::vector<double>& input = decimateToStopband(inputData, rate, stopbandEdge, window, decimated);
+
+    size_t length = window.length(rate, transition);
+    if (length > input.size())
+    {
+        throw std::runtime_error("Kernel size must be smaller than input size!");
+    }
+    static FilterCache<SincTable> tableCache;
+    auto table = tableCache.get({ cutoff / rate, (double)length, window.attenuation() }, [&]() { return SincTable(cutoff / rate, length, window); });
+
+    // output sample i is located at input sample i * step
+    double step = rate / outputSampleRate;
+    ProgressStage progress("Resampling", outputSize);
+
+    #pragma omp parallel for schedule(static) num_threads(ExecutionContext::threads())
+    for (int64_t block = 0; block < blockCount; ++block)
+    {
+        if (Progress::cancelled())
+        {
+            continue;
+        }
+        size_t blockEnd = std::min<size_t>(outputSize, (block + 1) * parallelBlockSize);
+        for (size_t i = block * parallelBlockSize; i < blockEnd; ++i)
+        {
+            output[i] = table->filterAt(input, i * step);
+        }
+        progress.add(blockEnd - block * parallelBlockSize);
+    }
+    progress.throwIfCancelled();
+    return output;
+}
+
+
+double attenuationForBitDepth(int bits)
+{
+    return 6.02 * bits + 1.76;
+}
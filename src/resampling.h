@@ -5,12 +5,41 @@
 #include <vector>
 #include <optional>
 
+/**
+ * @brief Resamples with a windowed-sinc lowpass filter against aliasing.
+ *
+ * If a stopband attenuation in dB is given, the filters use a Kaiser window that is
+ * designed for this attenuation and are not longer than needed for it. Otherwise the
+ * Blackman window is used, which attenuates by about 74 dB.
+ */
 std::vector<double> resample(
     const std::vector<double>& inputData,
     uint32_t inputSampleRate,
     uint32_t outputSampleRate,
     std::optional<double> cutoffFrequency = {},
-    std::optional<double> transitionBandwidth = {});
+    std::optional<double> transitionBandwidth = {},
+    std::optional<double> stopbandAttenuation = {});
+
+/**
+ * @brief Band-limited resampling for any ratio of sample rates, which do not need to be integers.
+ *
+ * The windowed-sinc lowpass filter is tabulated once and evaluated directly at the output
+ * positions, so there is no linear interpolation between filtered input samples.
+ * The default cutoff is half of the lower of both sample rates.
+ * The stopband attenuation is used like in resample().
+ */
+std::vector<double> resampleSinc(
+    const std::vector<double>& inputData,
+    double inputSampleRate,
+    double outputSampleRate,
+    std::optional<double> cutoffFrequency = {},
+    std::optional<double> transitionBandwidth = {},
+    std::optional<double> stopbandAttenuation = {});
+
+/**
+ * @brief Stopband attenuation in dB that matches the dynamic range of samples with the given number of bits.
+ */
+double attenuationForBitDepth(int bits);
 
 std::vector<double> toDoubleVector(const std::vector<int32_t>& input);
 std::vector<double> toDoubleVector(const std::vector<int16_t>& input);
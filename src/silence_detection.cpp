@@ -0,0 +1,100 @@
+#include "silence_detection.h"
+
+#include <cstdlib>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+std::vector<SilenceRun> findSilence(const std::vector<uint8_t>& raw, uint8_t threshold, size_t minimumLength)
+{
+    minimumLength = std::max<size_t>(minimumLength, 1);
+
+    std::vector<SilenceRun> runs;
+    size_t runBegin = 0;
+    bool inRun = false;
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        bool quiet = std::abs(raw[i] - 128) <= threshold;
+        if (quiet && !inRun)
+        {
+            runBegin = i;
+            inRun = true;
+        }
+        else if (!quiet && inRun)
+        {
+            inRun = false;
+            if (i - runBegin >= minimumLength)
+            {
+                runs.push_back({ runBegin, i - runBegin });
+            }
+        }
+    }
+
+    if (inRun && raw.size() - runBegin >= minimumLength)
+    {
+        runs.push_back({ runBegin, raw.size() - runBegin });
+    }
+    return runs;
+}
+
+
+std::vector<VocBlock> createBlocksWithSilence(
+    const std::vector<uint8_t>& raw,
+    const std::vector<SilenceRun>& silence,
+    const BlockEncoder& encode)
+{
+    std::vector<VocBlock> blocks;
+
+    // samples the last sound block decodes to less than its input, negative if more
+    int64_t missingSamples = 0;
+
+    auto addSound = [&](size_t begin, size_t end)
+    {
+        std::vector<uint8_t> samples(raw.begin() + begin, raw.begin() + end);
+        auto encoded = encode(samples);
+
+        // drop padding bytes at the end that are not needed for the input samples
+        size_t sampleCount = vocSampleCount(encoded);
+        if (!encoded.empty() && encoded.back().type == VOC_BLOCK_SOUND)
+        {
+            VocBlock& last = encoded.back();
+            size_t perByte = vocSamplesPerByte(last.sampleFormat);
+            while (last.sampleData.size() > 1 && sampleCount >= samples.size() + perByte)
+            {
+                last.sampleData.pop_back();
+                sampleCount -= perByte;
+            }
+        }
+
+        missingSamples = static_cast<int64_t>(samples.size()) - static_cast<int64_t>(sampleCount);
+        blocks.insert(blocks.end(), std::make_move_iterator(encoded.begin()), std::make_move_iterator(encoded.end()));
+    };
+
+    size_t position = 0;
+    for (const SilenceRun& run : silence)
+    {
+        if (run.begin < position || run.begin + run.length > raw.size())
+        {
+            throw std::runtime_error("Silence runs must be sorted and inside of the samples");
+        }
+
+        if (run.begin > position)
+        {
+            addSound(position, run.begin);
+        }
+
+        int64_t length = static_cast<int64_t>(run.length) + missingSamples;
+        missingSamples = 0;
+        if (length > 0)
+        {
+            blocks.push_back(createSilenceBlock(static_cast<uint32_t>(length)));
+        }
+        position = run.begin + run.length;
+    }
+
+    if (position < raw.size())
+    {
+        addSound(position, raw.size());
+    }
+    return blocks;
+}
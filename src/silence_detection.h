@@ -0,0 +1,33 @@
+#ifndef SILENCE_DETECTION_H
+#define SILENCE_DETECTION_H
+
+#include "voc_format.h"
+
+#include <vector>
+#include <cstdint>
+
+struct SilenceRun
+{
+    size_t begin;
+    size_t length;
+};
+
+/**
+ * @brief Finds runs of at least minimumLength samples that differ by at most threshold
+ *        from the zero line (128) of unsigned 8bit samples.
+ */
+std::vector<SilenceRun> findSilence(const std::vector<uint8_t>& raw, uint8_t threshold, size_t minimumLength);
+
+/**
+ * @brief Creates VOC blocks for raw. The silent runs become silence blocks, only the
+ *        samples between them are encoded by encode.
+ *
+ * Encoders may drop or pad a few samples at the end of their input. The silence block
+ * after the encoded blocks absorbs the difference, so the file plays as long as raw.
+ */
+std::vector<VocBlock> createBlocksWithSilence(
+    const std::vector<uint8_t>& raw,
+    const std::vector<SilenceRun>& silence,
+    const BlockEncoder& encode);
+
+#endif
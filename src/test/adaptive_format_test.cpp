@@ -0,0 +1,100 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "adaptive_format.h"
+#include "compare_audio.h"
+#include "voc_format.h"
+
+#include <math.h>
+
+namespace {
+
+// quiet smooth tone, then loud noise, then the tone again
+std::vector<uint8_t> createToneWithNoise()
+{
+    std::vector<uint8_t> raw;
+    uint32_t noise = 4711;
+    for (int i = 0; i < 10001; ++i)
+    {
+        if (i >= 4000 && i < 6000)
+        {
+            noise = noise * 1103515245 + 12345;
+            raw.push_back(static_cast<uint8_t>(noise >> 24));
+        }
+        else
+        {
+            raw.push_back(static_cast<uint8_t>(128 + 8 * sin(i * 0.01)));
+        }
+    }
+    return raw;
+}
+
+} // annonymous namespace
+
+TEST_CASE("Adaptive format meets the maximum error per block")
+{
+    auto raw = createToneWithNoise();
+    double maxError = GENERATE(0.0, 2.0, 100000.0);
+    const size_t blockLength = 500;
+
+    auto blocks = createAdaptiveBlocks(raw, blockLength, maxError, 10000, encodeInFormat);
+    REQUIRE(vocSampleCount(blocks) == raw.size());
+
+    auto decoded = decodeToPcm(VocFile{ 0, 1, 10, VOC_FORMAT_PCM_8BIT, {}, blocks }).sampleData;
+    REQUIRE(decoded.size() == raw.size());
+
+    // the last block also holds the remaining sample
+    for (size_t begin = 0; begin < raw.size(); begin += blockLength)
+    {
+        size_t length = begin + 2 * blockLength > raw.size() ? raw.size() - begin : blockLength;
+        auto difference = computeAudioDifference(
+            std::span<uint8_t>(raw).subspan(begin, length),
+            std::span<uint8_t>(decoded).subspan(begin, length),
+            10000);
+        REQUIRE(difference.averageDifference <= maxError);
+        if (length > blockLength)
+        {
+            break;
+        }
+    }
+
+    bool hasAdpcm2 = false;
+    bool hasPcm = false;
+    for (const VocBlock& block : blocks)
+    {
+        hasAdpcm2 |= block.sampleFormat == VOC_FORMAT_ADPCM_2BIT;
+        hasPcm |= block.sampleFormat == VOC_FORMAT_PCM_8BIT && vocBlockSampleCount(block) >= blockLength;
+    }
+    REQUIRE(hasAdpcm2 == (maxError > 0));
+    REQUIRE(hasPcm == (maxError < 100000));
+}
+
+TEST_CASE("Adaptive format handles short input")
+{
+    std::vector<uint8_t> raw = { 128, 130, 135 };
+    auto blocks = createAdaptiveBlocks(raw, 500, 1, 10000, encodeInFormat);
+    auto decoded = decodeToPcm(VocFile{ 0, 1, 10, VOC_FORMAT_PCM_8BIT, {}, blocks }).sampleData;
+    REQUIRE(decoded.size() == raw.size());
+
+    REQUIRE(createAdaptiveBlocks({}, 500, 1, 10000, encodeInFormat).empty());
+    REQUIRE_THROWS(createAdaptiveBlocks(raw, 0, 1, 10000, encodeInFormat));
+    REQUIRE_THROWS(createAdaptiveBlocks(raw, 500, -1, 10000, encodeInFormat));
+}
+
+TEST_CASE("Adaptive format stores adjacent blocks in the same format as one sound block")
+{
+    std::vector<uint8_t> raw(11025);
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        raw[i] = static_cast<uint8_t>(128 + 2 * sin(i * 0.01));
+    }
+
+    auto blocks = createAdaptiveBlocks(raw, 220, 4, 11025, encodeInFormat);
+    REQUIRE(blocks.size() == 1);
+    REQUIRE(blocks[0].sampleFormat == VOC_FORMAT_ADPCM_2BIT);
+    REQUIRE(decodeToPcm(VocFile{ 0, 1, 10, VOC_FORMAT_PCM_8BIT, {}, blocks }).sampleData.size() == raw.size());
+
+    // header, one block header with time constant and format, reference byte and 4 samples per byte
+    size_t expectedSize = 26 + 4 + 2 + 1 + (raw.size() - 1 + 3) / 4 + 1;
+    REQUIRE(createVocFile(11025, blocks).size() <= expectedSize);
+}
@@ -0,0 +1,94 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "decode_creative_adpcm.h"
+#include "decode_creative_adpcm_parallel.h"
+#include "voc_format.h"
+#include "voc_stream_decoder.h"
+#include "file_tools.h"
+
+#include <random>
+#include <array>
+
+TEST_CASE("Parallel ADPCM4 decoding matches serial decoding")
+{
+    auto vocfile = readVocFile(getTestDataDir() + "/jetpack_adpcm4.voc");
+    auto reference = readRaw(getTestDataDir() + "/jetpack_adpcm4_decoded.raw");
+    auto payload = std::span<const uint8_t>(vocfile.sampleData).subspan(1);
+
+    for (size_t chunkSize : {1, 7, 100, 4096})
+    {
+        std::vector<uint8_t> output(payload.size() * 2 + 1);
+        decodeAdpcm4Parallel(vocfile.sampleData[0], payload, output, chunkSize);
+        REQUIRE(output == reference);
+    }
+}
+
+TEST_CASE("Parallel ADPCM decoding of random data matches serial decoding")
+{
+    // random data frequently hits the clamping at 0 and 255
+    std::mt19937 gen(42);
+    std::vector<uint8_t> data(20000);
+    for (auto& value : data)
+    {
+        value = gen() & 0xff;
+    }
+
+    for (size_t chunkSize : {3, 64, 1000})
+    {
+        std::vector<uint8_t> output4(data.size() * 2 + 1);
+        decodeAdpcm4Parallel(17, data, output4, chunkSize);
+        REQUIRE(output4 == decodeAdpcm4(17, data));
+
+        std::vector<uint8_t> output2(data.size() * 4 + 1);
+        decodeAdpcm2Parallel(200, data, output2, chunkSize);
+        REQUIRE(output2 == decodeAdpcm2(200, data));
+    }
+}
+
+TEST_CASE("Streaming ADPCM decoder with small buffers")
+{
+    auto vocfile = readVocFile(getTestDataDir() + "/jetpack.voc");
+    auto reference = readRaw(getTestDataDir() + "/jetpack_decoded.raw");
+
+    // feed the input in pieces of 5 bytes and request 7 samples per call,
+    // so bytes are frequently split between calls
+    AdpcmStreamDecoder decoder;
+    decoder.startBlock(vocfile.sampleFormat, true);
+    std::span<const uint8_t> data(vocfile.sampleData);
+    std::vector<uint8_t> decoded;
+    std::array<uint8_t, 7> buffer;
+    while (true)
+    {
+        auto input = data.first(std::min<size_t>(5, data.size()));
+        size_t count = decoder.decode(input, buffer);
+        data = data.subspan(std::min<size_t>(5, data.size()) - input.size());
+        decoded.insert(decoded.end(), buffer.begin(), buffer.begin() + count);
+        if (count == 0)
+        {
+            break;
+        }
+    }
+    REQUIRE(decoded == reference);
+}
+
+TEST_CASE("Streaming VOC decoder")
+{
+    auto vocData = loadFile(getTestDataDir() + "/jetpack_adpcm4.voc");
+    auto reference = readRaw(getTestDataDir() + "/jetpack_adpcm4_decoded.raw");
+
+    VocStreamDecoder decoder(vocData);
+    std::vector<uint8_t> decoded;
+    std::array<uint8_t, 333> buffer;
+    while (size_t count = decoder.decode(buffer))
+    {
+        decoded.insert(decoded.end(), buffer.begin(), buffer.begin() + count);
+    }
+    REQUIRE(decoder.finished());
+    REQUIRE(decoder.timeConstant() == 131);
+    REQUIRE(decoded == reference);
+
+    decoder.rewind();
+    std::vector<uint8_t> all(reference.size() + 10);
+    REQUIRE(decoder.decode(all) == reference.size());
+}
@@ -2,6 +2,54 @@
 #include "test_helper.h"
 
 #include "detect_file_format.h"
+#include "voc_format.h"
+#include "read_wave.h"
+
+#include "file_tools.h"
+
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+#if defined(_WIN32)
+    #include <io.h>
+    #define dup _dup
+    #define dup2 _dup2
+    #define close _close
+    #define fileno _fileno
+#else
+    #include <unistd.h>
+#endif
+
+namespace { // annonymous namespace
+
+// reads stdin from a file and restores the original stdin afterwards
+class StdinRedirect
+{
+public:
+    explicit StdinRedirect(const std::string& path) :
+        m_original(dup(fileno(stdin)))
+    {
+        REQUIRE(m_original >= 0);
+        REQUIRE(freopen(path.c_str(), "rb", stdin));
+    }
+
+    ~StdinRedirect()
+    {
+        // drop what is left of the file in the buffer of stdin
+        while (getc(stdin) != EOF)
+        {
+        }
+        dup2(m_original, fileno(stdin));
+        close(m_original);
+        clearerr(stdin);
+    }
+
+private:
+    int m_original;
+};
+
+} // annonymous namespace
 
 TEST_CASE("Detect file format formats")
 {
@@ -15,3 +63,43 @@ TEST_CASE("Detect file format missing file")
     // check if function throws exception when file does not exist
     REQUIRE_THROWS_AS(detectFileFormat("non_existing_file"), std::runtime_error);
 }
+
+TEST_CASE("Detect stream format keeps the bytes for the reader")
+{
+    for (auto [name, format] : { std::pair{ "jetpack.voc", FileFormat::VOC }, std::pair{ "jetpack.wav", FileFormat::WAV }, std::pair{ "16bit_mono_48000.raw", FileFormat::UNKNOWN } })
+    {
+        std::string path = getTestDataDir() + "/" + name;
+        auto file = openFile(path, "rb");
+        REQUIRE(file);
+        REQUIRE(detectStreamFormat(file.get()) == format);
+
+        std::vector<uint8_t> content;
+        for (int c = getc(file.get()); c != EOF; c = getc(file.get()))
+        {
+            content.push_back(static_cast<uint8_t>(c));
+        }
+        REQUIRE(content == loadFile(path));
+    }
+
+    auto empty = std::shared_ptr<FILE>(tmpfile(), fclose);
+    REQUIRE(empty);
+    REQUIRE(detectStreamFormat(empty.get()) == FileFormat::UNKNOWN);
+}
+
+TEST_CASE("Detect file format on stdin keeps the bytes for the reader")
+{
+    {
+        StdinRedirect redirect(getTestDataDir() + "/jetpack.voc");
+        REQUIRE(detectFileFormat("-") == FileFormat::VOC);
+        REQUIRE(readVocFile("-").sampleData == readVocFile(getTestDataDir() + "/jetpack.voc").sampleData);
+    }
+    {
+        StdinRedirect redirect(getTestDataDir() + "/jetpack.wav");
+        REQUIRE(detectFileFormat("-") == FileFormat::WAV);
+        REQUIRE(loadWaveFile("-").rawData == loadWaveFile(getTestDataDir() + "/jetpack.wav").rawData);
+    }
+    {
+        StdinRedirect redirect(getTestDataDir() + "/16bit_mono_48000.raw");
+        REQUIRE(detectFileFormat("-") == FileFormat::UNKNOWN);
+    }
+}
@@ -0,0 +1,119 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "encode_checkpoint.h"
+#include "encode_creative_adpcm.h"
+#if defined(__x86_64__)
+    #include "encode_creative_adpcm_simd.h"
+#endif
+
+#include <random>
+#include <cmath>
+#include <filesystem>
+
+namespace { // annonymous namespace
+
+std::vector<uint8_t> createNoisySignal(size_t length)
+{
+    std::mt19937 gen(42);
+    std::vector<uint8_t> signal(length);
+    for (size_t i = 0; i < length; ++i)
+    {
+        double value = 128 + 60 * sin(i * 0.02) + 30 * sin(i * 0.31) + (int)(gen() % 21) - 10;
+        signal[i] = static_cast<uint8_t>(std::clamp(value, 0.0, 255.0));
+    }
+    return signal;
+}
+
+std::vector<uint8_t> splitNibbles(const std::vector<uint8_t>& encoded, size_t count)
+{
+    std::vector<uint8_t> nibbles;
+    for (size_t i = 1; nibbles.size() < count; ++i)
+    {
+        nibbles.push_back(encoded[i] >> 4);
+        nibbles.push_back(encoded[i] & 0xf);
+    }
+    nibbles.resize(count);
+    return nibbles;
+}
+
+std::string checkpointPath()
+{
+    return (std::filesystem::temp_directory_path() / "voctool_checkpoint_test.bin").string();
+}
+
+} // annonymous namespace
+
+
+TEST_CASE("Resumed combined encode is identical to an uninterrupted encode")
+{
+    auto raw = createNoisySignal(20001);
+    auto path = checkpointPath();
+
+    auto full = createAdpcm4BitFromRaw(raw, 4);
+    {
+        // as if the encode was interrupted after 1000 groups
+        EncodeCheckpoint interrupted(path, "combined 4", raw, std::chrono::seconds(0));
+        interrupted.store(0, splitNibbles(full, 4000));
+    }
+
+    EncodeCheckpoint checkpoint(path, "combined 4", raw, std::chrono::hours(1));
+    checkpoint.resume(path);
+    REQUIRE(checkpoint.storedNibbles() == 4000);
+    REQUIRE(createAdpcm4BitFromRaw(raw, 4, &checkpoint) == full);
+
+#if defined(__x86_64__)
+    // the SIMD encoder breaks ties differently, so it gets its own checkpoint
+    auto fullSIMD = createAdpcm4BitFromRawSIMD(raw, 4);
+    EncodeCheckpoint checkpointSIMD(path, "combined SIMD 4", raw, std::chrono::hours(1));
+    checkpointSIMD.store(0, splitNibbles(fullSIMD, 4000));
+    REQUIRE(createAdpcm4BitFromRawSIMD(raw, 4, &checkpointSIMD) == fullSIMD);
+#endif
+
+    EncodeCheckpoint otherSettings(path, "combined 5", raw, std::chrono::hours(1));
+    REQUIRE_THROWS(otherSettings.resume(path));
+
+    auto otherRaw = raw;
+    otherRaw[100] ^= 1;
+    EncodeCheckpoint otherInput(path, "combined 4", otherRaw, std::chrono::hours(1));
+    REQUIRE_THROWS(otherInput.resume(path));
+
+    checkpoint.remove();
+    REQUIRE(!std::filesystem::exists(path));
+}
+
+
+TEST_CASE("Combined encoder writes checkpoints while encoding")
+{
+    auto raw = createNoisySignal(5001);
+    auto path = checkpointPath();
+
+    EncodeCheckpoint writer(path, "combined 3", raw, std::chrono::seconds(0));
+    auto full = createAdpcm4BitFromRaw(raw, 3, &writer);
+    REQUIRE(std::filesystem::exists(path));
+
+    EncodeCheckpoint checkpoint(path, "combined 3", raw, std::chrono::hours(1));
+    checkpoint.resume(path);
+    REQUIRE(checkpoint.storedNibbles() > 4000);
+    REQUIRE(checkpoint.storedNibbles() % 3 == 0);
+    REQUIRE(createAdpcm4BitFromRaw(raw, 3, &checkpoint) == full);
+    checkpoint.remove();
+}
+
+
+TEST_CASE("Resumed trellis encode is identical to an uninterrupted encode")
+{
+    auto raw = createNoisySignal(2 * 16384 + 1000);
+    auto path = checkpointPath();
+
+    EncodeCheckpoint writer(path, "trellis 8", raw, std::chrono::hours(1));
+    auto full = createAdpcm4BitFromRawTrellis(raw, 8, 1, 0.5, &writer);
+    REQUIRE(full == createAdpcm4BitFromRawTrellis(raw, 8, 1, 0.5));
+
+    EncodeCheckpoint checkpoint(path, "trellis 8", raw, std::chrono::hours(1));
+    checkpoint.resume(path);
+    REQUIRE(checkpoint.storedNibbles() == raw.size() - 1);
+    REQUIRE(checkpoint.segment(2).has_value());
+    REQUIRE(createAdpcm4BitFromRawTrellis(raw, 8, 1, 0.5, &checkpoint) == full);
+    checkpoint.remove();
+}
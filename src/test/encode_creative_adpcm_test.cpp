@@ -0,0 +1,422 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "encode_creative_adpcm.h"
+#include "decode_creative_adpcm.h"
+#include "execution_context.h"
+#include "read_wave.h"
+#include "resampling.h"
+#if defined(__x86_64__)
+    #include "encode_creative_adpcm_simd.h"
+#endif
+
+#include <random>
+#include <cmath>
+#include <array>
+#include <chrono>
+#include <limits>
+
+namespace { // annonymous namespace
+
+/**
+ * Creates a test signal of a few sine waves with some noise.
+ */
+std::vector<uint8_t> createTestSignal(size_t length, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::vector<uint8_t> signal(length);
+    for (size_t i = 0; i < length; ++i)
+    {
+        double value = 128 + 60 * sin(i * 0.05 * (1 + seed % 5)) + 30 * sin(i * 0.31) + (int)(gen() % 21) - 10;
+        signal[i] = static_cast<uint8_t>(std::clamp(value, 0.0, 255.0));
+    }
+    return signal;
+}
+
+/**
+ * Test signals for comparing searches, including clipped and constant parts
+ * where many nibble sequences have the same error.
+ */
+std::vector<std::vector<uint8_t>> createSearchTestSignals()
+{
+    std::vector<std::vector<uint8_t>> signals = { createTestSignal(241, 3), createTestSignal(97, 4) };
+
+    std::vector<uint8_t> clipped(200);
+    for (size_t i = 0; i < clipped.size(); ++i)
+    {
+        clipped[i] = (i / 50) % 2 ? 255 : (i < 100 ? 0 : 128);
+    }
+    signals.push_back(clipped);
+    return signals;
+}
+
+/**
+ * Tries every nibble sequence for a group of samples and keeps the first best one. The first
+ * nibble is in the highest bits of the candidate for the SIMD encoder, in the lowest bits
+ * for the encoder without SIMD.
+ */
+uint64_t searchExhaustively(CreativeAdpcmDecoder4Bit& decoder, const uint8_t* targets, int levels, bool firstNibbleHigh)
+{
+    uint64_t bestCandidate = 0;
+    uint64_t bestDiff = std::numeric_limits<uint64_t>::max();
+    CreativeAdpcmDecoder4Bit bestDecoder = decoder;
+    for (uint64_t candidate = 0; candidate < (uint64_t(1) << (4 * levels)); ++candidate)
+    {
+        CreativeAdpcmDecoder4Bit candidateDecoder = decoder;
+        uint64_t diffSum = 0;
+        for (int n = 0; n < levels; ++n)
+        {
+            int shift = 4 * (firstNibbleHigh ? levels - 1 - n : n);
+            int diff = candidateDecoder.decodeNibble((candidate >> shift) & 0xf) - targets[n];
+            diffSum += diff * diff;
+        }
+        if (diffSum < bestDiff)
+        {
+            bestDiff = diffSum;
+            bestCandidate = candidate;
+            bestDecoder = candidateDecoder;
+        }
+    }
+    decoder = bestDecoder;
+    return bestCandidate;
+}
+
+std::vector<uint8_t> mergeNibbles(const std::vector<uint8_t>& nibbles, uint8_t first)
+{
+    std::vector<uint8_t> encoded = { first };
+    for (size_t n = 0; n + 1 < nibbles.size(); n += 2)
+    {
+        encoded.push_back((nibbles[n] << 4) | nibbles[n + 1]);
+    }
+    return encoded;
+}
+
+/**
+ * Exhaustive search with the groups and the order of createAdpcm4BitFromRawSIMD().
+ */
+std::vector<uint8_t> encodeExhaustivelySIMD(const std::vector<uint8_t>& raw, int levels)
+{
+    CreativeAdpcmDecoder4Bit decoder(raw[0]);
+    std::vector<uint8_t> nibbles;
+    for (size_t i = 1; i + levels < raw.size(); i += levels)
+    {
+        uint64_t best = searchExhaustively(decoder, &raw[i], levels, true);
+        for (int n = levels - 1; n >= 0; --n)
+        {
+            nibbles.push_back((best >> (4 * n)) & 0xf);
+        }
+    }
+    return mergeNibbles(nibbles, raw[0]);
+}
+
+/**
+ * Exhaustive search with the groups and the order of createAdpcm4BitFromRaw(), which leaves
+ * the nibbles of the last group 0.
+ */
+std::vector<uint8_t> encodeExhaustively(const std::vector<uint8_t>& raw, int levels)
+{
+    CreativeAdpcmDecoder4Bit decoder(raw[0]);
+    std::vector<uint8_t> nibbles(raw.size() / levels * levels);
+    for (size_t i = 1; i < raw.size() / levels; ++i)
+    {
+        uint64_t best = searchExhaustively(decoder, &raw[(i - 1) * levels + 1], levels, false);
+        for (int n = 0; n < levels; ++n)
+        {
+            nibbles[(i - 1) * levels + n] = (best >> (4 * n)) & 0xf;
+        }
+    }
+    return mergeNibbles(nibbles, raw[0]);
+}
+
+// FNV-1a hash, so the reference outputs of all levels fit into the test
+uint64_t hashBytes(const std::vector<uint8_t>& data)
+{
+    uint64_t hash = 14695981039346656037u;
+    for (uint8_t byte : data)
+    {
+        hash = (hash ^ byte) * 1099511628211u;
+    }
+    return hash;
+}
+
+} // annonymous namespace
+
+TEST_CASE("OpenMP encoder does not depend on the number of threads")
+{
+    auto raw = createSearchTestSignals().back();
+    auto expected = createAdpcm4BitFromRaw(raw, 3);
+
+    for (int threads : {1, 3, 4})
+    {
+        ExecutionContext::configure(threadSettings(threads));
+        REQUIRE(createAdpcm4BitFromRawOpenMP(raw, 3) == expected);
+    }
+    ExecutionContext::configure({});
+
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRawOpenMP(raw, 9), std::runtime_error);
+}
+
+TEST_CASE("State table search matches exhaustive search")
+{
+    for (const auto& raw : createSearchTestSignals())
+    {
+        auto expected = encodeExhaustively(raw, 4);
+        REQUIRE(createAdpcm4BitFromRaw(raw, 4) == expected);
+        REQUIRE(createAdpcm4BitFromRawOpenMP(raw, 4) == expected);
+    }
+}
+
+#if defined(__x86_64__)
+TEST_CASE("Batch encoding matches single stream encoding")
+{
+    std::vector<std::vector<uint8_t>> raws;
+    for (uint32_t i = 0; i < 40; ++i)
+    {
+        raws.push_back(createTestSignal(5 + (i * 37) % 300, i));
+    }
+
+    for (uint64_t level : {1, 3})
+    {
+        auto encoded = createAdpcm4BitBatchSIMD(raws, level);
+        REQUIRE(encoded.size() == raws.size());
+        for (size_t i = 0; i < raws.size(); ++i)
+        {
+            REQUIRE(encoded[i] == createAdpcm4BitFromRawSIMD(raws[i], level));
+        }
+    }
+}
+
+TEST_CASE("SIMD state table search matches exhaustive search")
+{
+    auto raws = createSearchTestSignals();
+    auto encoded = createAdpcm4BitBatchSIMD(raws, 4);
+    for (size_t i = 0; i < raws.size(); ++i)
+    {
+        auto expected = encodeExhaustivelySIMD(raws[i], 4);
+        REQUIRE(createAdpcm4BitFromRawSIMD(raws[i], 4) == expected);
+        REQUIRE(encoded[i] == expected);
+    }
+}
+
+TEST_CASE("Batch encoding is not slower than single stream encoding")
+{
+    // before the batch encoder used the state table search it took about 30 times as long at level 4
+    std::vector<std::vector<uint8_t>> raws;
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        raws.push_back(createTestSignal(4000, i));
+    }
+    ExecutionContext::configure(threadSettings(1));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<uint8_t>> single;
+    for (const auto& raw : raws)
+    {
+        single.push_back(createAdpcm4BitFromRawSIMD(raw, 4));
+    }
+    auto singleTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    auto batch = createAdpcm4BitBatchSIMD(raws, 4);
+    auto batchTime = std::chrono::steady_clock::now() - start;
+    ExecutionContext::configure({});
+
+    REQUIRE(batch == single);
+    REQUIRE(batchTime < 3 * singleTime + std::chrono::milliseconds(50));
+}
+#endif
+
+TEST_CASE("Combined encoders reject unsupported levels")
+{
+    auto raw = createTestSignal(100, 1);
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRaw(raw, 0), std::runtime_error);
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRaw(raw, 9), std::runtime_error);
+    REQUIRE_THROWS_AS(createAdpcm2BitFromRaw(raw, 9), std::runtime_error);
+    REQUIRE(createAdpcm2BitFromRaw(raw, 8).size() == 25);
+}
+
+TEST_CASE("Combined search output of every level matches the reference")
+{
+    // the references were created with the search that took the level at runtime, before it
+    // was instantiated for every level
+    auto raw = toUint8Vector(loadWaveFileToMono(getTestDataDir() + "/jetpack.wav").data);
+    raw.resize(2048);
+
+    const std::array<uint64_t, 8> adpcm2BitReference =
+    {
+        0xea9cd6487f7af906, 0xd6c9bedd663b77be, 0x504ac07c75dff859, 0xd346f6966238dae5,
+        0x96a103d5b53b21c9, 0x2f76f72478f8ff05, 0x2ba27acac8135d51, 0xe1eac85e7aafd9a7
+    };
+    for (uint64_t level = 1; level <= 8; ++level)
+    {
+        REQUIRE(hashBytes(createAdpcm2BitFromRaw(raw, level)) == adpcm2BitReference[level - 1]);
+    }
+
+    // the exhaustive search of the reference takes too long for higher levels
+    const std::array<uint64_t, 5> adpcm4BitReference =
+    {
+        0x35889fdc236419e3, 0x67f031dd01466c0e, 0x5b44fc4ade65cd1c, 0xb2574c30fc67a7e8,
+        0xb5841c0c7d0d6919
+    };
+    for (uint64_t level = 1; level <= 5; ++level)
+    {
+        REQUIRE(hashBytes(createAdpcm4BitFromRaw(raw, level)) == adpcm4BitReference[level - 1]);
+    }
+
+#if defined(__x86_64__)
+    const std::array<uint64_t, 8> simdReference =
+    {
+        0x7b891b66514b8fc1, 0x0781fffb4f8f2bcc, 0xc0daabab9831b6c5, 0xd903a040a0bbcd48,
+        0x1e9c34892d1c2c07, 0x97cc9f270aea6186, 0x1ab5f4a2443872cf, 0xcef5e4eed8eb82e6
+    };
+    for (uint64_t level = 1; level <= 8; ++level)
+    {
+        REQUIRE(hashBytes(createAdpcm4BitFromRawSIMD(raw, level)) == simdReference[level - 1]);
+    }
+#endif
+}
+
+TEST_CASE("Trellis encoding is reproducible")
+{
+    auto raw = createTestSignal(500, 7);
+
+    auto first = createAdpcm4BitFromRawTrellis(raw, 16, 1234);
+    REQUIRE(first.size() == 250);
+    REQUIRE(first == createAdpcm4BitFromRawTrellis(raw, 16, 1234));
+
+    // without random branches the seed has no influence
+    REQUIRE(createAdpcm4BitFromRawTrellis(raw, 16, 1, 0.0) == createAdpcm4BitFromRawTrellis(raw, 16, 2, 0.0));
+
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRawTrellis(raw, 0), std::runtime_error);
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRawTrellis(raw, 16, 0, 1.5), std::runtime_error);
+}
+
+TEST_CASE("Trellis with many branches is at least as good as the combined search")
+{
+    auto raw = createTestSignal(400, 9);
+
+    auto squaredError = [&](const std::vector<uint8_t>& encoded)
+    {
+        auto decoded = decodeAdpcm4(encoded[0], std::span<const uint8_t>(encoded).subspan(1));
+        uint64_t sum = 0;
+        for (size_t i = 0; i < 397; ++i)
+        {
+            int diff = (int)decoded[i] - (int)raw[i];
+            sum += diff * diff;
+        }
+        return sum;
+    };
+
+    // the combined search encodes the first 396 samples after the initial one, the rest is padding
+    auto combined = createAdpcm4BitFromRaw(raw, 4);
+
+    // with 1024 branches and deduplication every decoder state is kept, so the trellis is optimal
+    auto trellis = createAdpcm4BitFromRawTrellis(std::vector<uint8_t>(raw.begin(), raw.begin() + 397), 1024, 0, 0.0);
+    REQUIRE(trellis.size() == 199);
+    REQUIRE(squaredError(trellis) <= squaredError(combined));
+}
+
+TEST_CASE("Trellis joins parallel segments")
+{
+    // long enough for several segments, with a jump at a segment boundary so the speculative start state is wrong
+    auto raw = createTestSignal(40000, 11);
+    for (size_t i = 16000; i < 16385; ++i)
+    {
+        raw[i] = 250;
+    }
+
+    auto encoded = createAdpcm4BitFromRawTrellis(raw, 16, 5);
+    REQUIRE(encoded.size() == 20000);
+
+    auto decoded = decodeAdpcm4(encoded[0], std::span<const uint8_t>(encoded).subspan(1));
+    uint64_t squaredSum = 0;
+    REQUIRE(decoded.size() == raw.size() - 1);
+    for (size_t i = 0; i < decoded.size(); ++i)
+    {
+        int diff = (int)decoded[i] - (int)raw[i];
+        squaredSum += diff * diff;
+    }
+    REQUIRE(squaredSum / decoded.size() < 16);
+
+#if defined(__x86_64__)
+    REQUIRE(encoded == createAdpcm4BitFromRawTrellisSIMD(raw, 16, 5));
+#endif
+}
+
+TEST_CASE("Adaptive level encoding")
+{
+    // with a jump the decoder cannot follow from a small accumulator
+    auto raw = createTestSignal(1000, 13);
+    for (size_t i = 500; i < 520; ++i)
+    {
+        raw[i] = 250;
+    }
+
+    auto squaredError = [&](const std::vector<uint8_t>& encoded)
+    {
+        auto decoded = decodeAdpcm4(encoded[0], std::span<const uint8_t>(encoded).subspan(1));
+        uint64_t sum = 0;
+        for (size_t i = 0; i < decoded.size(); ++i)
+        {
+            int diff = (int)decoded[i] - (int)raw[i];
+            sum += diff * diff;
+        }
+        return sum;
+    };
+
+    // without a higher level to escalate to it is the level 1 search, which pads one more byte
+    auto levelOne = createAdpcm4BitFromRaw(raw, 1);
+    auto adaptiveLevelOne = createAdpcm4BitFromRawAdaptive(raw, 1, 0);
+    REQUIRE(adaptiveLevelOne.size() == 500);
+    REQUIRE(std::equal(adaptiveLevelOne.begin(), adaptiveLevelOne.end(), levelOne.begin()));
+
+    auto adaptive = createAdpcm4BitFromRawAdaptive(raw, 4, 16);
+    REQUIRE(adaptive.size() == 500);
+    REQUIRE(squaredError(adaptive) < squaredError(levelOne));
+
+#if defined(__x86_64__)
+    REQUIRE(adaptive == createAdpcm4BitFromRawAdaptiveSIMD(raw, 4, 16));
+#endif
+
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRawAdaptive(raw, 0, 16), std::runtime_error);
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRawAdaptive(raw, 9, 16), std::runtime_error);
+    REQUIRE_THROWS_AS(createAdpcm4BitFromRawAdaptive(raw, 4, -1), std::runtime_error);
+}
+
+TEST_CASE("Time limited encoding improves the first encode")
+{
+    auto raw = createTestSignal(3001, 17);
+
+    auto squaredError = [&](const std::vector<uint8_t>& encoded)
+    {
+        auto decoded = decodeAdpcm4(encoded[0], std::span<const uint8_t>(encoded).subspan(1));
+        uint64_t sum = 0;
+        // the samples all encoders cover
+        for (size_t i = 0; i < 2999; ++i)
+        {
+            int diff = (int)decoded[i] - (int)raw[i];
+            sum += diff * diff;
+        }
+        return sum;
+    };
+
+    // after the deadline only the first encode is done
+    auto first = createAdpcm4BitFromRawTimeLimited(raw, std::chrono::steady_clock::now());
+    REQUIRE(first == createAdpcm4BitFromRawAdaptive(raw, 2, 16));
+
+    // the windows of a pass are independent, so once all passes are done the number of threads does not matter
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::minutes(1);
+    ExecutionContext::configure(threadSettings(1));
+    auto optimized = createAdpcm4BitFromRawTimeLimited(raw, deadline);
+    ExecutionContext::configure(threadSettings(3));
+    REQUIRE(createAdpcm4BitFromRawTimeLimited(raw, deadline) == optimized);
+    ExecutionContext::configure({});
+
+    REQUIRE(optimized.size() == first.size());
+    REQUIRE(squaredError(optimized) < squaredError(first));
+    REQUIRE(squaredError(optimized) < squaredError(createAdpcm4BitFromRaw(raw, 4)));
+
+#if defined(__x86_64__)
+    REQUIRE(createAdpcm4BitFromRawTimeLimitedSIMD(raw, deadline) == optimized);
+#endif
+}
@@ -0,0 +1,38 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "execution_context.h"
+#include "decode_creative_adpcm.h"
+#include "decode_creative_adpcm_parallel.h"
+
+#include <stdexcept>
+
+TEST_CASE("Parse CPU list")
+{
+    REQUIRE(parseCpuList("3") == std::vector<int>{3});
+    REQUIRE(parseCpuList("0-3,8") == std::vector<int>{0, 1, 2, 3, 8});
+    REQUIRE(parseCpuList("5,1-2,2") == std::vector<int>{1, 2, 5});
+    REQUIRE_THROWS_AS(parseCpuList("3-1"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseCpuList("a"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseCpuList("1,,2"), std::runtime_error);
+}
+
+TEST_CASE("Execution context controls the number of threads")
+{
+    ExecutionContext::configure(threadSettings(3));
+    REQUIRE(ExecutionContext::threads() == 3);
+
+    // parallel stages give the same result with any number of threads
+    std::vector<uint8_t> data(5000);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 37 + (i >> 3));
+    }
+    std::vector<uint8_t> output(data.size() * 2 + 1);
+    decodeAdpcm4Parallel(17, data, output, 300);
+    REQUIRE(output == decodeAdpcm4(17, data));
+
+    ExecutionContext::configure({});
+    REQUIRE(ExecutionContext::threads() >= 1);
+    REQUIRE_THROWS_AS(ExecutionContext::configure(threadSettings(-1)), std::runtime_error);
+}
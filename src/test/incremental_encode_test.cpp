@@ -0,0 +1,107 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "incremental_encode.h"
+
+#include <math.h>
+#include <filesystem>
+
+namespace {
+
+// tone with a little noise, so the chunk boundaries are spread over the whole signal
+std::vector<uint8_t> createNoisyTone(size_t length)
+{
+    std::vector<uint8_t> raw;
+    uint32_t noise = 4711;
+    for (size_t i = 0; i < length; ++i)
+    {
+        noise = noise * 1103515245 + 12345;
+        raw.push_back(static_cast<uint8_t>(128 + 60 * sin(i * 0.003) + 20 * sin(i * 0.05) + (noise >> 29)));
+    }
+    return raw;
+}
+
+} // annonymous namespace
+
+
+TEST_CASE("Incremental encoding produces the same result as a fresh encode")
+{
+    auto raw = createNoisyTone(100000);
+    auto first = createAdpcm4BitIncremental(raw, 3);
+    REQUIRE(first.reusedSamples == 0);
+    REQUIRE(first.encoded.size() == (raw.size() - 1) / 2 + 1);
+    REQUIRE(first.index.chunks.size() > 5);
+    REQUIRE(first.index.dataHash == hashSamples(first.encoded.data(), first.encoded.size()));
+
+    SECTION("Unchanged input reuses all stored samples")
+    {
+        auto again = createAdpcm4BitIncremental(raw, 3, first.index, first.encoded);
+        REQUIRE(again.encoded == first.encoded);
+        // the odd last sample was not stored, so the last group is searched again
+        REQUIRE(again.reusedSamples >= raw.size() - 1 - 3);
+    }
+
+    SECTION("Edited samples")
+    {
+        auto edited = raw;
+        for (size_t i = 50000; i < 50500; ++i)
+        {
+            edited[i] = static_cast<uint8_t>(edited[i] / 2 + 64);
+        }
+
+        auto fresh = createAdpcm4BitIncremental(edited, 3);
+        auto incremental = createAdpcm4BitIncremental(edited, 3, first.index, first.encoded);
+        REQUIRE(incremental.encoded == fresh.encoded);
+        REQUIRE(incremental.reusedSamples > raw.size() / 2);
+        REQUIRE(incremental.reusedSamples < raw.size() - 500);
+    }
+
+    SECTION("Trimmed start")
+    {
+        std::vector<uint8_t> trimmed(raw.begin() + 3333, raw.end());
+
+        auto fresh = createAdpcm4BitIncremental(trimmed, 3);
+        auto incremental = createAdpcm4BitIncremental(trimmed, 3, first.index, first.encoded);
+        REQUIRE(incremental.encoded == fresh.encoded);
+        REQUIRE(incremental.reusedSamples > trimmed.size() / 2);
+    }
+
+    SECTION("Index of other data or level is ignored")
+    {
+        auto otherData = first.encoded;
+        otherData[1000] ^= 0x11;
+        auto incremental = createAdpcm4BitIncremental(raw, 3, first.index, otherData);
+        REQUIRE(incremental.encoded == first.encoded);
+        REQUIRE(incremental.reusedSamples == 0);
+
+        auto otherLevel = createAdpcm4BitIncremental(raw, 2, first.index, first.encoded);
+        REQUIRE(otherLevel.encoded == createAdpcm4BitIncremental(raw, 2).encoded);
+        REQUIRE(otherLevel.reusedSamples == 0);
+    }
+}
+
+
+TEST_CASE("Encode index is written and read")
+{
+    auto raw = createNoisyTone(30000);
+    auto result = createAdpcm4BitIncremental(raw, 2);
+
+    auto path = (std::filesystem::temp_directory_path() / "voctool_index_test.txt").string();
+    writeEncodeIndex(path, result.index);
+    auto index = readEncodeIndex(path);
+
+    REQUIRE(index.level == result.index.level);
+    REQUIRE(index.dataHash == result.index.dataHash);
+    REQUIRE(index.chunks.size() == result.index.chunks.size());
+    for (size_t i = 0; i < index.chunks.size(); ++i)
+    {
+        REQUIRE(index.chunks[i].begin == result.index.chunks[i].begin);
+        REQUIRE(index.chunks[i].length == result.index.chunks[i].length);
+        REQUIRE(index.chunks[i].hash == result.index.chunks[i].hash);
+        REQUIRE(index.chunks[i].entry == result.index.chunks[i].entry);
+    }
+
+    dumpRaw(std::vector<uint8_t>{ 'n', 'o', 'p', 'e' }, path);
+    REQUIRE_THROWS(readEncodeIndex(path));
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,41 @@
+#include "catch_importer.h"
+
+#include "json_lines.h"
+
+#include <stdexcept>
+
+
+TEST_CASE("Flat JSON objects are parsed")
+{
+    auto object = parseJsonObject(R"( {"id": "job 1", "level": 5, "cutoff": -1.5e3, "fast": true, "seed": null} )");
+    REQUIRE(object.size() == 4);
+    REQUIRE(object["id"] == "job 1");
+    REQUIRE(object["level"] == "5");
+    REQUIRE(object["cutoff"] == "-1.5e3");
+    REQUIRE(object["fast"] == "true");
+    REQUIRE(object.count("seed") == 0);
+
+    REQUIRE(parseJsonObject("{}").empty());
+}
+
+TEST_CASE("JSON strings are unescaped and escaped")
+{
+    auto object = parseJsonObject(R"({"input": "C:\\audio\\\"a\".wav", "name": "\u00e4\ud83d\ude00\n"})");
+    REQUIRE(object["input"] == "C:\\audio\\\"a\".wav");
+    REQUIRE(object["name"] == "\xc3\xa4\xf0\x9f\x98\x80\n");
+
+    REQUIRE(toJsonString("a \"b\"\\\n\x01") == "\"a \\\"b\\\"\\\\\\n\\u0001\"");
+    REQUIRE(parseJsonObject("{\"text\": " + toJsonString("tab\there \"quoted\"") + "}")["text"] == "tab\there \"quoted\"");
+}
+
+TEST_CASE("Invalid JSON is rejected")
+{
+    REQUIRE_THROWS_AS(parseJsonObject(""), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": 1"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": 1,}"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": [1, 2]}"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": {\"b\": 1}}"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": nan}"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": \"unterminated}"), std::runtime_error);
+    REQUIRE_THROWS_AS(parseJsonObject("{\"a\": 1} trailing"), std::runtime_error);
+}
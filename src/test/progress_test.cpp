@@ -0,0 +1,77 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "progress.h"
+#include "encode_creative_adpcm.h"
+#include "resampling.h"
+
+#include <cmath>
+#include <string>
+
+namespace { // annonymous namespace
+
+std::vector<uint8_t> createTone(size_t length)
+{
+    std::vector<uint8_t> raw(length);
+    for (size_t i = 0; i < length; ++i)
+    {
+        raw[i] = static_cast<uint8_t>(128 + 100 * sin(i * 0.01));
+    }
+    return raw;
+}
+
+} // annonymous namespace
+
+
+TEST_CASE("Stages report their progress")
+{
+    std::vector<ProgressInfo> reports;
+    Progress::setCallback([&](const ProgressInfo& info) { reports.push_back(info); }, std::chrono::seconds(0));
+
+    auto raw = createTone(50001);
+    createAdpcm4BitFromRaw(raw, 3);
+    Progress::setCallback({});
+
+    REQUIRE(reports.size() > 5);
+    for (size_t i = 0; i < reports.size(); ++i)
+    {
+        REQUIRE(std::string(reports[i].stage) == "Encoding ADPCM4");
+        REQUIRE(reports[i].total == raw.size());
+        REQUIRE(reports[i].finished == (i + 1 == reports.size()));
+        if (i > 0)
+        {
+            REQUIRE(reports[i].done >= reports[i - 1].done);
+        }
+    }
+    REQUIRE(reports.back().done == raw.size());
+    REQUIRE(reports.back().samplesPerSecond > 0);
+}
+
+
+TEST_CASE("Stages stop when cancelled")
+{
+    auto raw = createTone(50001);
+    Progress::setCallback([](const ProgressInfo&) { Progress::cancel(); }, std::chrono::seconds(0));
+
+    SECTION("Sequential encoder")
+    {
+        REQUIRE_THROWS_AS(createAdpcm4BitFromRaw(raw, 3), OperationCancelled);
+    }
+
+    SECTION("Parallel encoder")
+    {
+        REQUIRE_THROWS_AS(createAdpcm4BitFromRawTrellis(raw, 4), OperationCancelled);
+    }
+
+    SECTION("Resampler")
+    {
+        REQUIRE_THROWS_AS(resampleSinc(toDoubleVector(raw), 44100, 22050), OperationCancelled);
+    }
+
+    Progress::setCallback({});
+    REQUIRE(Progress::cancelled());
+    Progress::reset();
+
+    // nothing is left over from the cancelled stage
+    REQUIRE(createAdpcm4BitFromRaw(raw, 3).size() > raw.size() / 2);
+}
@@ -0,0 +1,153 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "read_wave.h"
+#include "detect_file_format.h"
+
+#include <filesystem>
+#include <cstring>
+
+namespace {
+
+void appendId(std::vector<uint8_t>& out, const char (&id)[5])
+{
+    // byte by byte, GCC 12 warns about a range insert into the still empty vector
+    for (size_t i = 0; i < 4; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(id[i]));
+    }
+}
+
+void appendLe(std::vector<uint8_t>& out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        out.push_back((value >> (8 * i)) & 0xff);
+    }
+}
+
+std::vector<uint8_t> formatChunk(uint16_t audioFormat, uint16_t channels, uint32_t sampleRate, uint16_t bits, bool extensible)
+{
+    std::vector<uint8_t> out;
+    appendId(out, "fmt ");
+    appendLe(out, extensible ? 40 : 16, 4);
+    appendLe(out, extensible ? WAVE_FORMAT_EXTENSIBLE : audioFormat, 2);
+    appendLe(out, channels, 2);
+    appendLe(out, sampleRate, 4);
+    appendLe(out, sampleRate * channels * bits / 8, 4);
+    appendLe(out, channels * bits / 8, 2);
+    appendLe(out, bits, 2);
+    if (extensible)
+    {
+        appendLe(out, 22, 2);
+        appendLe(out, bits, 2);
+        appendLe(out, 0, 4);
+        appendLe(out, audioFormat, 2);
+        const uint8_t suffix[] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+        out.insert(out.end(), suffix, suffix + sizeof(suffix));
+    }
+    return out;
+}
+
+std::string writeTempFile(const std::string& name, const std::vector<uint8_t>& data)
+{
+    auto path = (std::filesystem::temp_directory_path() / name).string();
+    dumpRaw(data, path);
+    return path;
+}
+
+std::vector<uint8_t> testSamples16Bit()
+{
+    std::vector<uint8_t> samples;
+    for (int i = 0; i < 101; ++i)
+    {
+        appendLe(samples, (uint16_t)(int16_t)(i * 300 - 15000), 2);
+    }
+    return samples;
+}
+
+} // annonymous namespace
+
+TEST_CASE("LoadWaveTest extensible with chunks in arbitrary order")
+{
+    auto samples = testSamples16Bit();
+
+    std::vector<uint8_t> file;
+    appendId(file, "RIFF");
+    appendLe(file, 0, 4);
+    appendId(file, "WAVE");
+
+    // odd sized chunk including pad byte before the fmt chunk
+    appendId(file, "junk");
+    appendLe(file, 3, 4);
+    file.insert(file.end(), {1, 2, 3, 0});
+
+    // data chunk before fmt chunk
+    appendId(file, "data");
+    appendLe(file, samples.size(), 4);
+    file.insert(file.end(), samples.begin(), samples.end());
+    auto fmt = formatChunk(WAVE_FORMAT_PCM, 1, 22050, 16, true);
+    file.insert(file.end(), fmt.begin(), fmt.end());
+
+    auto path = writeTempFile("voctool_extensible.wav", file);
+    auto waveFile = loadWaveFile(path);
+    REQUIRE(waveFile.header.audioFormat == WAVE_FORMAT_PCM);
+    REQUIRE(waveFile.header.sampleRate == 22050);
+    REQUIRE(waveFile.header.bitsPerSample == 16);
+    REQUIRE(vectorsAreEqual(samples, waveFile.rawData));
+
+    auto mono = loadWaveFileToMono(path);
+    REQUIRE(mono.data.size() == 101);
+    REQUIRE(mono.data.front() < -0.45);
+    REQUIRE(mono.data.back() > 0.45);
+}
+
+TEST_CASE("LoadWaveTest RF64")
+{
+    auto samples = testSamples16Bit();
+
+    std::vector<uint8_t> file;
+    appendId(file, "RF64");
+    appendLe(file, 0xffffffff, 4);
+    appendId(file, "WAVE");
+    appendId(file, "ds64");
+    appendLe(file, 28, 4);
+    appendLe(file, 0, 8);               // riff size, not used
+    appendLe(file, samples.size(), 8);  // data size
+    appendLe(file, samples.size() / 2, 8);
+    appendLe(file, 0, 4);
+    auto fmt = formatChunk(WAVE_FORMAT_PCM, 1, 48000, 16, false);
+    file.insert(file.end(), fmt.begin(), fmt.end());
+    appendId(file, "data");
+    appendLe(file, 0xffffffff, 4);
+    file.insert(file.end(), samples.begin(), samples.end());
+    // trailing chunk must not be read as sample data
+    appendId(file, "LIST");
+    appendLe(file, 4, 4);
+    appendId(file, "INFO");
+
+    auto path = writeTempFile("voctool_rf64.wav", file);
+    REQUIRE(detectFileFormat(path) == FileFormat::WAV);
+
+    WaveReader reader(path);
+    REQUIRE(reader.dataSize() == samples.size());
+    REQUIRE(reader.frameCount() == 101);
+
+    auto waveFile = loadWaveFile(path);
+    REQUIRE(vectorsAreEqual(samples, waveFile.rawData));
+}
+
+TEST_CASE("LoadWaveTest streamed mono conversion matches reference")
+{
+    // stereo file, converted block by block
+    auto mono = loadWaveFileToMono(getTestDataDir() + "/jetpack.wav");
+    REQUIRE(mono.sampleRate == 44100);
+    REQUIRE(mono.data.size() == 386776 / 4);
+
+    WaveReader reader(getTestDataDir() + "/jetpack.wav");
+    std::vector<double> blockwise;
+    while (reader.readMonoFrames(blockwise, 1000) > 0)
+    {
+    }
+    REQUIRE(vectorsAreEqual(mono.data, blockwise));
+}
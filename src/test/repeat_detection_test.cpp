@@ -0,0 +1,118 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "repeat_detection.h"
+#include "voc_format.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace {
+
+// noise, then a loop of 301 even samples played 20 times, with copies that differ by at most one, then noise
+std::vector<uint8_t> createLoopingSound()
+{
+    std::vector<uint8_t> raw;
+    uint32_t noise = 12345;
+    auto nextNoise = [&]()
+    {
+        noise = noise * 1103515245 + 12345;
+        return static_cast<uint8_t>(noise >> 24);
+    };
+
+    for (int i = 0; i < 777; ++i)
+    {
+        raw.push_back(nextNoise());
+    }
+
+    std::vector<uint8_t> loop;
+    for (int i = 0; i < 301; ++i)
+    {
+        loop.push_back(static_cast<uint8_t>(128 + 100 * sin(i * 0.3) + (nextNoise() & 15)) & 0xfe);
+    }
+    for (int repeat = 0; repeat < 20; ++repeat)
+    {
+        for (size_t i = 0; i < loop.size(); ++i)
+        {
+            raw.push_back(static_cast<uint8_t>(loop[i] + ((repeat + i) % 5 == 0 ? 1 : 0)));
+        }
+    }
+
+    for (int i = 0; i < 555; ++i)
+    {
+        raw.push_back(nextNoise());
+    }
+    return raw;
+}
+
+} // annonymous namespace
+
+TEST_CASE("Repeat detection finds loops")
+{
+    auto raw = createLoopingSound();
+
+    // the copies differ, so exact repeats only exist where no sample was changed
+    auto exact = findRepeats(raw, 100, 0);
+    for (const RepeatRun& run : exact)
+    {
+        for (size_t copy = 1; copy < run.count; ++copy)
+        {
+            REQUIRE(std::equal(raw.begin() + run.begin, raw.begin() + run.begin + run.length, raw.begin() + run.begin + copy * run.length));
+        }
+    }
+
+    auto repeats = findRepeats(raw, 100, 1);
+    REQUIRE(repeats.size() == 1);
+    REQUIRE(repeats[0].begin == 777);
+    REQUIRE(repeats[0].length == 301);
+    REQUIRE(repeats[0].count == 20);
+
+    // shortest instance of at least the minimum length
+    repeats = findRepeats(raw, 400, 1);
+    REQUIRE(repeats.size() == 1);
+    REQUIRE(repeats[0].length == 602);
+    REQUIRE(repeats[0].count == 10);
+
+    REQUIRE(findRepeats(raw, 3100, 1).empty());
+}
+
+TEST_CASE("Repeat blocks decode to the original length")
+{
+    auto raw = createLoopingSound();
+    auto repeats = findRepeats(raw, 100, 1);
+
+    auto format = GENERATE(VOC_FORMAT_PCM_8BIT, VOC_FORMAT_ADPCM_4BIT, VOC_FORMAT_ADPCM_2BIT);
+    size_t encodedSamples = 0;
+    auto encode = [&](const std::vector<uint8_t>& samples)
+    {
+        encodedSamples += samples.size();
+        return encodeInFormat(format, samples);
+    };
+    auto blocks = createBlocksWithRepeats(raw, repeats, [&](const std::vector<uint8_t>& samples)
+    {
+        return createExactSoundBlocks(format, samples, encode);
+    });
+    REQUIRE(encodedSamples == 777 + 301 + 555);
+    REQUIRE(vocSampleCount(blocks) == raw.size());
+
+    auto vocData = createVocFile(10000, blocks);
+    auto vocFile = writeAndReadVocFile(vocData, "voctool_repeat_test.voc");
+
+    REQUIRE(vocFile.blocks.size() == blocks.size());
+    auto decoded = decodeToPcm(vocFile).sampleData;
+    REQUIRE(decoded.size() == raw.size());
+
+    REQUIRE(decodeStreamed(vocData) == decoded);
+
+    // every copy plays the first instance
+    for (size_t copy = 1; copy < 20; ++copy)
+    {
+        REQUIRE(std::equal(decoded.begin() + 777, decoded.begin() + 777 + 301, decoded.begin() + 777 + copy * 301));
+    }
+
+    if (format == VOC_FORMAT_PCM_8BIT)
+    {
+        REQUIRE(std::equal(raw.begin(), raw.begin() + 777 + 301, decoded.begin()));
+        REQUIRE(std::equal(raw.end() - 555, raw.end(), decoded.end() - 555));
+    }
+}
@@ -1,12 +1,62 @@
 #include "catch_importer.h"
 
 #include "resampling.h"
+#include "filter_cache.h"
 
 #include "read_wave.h"
+#include "execution_context.h"
 
 #include "test_helper.h"
 
 #include <memory>
+#include <algorithm>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+namespace { // annonymous namespace
+
+std::vector<double> sine(double frequency, double sampleRate, size_t length)
+{
+    std::vector<double> signal(length);
+    for (size_t i = 0; i < length; ++i)
+    {
+        signal[i] = sin(2 * M_PI * frequency * i / sampleRate);
+    }
+    return signal;
+}
+
+// maximum difference to the ideal sine away from the edges
+double sineError(const std::vector<double>& signal, double frequency, double sampleRate)
+{
+    double error = 0;
+    for (size_t i = signal.size() / 4; i < signal.size() * 3 / 4; ++i)
+    {
+        error = std::max(error, std::abs(signal[i] - sin(2 * M_PI * frequency * i / sampleRate)));
+    }
+    return error;
+}
+
+// maximum absolute value away from the edges
+double peak(const std::vector<double>& signal)
+{
+    return sineError(signal, 0, 1);
+}
+
+// amplitude of a sine away from the edges
+double amplitude(const std::vector<double>& signal)
+{
+    double sum = 0;
+    size_t begin = signal.size() / 4;
+    size_t end = signal.size() * 3 / 4;
+    for (size_t i = begin; i < end; ++i)
+    {
+        sum += signal[i] * signal[i];
+    }
+    return sqrt(2 * sum / (end - begin));
+}
+
+} // annonymous namespace
 
 TEST_CASE("Conversion Tests uint8_t")
 {
@@ -158,3 +208,154 @@ TEST_CASE("Resampling Test")
 
 
 
+
+TEST_CASE("Parallel resampling is identical to serial resampling")
+{
+    auto waveFile = loadWaveFileToMono(getTestDataDir() + "/jetpack.wav");
+
+    ExecutionContext::configure(threadSettings(1));
+    auto serial = resample(waveFile.data, waveFile.sampleRate, 11025);
+
+    ExecutionContext::configure(threadSettings(4));
+    auto parallel = resample(waveFile.data, waveFile.sampleRate, 11025);
+    ExecutionContext::configure({});
+
+    REQUIRE(serial.size() == waveFile.data.size() / 4);
+    REQUIRE(serial == parallel);
+}
+
+TEST_CASE("Filters designed for earlier calls are only reused for the same parameters")
+{
+    auto waveFile = loadWaveFileToMono(getTestDataDir() + "/jetpack.wav");
+
+    auto first = resampleSinc(waveFile.data, waveFile.sampleRate, 8000.0);
+    auto lowerCutoff = resampleSinc(waveFile.data, waveFile.sampleRate, 8000.0, 3000.0);
+    auto again = resampleSinc(waveFile.data, waveFile.sampleRate, 8000.0);
+    REQUIRE(first == again);
+    REQUIRE(first != lowerCutoff);
+
+    auto linear = resample(waveFile.data, waveFile.sampleRate, 8000);
+    auto kaiser = resample(waveFile.data, waveFile.sampleRate, 8000, {}, {}, 90.0);
+    REQUIRE(linear == resample(waveFile.data, waveFile.sampleRate, 8000));
+    REQUIRE(linear != kaiser);
+}
+
+TEST_CASE("The filter cache designs every filter once and is cleared when full")
+{
+    FilterCache<std::vector<double>, 3> cache;
+    int designs = 0;
+    auto design = [&designs](double value)
+    {
+        return [&designs, value]()
+        {
+            ++designs;
+            return std::vector<double>{ value };
+        };
+    };
+
+    auto first = cache.get({ 1.0, 2.0 }, design(1));
+    REQUIRE(designs == 1);
+    REQUIRE(cache.get({ 1.0, 2.0 }, design(1)) == first);
+    REQUIRE(designs == 1);
+
+    auto second = cache.get({ 1.0, 3.0 }, design(2));
+    REQUIRE(designs == 2);
+    REQUIRE(second != first);
+    REQUIRE(*second == std::vector<double>{ 2 });
+    REQUIRE(cache.get({ 1.0 }, design(3)) != first);
+    REQUIRE(designs == 3);
+    REQUIRE(cache.get({ 1.0, 2.0 }, design(1)) == first);
+    REQUIRE(cache.get({ 1.0, 3.0 }, design(2)) == second);
+    REQUIRE(designs == 3);
+
+    // the fourth filter clears the cache
+    auto fourth = cache.get({ 4.0 }, design(4));
+    REQUIRE(designs == 4);
+    REQUIRE(*fourth == std::vector<double>{ 4 });
+    REQUIRE(cache.get({ 4.0 }, design(4)) == fourth);
+    REQUIRE(designs == 4);
+
+    auto redesigned = cache.get({ 1.0, 2.0 }, design(1));
+    REQUIRE(designs == 5);
+    REQUIRE(redesigned != first);
+    REQUIRE(*redesigned == *first);
+    REQUIRE(*cache.get({ 1.0, 3.0 }, design(2)) == std::vector<double>{ 2 });
+    REQUIRE(designs == 6);
+}
+
+TEST_CASE("Multistage decimation keeps passband and removes stopband")
+{
+    // 48000 Hz to 8000 Hz uses two half-band stages, the stopband starts at 4400 Hz
+    auto passband = resample(sine(1000, 48000, 48000), 48000, 8000);
+    REQUIRE(passband.size() == 8000);
+    REQUIRE(amplitude(passband) > 0.99);
+    REQUIRE(amplitude(passband) < 1.01);
+
+    // would alias to 2000 Hz
+    auto stopband = resample(sine(10000, 48000, 48000), 48000, 8000);
+    REQUIRE(amplitude(stopband) < 0.001);
+
+    // stopband of the final stage
+    auto transition = resample(sine(5000, 48000, 48000), 48000, 8000);
+    REQUIRE(amplitude(transition) < 0.001);
+}
+
+TEST_CASE("Sinc resampling works for any ratio of sample rates")
+{
+    SECTION("44100 Hz to the VOC playback rate of 44100 Hz")
+    {
+        double playbackRate = 1000000.0 / 23;
+        auto output = resampleSinc(sine(1000, 44100, 44100), 44100, playbackRate);
+        REQUIRE(output.size() == 43478);
+        REQUIRE(sineError(output, 1000, playbackRate) < 0.001);
+    }
+
+    SECTION("8000 Hz up to 11111.11 Hz")
+    {
+        double playbackRate = 1000000.0 / 90;
+        auto output = resampleSinc(sine(1000, 8000, 8000), 8000, playbackRate);
+        REQUIRE(output.size() == 11111);
+        REQUIRE(sineError(output, 1000, playbackRate) < 0.001);
+    }
+
+    SECTION("48000 Hz down to 12048.19 Hz removes the stopband")
+    {
+        double playbackRate = 1000000.0 / 83;
+        REQUIRE(sineError(resampleSinc(sine(1000, 48000, 48000), 48000, playbackRate), 1000, playbackRate) < 0.001);
+
+        auto stopband = resampleSinc(sine(8000, 48000, 48000), 48000, playbackRate);
+        REQUIRE(sineError(stopband, 0, playbackRate) < 0.001);
+    }
+
+    SECTION("Integer resampling with too many phases for a polyphase filter")
+    {
+        // 7919 is prime, so there are 7919 phases after two half-band stages
+        auto output = resample(sine(1000, 48000, 48000), 48000, 7919);
+        REQUIRE(output.size() == 7919);
+        REQUIRE(sineError(output, 1000, 7919) < 0.001);
+    }
+}
+
+TEST_CASE("Kaiser window filters meet the requested stopband attenuation")
+{
+    double attenuation = GENERATE(attenuationForBitDepth(8), 90.0);
+    double stopbandGain = pow(10, -attenuation / 20);
+
+    SECTION("multistage decimation")
+    {
+        auto passband = resample(sine(1000, 48000, 48000), 48000, 8000, {}, {}, attenuation);
+        REQUIRE(peak(passband) > 1 - 2 * stopbandGain);
+        REQUIRE(peak(passband) < 1 + 2 * stopbandGain);
+
+        REQUIRE(peak(resample(sine(10000, 48000, 48000), 48000, 8000, {}, {}, attenuation)) < stopbandGain);
+        REQUIRE(peak(resample(sine(5000, 48000, 48000), 48000, 8000, {}, {}, attenuation)) < stopbandGain);
+    }
+
+    SECTION("single stage")
+    {
+        REQUIRE(peak(resample(sine(8000, 22050, 22050), 22050, 11025, {}, {}, attenuation)) < stopbandGain);
+        REQUIRE(peak(resampleSinc(sine(8000, 22050, 22050), 22050, 1000000.0 / 91, {}, {}, attenuation)) < stopbandGain);
+    }
+
+    REQUIRE_THROWS_AS(resample(sine(1000, 48000, 48000), 48000, 8000, {}, {}, 0.0), std::runtime_error);
+}
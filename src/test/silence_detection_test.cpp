@@ -0,0 +1,102 @@
+#include "catch_importer.h"
+#include "test_helper.h"
+
+#include "silence_detection.h"
+#include "voc_format.h"
+
+#include <math.h>
+#include <algorithm>
+
+namespace {
+
+// noise with pauses at the start, in the middle (longer than one VOC silence block) and at the end
+std::vector<uint8_t> createSpeechWithPauses()
+{
+    std::vector<uint8_t> raw;
+    raw.insert(raw.end(), 1000, 128);
+    for (int i = 0; i < 5001; ++i)
+    {
+        raw.push_back(static_cast<uint8_t>(128 + 100 * sin(i * 0.05) + (i % 7)));
+    }
+    for (int i = 0; i < 70000; ++i)
+    {
+        raw.push_back(static_cast<uint8_t>(127 + i % 3));
+    }
+    for (int i = 0; i < 3002; ++i)
+    {
+        raw.push_back(static_cast<uint8_t>(128 + 90 * sin(i * 0.02)));
+    }
+    raw.insert(raw.end(), 500, 129);
+    return raw;
+}
+
+} // annonymous namespace
+
+TEST_CASE("Silence detection finds quiet runs")
+{
+    std::vector<uint8_t> raw = { 128, 128, 129, 200, 127, 128, 128, 128, 60, 126, 130, 128 };
+
+    auto runs = findSilence(raw, 1, 3);
+    REQUIRE(runs.size() == 2);
+    REQUIRE(runs[0].begin == 0);
+    REQUIRE(runs[0].length == 3);
+    REQUIRE(runs[1].begin == 4);
+    REQUIRE(runs[1].length == 4);
+
+    // a threshold of 2 also accepts 126 and 130
+    runs = findSilence(raw, 2, 3);
+    REQUIRE(runs.size() == 3);
+    REQUIRE(runs[2].begin == 9);
+    REQUIRE(runs[2].length == 3);
+
+    REQUIRE(findSilence(raw, 1, 5).empty());
+}
+
+TEST_CASE("Silence blocks keep the length of the sound")
+{
+    auto raw = createSpeechWithPauses();
+    auto silence = findSilence(raw, 1, 100);
+    REQUIRE(silence.size() == 3);
+    size_t silentSamples = 0;
+    for (const SilenceRun& run : silence)
+    {
+        silentSamples += run.length;
+    }
+
+    auto format = GENERATE(VOC_FORMAT_PCM_8BIT, VOC_FORMAT_ADPCM_4BIT, VOC_FORMAT_ADPCM_2BIT);
+    size_t encodedSamples = 0;
+    auto encode = [&](const std::vector<uint8_t>& samples)
+    {
+        encodedSamples += samples.size();
+        return encodeInFormat(format, samples);
+    };
+    auto blocks = createBlocksWithSilence(raw, silence, [&](const std::vector<uint8_t>& samples)
+    {
+        return std::vector<VocBlock>{ createSoundBlock(format, encode(samples)) };
+    });
+    REQUIRE(encodedSamples == raw.size() - silentSamples);
+    REQUIRE(blocks.size() == 5);
+
+    auto vocData = createVocFile(10000, blocks);
+    auto vocFile = writeAndReadVocFile(vocData, "voctool_silence_test.voc");
+
+    REQUIRE(vocFile.sampleFormat == format);
+    REQUIRE(vocFile.timeConstant == 156);
+    // the middle pause is split into two silence blocks
+    REQUIRE(vocFile.blocks.size() == 6);
+
+    auto decoded = decodeToPcm(vocFile).sampleData;
+    REQUIRE(decoded.size() == raw.size());
+
+    REQUIRE(decodeStreamed(vocData) == decoded);
+
+    if (format == VOC_FORMAT_PCM_8BIT)
+    {
+        auto expected = raw;
+        for (const SilenceRun& run : silence)
+        {
+            std::fill_n(expected.begin() + run.begin, run.length, 128);
+        }
+        REQUIRE(decoded == expected);
+    }
+}
@@ -5,6 +5,13 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <filesystem>
+#include <array>
+
+#include "voc_format.h"
+#include "voc_stream_decoder.h"
+#include "encode_creative_adpcm.h"
+#include "execution_context.h"
 
 namespace { // annonymous namespace
 
@@ -78,6 +85,72 @@ bool vectorsAreEqual(const std::vector<SampleType>& a, const std::vector<SampleT
     return true;
 }
 
+
+/**
+ * Settings for ExecutionContext::configure() with the given number of threads and no other restriction.
+ */
+ExecutionSettings threadSettings(int threads)
+{
+    ExecutionSettings settings;
+    settings.threads = threads;
+    return settings;
+}
+
+
+/**
+ * Encodes samples into the sample data of a sound block in the given format with the
+ * default encoders of the tests.
+ */
+std::vector<uint8_t> encodeInFormat(VocSampleFormat format, const std::vector<uint8_t>& samples)
+{
+    switch (format)
+    {
+        case VOC_FORMAT_ADPCM_4BIT:
+            return createAdpcm4BitFromRaw(samples, 4);
+        case VOC_FORMAT_ADPCM_2BIT:
+            return createAdpcm2BitFromRaw(samples, 4);
+        default:
+            return samples;
+    }
+}
+
+
+/**
+ * Writes the VOC file to a temporary file and reads it back with readVocFile().
+ */
+VocFile writeAndReadVocFile(const std::vector<uint8_t>& vocData, const std::string& name)
+{
+    auto path = (std::filesystem::temp_directory_path() / name).string();
+    dumpRaw(vocData, path);
+    try
+    {
+        auto vocFile = readVocFile(path);
+        std::filesystem::remove(path);
+        return vocFile;
+    }
+    catch (...)
+    {
+        std::filesystem::remove(path);
+        throw;
+    }
+}
+
+
+/**
+ * Decodes the VOC file with VocStreamDecoder in small pieces.
+ */
+std::vector<uint8_t> decodeStreamed(const std::vector<uint8_t>& vocData)
+{
+    VocStreamDecoder streamDecoder(vocData);
+    std::vector<uint8_t> streamed;
+    std::array<uint8_t, 100> buffer;
+    while (size_t count = streamDecoder.decode(buffer))
+    {
+        streamed.insert(streamed.end(), buffer.begin(), buffer.begin() + count);
+    }
+    return streamed;
+}
+
 } // annonymous namespace
 
 #endif
\ No newline at end of file
@@ -1,12 +1,49 @@
 #include "catch_importer.h"
 #include "test_helper.h"
 #include "voc_format.h"
+#include "decode_creative_adpcm.h"
+#include "voc_stream_decoder.h"
 
 #include <memory>
+#include <array>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
+namespace { // annonymous namespace
+
+using RawVocBlocks = std::vector<std::pair<uint8_t, std::vector<uint8_t>>>;
+
+/**
+ * Creates a VOC file with the given blocks (type, payload).
+ */
+std::vector<uint8_t> createVocBlocks(const RawVocBlocks& blocks)
+{
+    std::string header = "Creative Voice File\x1a";
+    std::vector<uint8_t> data(header.begin(), header.end());
+    data.insert(data.end(), { 0x1a, 0x00, 0x14, 0x01, 0x1f, 0x11 });   // version 1.20
+    for (const auto& [type, payload] : blocks)
+    {
+        data.push_back(type);
+        data.push_back(payload.size() & 0xff);
+        data.push_back((payload.size() >> 8) & 0xff);
+        data.push_back((payload.size() >> 16) & 0xff);
+        data.insert(data.end(), payload.begin(), payload.end());
+    }
+    data.push_back(0);
+    return data;
+}
+
+/**
+ * Writes a VOC file with the given blocks (type, payload) and reads it back.
+ */
+VocFile readVocBlocks(const RawVocBlocks& blocks)
+{
+    return writeAndReadVocFile(createVocBlocks(blocks), "voctool_blocks_test.voc");
+}
+
+} // annonymous namespace
+
 TEST_CASE("Test Voc Decoding Wrong Filename")
 {
     REQUIRE_THROWS_AS(readVocFile(""), std::runtime_error);
@@ -52,3 +89,94 @@ TEST_CASE("Test Voc Decoding ADPCM4")
     REQUIRE(pcm.sampleData.size() == reference.size());
     REQUIRE(pcm.sampleData == reference);
 }
+
+TEST_CASE("Test ADPCM decoding into caller buffer")
+{
+    auto vocfile = readVocFile(getTestDataDir() + "/jetpack_adpcm4.voc");
+    auto reference = readRaw(getTestDataDir() + "/jetpack_adpcm4_decoded.raw");
+    auto payload = std::span<const uint8_t>(vocfile.sampleData).subspan(1);
+
+    std::vector<uint8_t> output(payload.size() * 2 + 1);
+    decodeAdpcm4(vocfile.sampleData[0], payload, output);
+    REQUIRE(output == reference);
+
+    std::vector<uint8_t> tooSmall(payload.size() * 2);
+    REQUIRE_THROWS_AS(decodeAdpcm4(vocfile.sampleData[0], payload, tooSmall), std::runtime_error);
+}
+
+TEST_CASE("VOC playback frequency")
+{
+    REQUIRE(frequencyToTimeConstant(44100) == 233);
+    REQUIRE(vocPlaybackFrequency(44100) == 1000000.0 / 23);
+    REQUIRE(vocPlaybackFrequency(11025) == 1000000.0 / 91);
+    REQUIRE(vocPlaybackFrequency(10000) == 10000);
+    REQUIRE(frequencyToTimeConstant(timeConstantToFrequency(131)) == 131);
+    REQUIRE_THROWS_AS(vocPlaybackFrequency(3000), std::runtime_error);
+}
+
+TEST_CASE("Extended VOC blocks set time constant and format of the next sound block")
+{
+    // 10000 Hz mono: 65536 - 256000000 / 10000 = 0x9c00, ADPCM4, mono
+    RawVocBlocks blocks = {
+        { 8, { 0x00, 0x9c, VOC_FORMAT_ADPCM_4BIT, 0 } },
+        { 1, { 131, VOC_FORMAT_PCM_8BIT, 0x80, 0x11, 0x22 } },
+    };
+    auto vocFile = readVocBlocks(blocks);
+    REQUIRE(vocFile.timeConstant == 0x9c);
+    REQUIRE(timeConstantToFrequency(vocFile.timeConstant) == 10000);
+    REQUIRE(vocFile.sampleFormat == VOC_FORMAT_ADPCM_4BIT);
+    REQUIRE(decodeToPcm(vocFile).sampleData.size() == 5);
+
+    auto vocData = createVocBlocks(blocks);
+    REQUIRE(decodeStreamed(vocData) == decodeToPcm(vocFile).sampleData);
+    VocStreamDecoder streamDecoder(vocData);
+    std::array<uint8_t, 5> output;
+    REQUIRE(streamDecoder.decode(output) == 5);
+    REQUIRE(streamDecoder.timeConstant() == 0x9c);
+
+    RawVocBlocks stereo = { { 8, { 0x00, 0x9c, VOC_FORMAT_PCM_8BIT, 1 } }, { 1, { 131, 0, 0x80 } } };
+    REQUIRE_THROWS_WITH(readVocBlocks(stereo), Catch::Matchers::Contains("Stereo"));
+    REQUIRE_THROWS_WITH(decodeStreamed(createVocBlocks(stereo)), Catch::Matchers::Contains("Stereo"));
+}
+
+TEST_CASE("VOC sound blocks of type 9 are read")
+{
+    // 11025 Hz, 2 bits per sample, mono, ADPCM2, 4 reserved bytes
+    RawVocBlocks blocks = {
+        { 9, { 0x11, 0x2b, 0, 0, 2, 1, VOC_FORMAT_ADPCM_2BIT, 0, 0, 0, 0, 0, 0x80, 0x1b } },
+    };
+    auto vocFile = readVocBlocks(blocks);
+    REQUIRE(vocFile.timeConstant == frequencyToTimeConstant(11025));
+    REQUIRE(vocFile.sampleFormat == VOC_FORMAT_ADPCM_2BIT);
+    REQUIRE(vocFile.sampleData == std::vector<uint8_t>{ 0x80, 0x1b });
+    REQUIRE(decodeToPcm(vocFile).sampleData.size() == 5);
+
+    auto vocData = createVocBlocks(blocks);
+    REQUIRE(decodeStreamed(vocData) == decodeToPcm(vocFile).sampleData);
+    VocStreamDecoder streamDecoder(vocData);
+    std::array<uint8_t, 5> output;
+    REQUIRE(streamDecoder.decode(output) == 5);
+    REQUIRE(streamDecoder.timeConstant() == frequencyToTimeConstant(11025));
+
+    // 16 bit PCM
+    RawVocBlocks pcm16 = { { 9, { 0x11, 0x2b, 0, 0, 16, 1, 4, 0, 0, 0, 0, 0, 0, 0 } } };
+    REQUIRE_THROWS_WITH(readVocBlocks(pcm16), Catch::Matchers::Contains("Codec 4"));
+    REQUIRE_THROWS_WITH(decodeStreamed(createVocBlocks(pcm16)), Catch::Matchers::Contains("Codec 4"));
+    // stereo
+    RawVocBlocks stereo = { { 9, { 0x11, 0x2b, 0, 0, 8, 2, 0, 0, 0, 0, 0, 0, 0x80, 0x80 } } };
+    REQUIRE_THROWS_WITH(readVocBlocks(stereo), Catch::Matchers::Contains("mono"));
+    REQUIRE_THROWS_WITH(decodeStreamed(createVocBlocks(stereo)), Catch::Matchers::Contains("mono"));
+}
+
+TEST_CASE("Unknown VOC block types are rejected")
+{
+    RawVocBlocks unknown = { { 1, { 131, 0, 0x80 } }, { 10, { 0 } } };
+    REQUIRE_THROWS_WITH(readVocBlocks(unknown), Catch::Matchers::Contains("Unsupported VOC block type 10"));
+    REQUIRE_THROWS_WITH(decodeStreamed(createVocBlocks(unknown)), Catch::Matchers::Contains("Unsupported VOC block type 10"));
+
+    // markers and text are skipped
+    RawVocBlocks blocks = { { 5, { 'h', 'i', 0 } }, { 4, { 1, 0 } }, { 1, { 131, 0, 0x80, 0x81 } } };
+    auto vocFile = readVocBlocks(blocks);
+    REQUIRE(vocFile.sampleData == std::vector<uint8_t>{ 0x80, 0x81 });
+    REQUIRE(decodeStreamed(createVocBlocks(blocks)) == vocFile.sampleData);
+}
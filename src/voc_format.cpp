@@ -1,5 +1,8 @@
 #include "voc_format.h"
 #include "decode_creative_adpcm.h"
+#include "decode_creative_adpcm_parallel.h"
+#include "progress.h"
+#include "file_tools.h"
 
 #include <string>
 #include <cmath>
@@ -7,6 +10,9 @@
 #include <stdexcept>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <algorithm>
+#include <optional>
 
 void append(std::vector<uint8_t>& container, const std::string& value)
 {
@@ -24,12 +30,8 @@ void append(std::vector<uint8_t>& container, uint8_t value)
     container.push_back(value);
 }
 
-std::vector<uint8_t> createVocFile(
-    uint32_t frequency,
-    const std::vector<uint8_t>& sampleData,
-    VocSampleFormat sampleFormat)
+uint8_t frequencyToTimeConstant(uint32_t frequency)
 {
-    
     // minimum frequency for VOC files
     // This is limited by the way VOC files encode the time constant
     const uint32_t MIN_VOC_FREQUENCY = 3908;
@@ -38,7 +40,147 @@ std::vector<uint8_t> createVocFile(
         throw std::runtime_error("Frequency too low for VOC file. Minimum frequency is 3908 Hz.");
     }
 
-    uint8_t timeConstant = static_cast<uint8_t>(round(256 - 1000000.0 / frequency));
+    return static_cast<uint8_t>(round(256 - 1000000.0 / frequency));
+}
+
+double vocPlaybackFrequency(uint32_t frequency)
+{
+    return 1000000.0 / (256 - frequencyToTimeConstant(frequency));
+}
+
+VocBlock createSoundBlock(VocSampleFormat sampleFormat, std::vector<uint8_t> sampleData)
+{
+    return { VOC_BLOCK_SOUND, sampleFormat, std::move(sampleData), 0, 0 };
+}
+
+VocBlock createSilenceBlock(uint32_t length)
+{
+    return { VOC_BLOCK_SILENCE, VOC_FORMAT_PCM_8BIT, {}, length, 0 };
+}
+
+VocBlock createRepeatStartBlock(uint32_t repeatCount)
+{
+    if (repeatCount > 0xffff)
+    {
+        throw std::runtime_error("A VOC repeat can be played at most 65535 times");
+    }
+    return { VOC_BLOCK_REPEAT_START, VOC_FORMAT_PCM_8BIT, {}, 0, repeatCount };
+}
+
+VocBlock createRepeatEndBlock()
+{
+    return { VOC_BLOCK_REPEAT_END, VOC_FORMAT_PCM_8BIT, {}, 0, 0 };
+}
+
+std::vector<VocBlock> createExactSoundBlocks(VocSampleFormat format, const std::vector<uint8_t>& samples, const SampleEncoder& encode)
+{
+    std::vector<VocBlock> blocks;
+    VocBlock block = createSoundBlock(format, encode(samples));
+    while (!block.sampleData.empty() && vocBlockSampleCount(block) > samples.size())
+    {
+        block.sampleData.pop_back();
+    }
+
+    size_t encoded = vocBlockSampleCount(block);
+    if (encoded > 0)
+    {
+        blocks.push_back(std::move(block));
+    }
+    if (encoded < samples.size())
+    {
+        blocks.push_back(createSoundBlock(VOC_FORMAT_PCM_8BIT, std::vector<uint8_t>(samples.begin() + encoded, samples.end())));
+    }
+    return blocks;
+}
+
+size_t vocSamplesPerByte(VocSampleFormat format)
+{
+    switch (format)
+    {
+        case VOC_FORMAT_PCM_8BIT:
+            return 1;
+        case VOC_FORMAT_ADPCM_4BIT:
+            return 2;
+        case VOC_FORMAT_ADPCM_2BIT:
+            return 4;
+        default:
+            throw std::runtime_error("Unsupported sample format");
+    }
+}
+
+size_t vocBlockSampleCount(const VocBlock& block)
+{
+    switch (block.type)
+    {
+        case VOC_BLOCK_SOUND:
+        {
+            // ADPCM data starts with the reference byte, which is the first sample
+            if (block.sampleFormat == VOC_FORMAT_PCM_8BIT || block.sampleData.empty())
+            {
+                return block.sampleData.size();
+            }
+            return 1 + (block.sampleData.size() - 1) * vocSamplesPerByte(block.sampleFormat);
+        }
+        case VOC_BLOCK_SILENCE:
+            return block.silenceLength;
+        default:
+            return 0;
+    }
+}
+
+size_t vocSampleCount(const std::vector<VocBlock>& blocks)
+{
+    size_t total = 0;
+    size_t repeated = 0;
+    uint32_t repeatCount = 1;
+    for (const VocBlock& block : blocks)
+    {
+        if (block.type == VOC_BLOCK_REPEAT_START)
+        {
+            total += repeated;
+            repeated = 0;
+            repeatCount = std::max<uint32_t>(block.repeatCount, 1);
+        }
+        else if (block.type == VOC_BLOCK_REPEAT_END)
+        {
+            total += repeated * repeatCount;
+            repeated = 0;
+            repeatCount = 1;
+        }
+        else
+        {
+            repeated += vocBlockSampleCount(block);
+        }
+    }
+    return total + repeated * repeatCount;
+}
+
+void appendBlockHeader(std::vector<uint8_t>& out, VocBlockType type, uint32_t size)
+{
+    if (size > 0xffffff)
+    {
+        throw std::runtime_error("VOC block too large");
+    }
+
+    append(out, (uint8_t)type);
+
+    // size has 3 bytes
+    out.push_back(size & 0xff);
+    out.push_back(size >> 8 & 0xff);
+    out.push_back(size >> 16 & 0xff);
+}
+
+std::vector<uint8_t> createVocFile(
+    uint32_t frequency,
+    const std::vector<uint8_t>& sampleData,
+    VocSampleFormat sampleFormat)
+{
+    return createVocFile(frequency, { createSoundBlock(sampleFormat, sampleData) });
+}
+
+std::vector<uint8_t> createVocFile(uint32_t frequency, const std::vector<VocBlock>& blocks)
+{
+    uint8_t timeConstant = frequencyToTimeConstant(frequency);
 
     std::string vocHeader = "Creative Voice File\x1a";
 
@@ -53,18 +195,54 @@ std::vector<uint8_t> createVocFile(
     append(out, (uint16_t)0x1a);
     append(out, version);
     append(out, versionCheck);
-    append(out, (uint8_t)1); // sample header
-
-    // now append size (3 bytes)
-    uint32_t sampleSize = static_cast<uint32_t>(sampleData.size() + 2);
-    out.push_back(sampleSize & 0xff);
-    out.push_back(sampleSize >> 8 & 0xff);
-    out.push_back(sampleSize >> 16 & 0xff);
 
-    append(out, timeConstant);
-    append(out, (uint8_t)sampleFormat);
-
-    out.insert(out.end(), sampleData.begin(), sampleData.end());
+    for (const VocBlock& block : blocks)
+    {
+        switch (block.type)
+        {
+            case VOC_BLOCK_SOUND:
+            {
+                appendBlockHeader(out, VOC_BLOCK_SOUND, static_cast<uint32_t>(block.sampleData.size() + 2));
+                append(out, timeConstant);
+                append(out, (uint8_t)block.sampleFormat);
+                out.insert(out.end(), block.sampleData.begin(), block.sampleData.end());
+                break;
+            }
+            case VOC_BLOCK_REPEAT_START:
+            {
+                // the stored count is the number of repetitions after the first time, 0xffff is endless
+                if (block.repeatCount > 0xffff)
+                {
+                    throw std::runtime_error("A VOC repeat can be played at most 65535 times");
+                }
+                appendBlockHeader(out, VOC_BLOCK_REPEAT_START, 2);
+                append(out, (uint16_t)(block.repeatCount == 0 ? 0xffff : block.repeatCount - 1));
+                break;
+            }
+            case VOC_BLOCK_REPEAT_END:
+            {
+                appendBlockHeader(out, VOC_BLOCK_REPEAT_END, 0);
+                break;
+            }
+            case VOC_BLOCK_SILENCE:
+            {
+                // one silence block holds up to 65536 samples, the stored length is one less
+                for (uint32_t remaining = block.silenceLength; remaining > 0;)
+                {
+                    uint32_t length = std::min<uint32_t>(remaining, 65536);
+                    appendBlockHeader(out, VOC_BLOCK_SILENCE, 3);
+                    append(out, (uint16_t)(length - 1));
+                    append(out, timeConstant);
+                    remaining -= length;
+                }
+                break;
+            }
+            default:
+            {
+                throw std::runtime_error("Unsupported VOC block type");
+            }
+        }
+    }
 
     append(out, (uint8_t)0); // end marker
 
@@ -84,9 +262,44 @@ uint32_t timeConstantToFrequency(uint8_t timeConstant)
     return 1000000 / (256 - timeConstant);
 }
 
+VocSoundFormat readVocExtendedBlock(std::span<const uint8_t> payload)
+{
+    if (payload.size() < 4)
+    {
+        throw std::runtime_error("Invalid VOC file. Extended block too small.");
+    }
+    if (payload[3] != 0)
+    {
+        throw std::runtime_error("Unsupported VOC file. Stereo sound data is not supported.");
+    }
+    // for mono the high byte of 65536 - 256000000 / frequency is the 8 bit time constant
+    return { payload[1], (VocSampleFormat)payload[2] };
+}
+
+VocSoundFormat readVocSoundBlock9Header(std::span<const uint8_t> payload)
+{
+    if (payload.size() < vocSoundBlock9HeaderSize)
+    {
+        throw std::runtime_error("Invalid VOC file. Sound block too small.");
+    }
+    uint32_t frequency = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+    uint8_t channels = payload[5];
+    uint16_t codec = payload[6] | (payload[7] << 8);
+    if (channels != 1)
+    {
+        throw std::runtime_error("Unsupported VOC file. Only mono sound data is supported.");
+    }
+    if (codec != VOC_FORMAT_PCM_8BIT && codec != VOC_FORMAT_ADPCM_4BIT && codec != VOC_FORMAT_ADPCM_2BIT)
+    {
+        throw std::runtime_error("Unsupported VOC file. Codec " + std::to_string(codec) + " in sound block type 9.");
+    }
+    return { frequencyToTimeConstant(frequency), (VocSampleFormat)codec };
+}
+
 VocFile readVocFile(const std::string &filename)
 {
-    FILE* fp = fopen(filename.c_str(), "rb");
+    auto file = openFile(filename, "rb");
+    FILE* fp = file.get();
     if (!fp)
     {
         throw std::runtime_error("Could not open file: " +  filename);
@@ -115,71 +328,236 @@ VocFile readVocFile(const std::string &filename)
         throw std::runtime_error("Invalid VOC file. Version check failed.");
     }
 
-    uint8_t headerType;
-    safeRead(&headerType, 1, fp);
+    VocFile result = {
+        0,
+        (uint8_t)((version >> 8) & 0xff),
+        (uint8_t)(version & 0xff),
+        VOC_FORMAT_PCM_8BIT,
+        {},
+        {}};
+    bool hasTimeConstant = false;
+
+    // an extended block (type 8) replaces time constant and format of the next sound block
+    std::optional<VocSoundFormat> extended;
 
-    if (headerType != 1)
+    while (true)
     {
-        throw std::runtime_error("Invalid VOC file. Header type is not 1.");
-    }
+        // terminator block, files without terminator end at the end of the file
+        uint8_t blockType;
+        if (fread(&blockType, 1, 1, fp) != 1 || blockType == 0)
+        {
+            break;
+        }
 
-    uint8_t sampleA, sampleB, sampleC;
-    safeRead(&sampleA, 1, fp);
-    safeRead(&sampleB, 1, fp);
-    safeRead(&sampleC, 1, fp);
-    uint32_t sampleSize = sampleA | (sampleB << 8) | (sampleC << 16);
+        uint8_t sizeBytes[3];
+        safeRead(sizeBytes, 3, fp);
+        uint32_t blockSize = sizeBytes[0] | (sizeBytes[1] << 8) | (sizeBytes[2] << 16);
 
-    uint8_t timeConstant;
-    safeRead(&timeConstant, 1, fp);
+        std::vector<uint8_t> payload(blockSize);
+        safeRead(payload.data(), blockSize, fp);
 
-    uint8_t sampleFormat;
-    safeRead(&sampleFormat, 1, fp);
+        switch (blockType)
+        {
+            case 1: // sound data
+            {
+                if (blockSize < 2)
+                {
+                    throw std::runtime_error("Invalid VOC file. Sound block too small.");
+                }
+                uint8_t timeConstant = extended ? extended->timeConstant : payload[0];
+                VocSampleFormat sampleFormat = extended ? extended->sampleFormat : (VocSampleFormat)payload[1];
+                extended.reset();
+                if (!hasTimeConstant)
+                {
+                    result.timeConstant = timeConstant;
+                    hasTimeConstant = true;
+                }
+                result.blocks.push_back(createSoundBlock(
+                    sampleFormat,
+                    std::vector<uint8_t>(payload.begin() + 2, payload.end())));
+                break;
+            }
+            case 2: // sound continuation, continues the decoder state of the previous block
+            {
+                if (result.blocks.empty() || result.blocks.back().type != VOC_BLOCK_SOUND)
+                {
+                    throw std::runtime_error("Invalid VOC file. Continuation without sound block.");
+                }
+                auto& sampleData = result.blocks.back().sampleData;
+                sampleData.insert(sampleData.end(), payload.begin(), payload.end());
+                break;
+            }
+            case 3: // silence
+            {
+                if (blockSize < 3)
+                {
+                    throw std::runtime_error("Invalid VOC file. Silence block too small.");
+                }
+                result.blocks.push_back(createSilenceBlock((payload[0] | (payload[1] << 8)) + 1));
+                if (!hasTimeConstant)
+                {
+                    result.timeConstant = payload[2];
+                }
+                break;
+            }
+            case 6: // repeat start
+            {
+                if (blockSize < 2)
+                {
+                    throw std::runtime_error("Invalid VOC file. Repeat block too small.");
+                }
+                uint16_t count = payload[0] | (payload[1] << 8);
+                result.blocks.push_back(createRepeatStartBlock(count == 0xffff ? 0 : count + 1));
+                break;
+            }
+            case 7: // repeat end
+            {
+                result.blocks.push_back(createRepeatEndBlock());
+                break;
+            }
+            case 4: // marker
+            case 5: // text
+            {
+                break;
+            }
+            case 8: // extended, 16 bit time constant, format and mono/stereo of the next sound block
+            {
+                extended = readVocExtendedBlock(payload);
+                break;
+            }
+            case 9: // sound data with sample rate, bits per sample, channels and codec
+            {
+                auto soundFormat = readVocSoundBlock9Header(payload);
+                if (!hasTimeConstant)
+                {
+                    result.timeConstant = soundFormat.timeConstant;
+                    hasTimeConstant = true;
+                }
+                result.blocks.push_back(createSoundBlock(
+                    soundFormat.sampleFormat,
+                    std::vector<uint8_t>(payload.begin() + vocSoundBlock9HeaderSize, payload.end())));
+                break;
+            }
+            default:
+            {
+                throw std::runtime_error("Unsupported VOC block type " + std::to_string(blockType));
+            }
+        }
+    }
 
-    std::vector<uint8_t> sampleData(sampleSize - 2);
-    safeRead(sampleData.data(), sampleSize - 2, fp);
+    if (vocSampleCount(result.blocks) == 0)
+    {
+        throw std::runtime_error("Invalid VOC file. No sound data.");
+    }
+
+    for (const VocBlock& block : result.blocks)
+    {
+        if (block.type == VOC_BLOCK_SOUND)
+        {
+            result.sampleFormat = block.sampleFormat;
+            result.sampleData = block.sampleData;
+            break;
+        }
+    }
 
-    VocFile result = {
-        timeConstant,
-        (uint8_t)((version >> 8) & 0xff),
-        (uint8_t)(version & 0xff),
-        (VocSampleFormat)sampleFormat,
-        sampleData};
     return result;
 }
 
-VocFile decodeToPcm(const VocFile& compressed)
+/**
+ * @brief Decodes the sample data of one sound block and appends it to output.
+ */
+void appendDecodedSamples(VocSampleFormat sampleFormat, const std::vector<uint8_t>& sampleData, std::vector<uint8_t>& output)
 {
-    VocFile result = compressed;
-    switch(compressed.sampleFormat)
+    if (sampleFormat != VocSampleFormat::VOC_FORMAT_PCM_8BIT && sampleData.empty())
+    {
+        throw std::runtime_error("ADPCM data is missing the reference byte");
+    }
+
+    // the first byte of ADPCM data is the reference byte, the payload is decoded in place from the input
+    size_t offset = output.size();
+    switch(sampleFormat)
     {
         case VocSampleFormat::VOC_FORMAT_ADPCM_2BIT:
         {
-            uint8_t initial = result.sampleData[0];
-            result.sampleData.erase(result.sampleData.begin()); 
-            result.sampleData = decodeAdpcm2(initial, result.sampleData);
-            result.sampleFormat = VocSampleFormat::VOC_FORMAT_PCM_8BIT;
+            auto payload = std::span<const uint8_t>(sampleData).subspan(1);
+            output.resize(offset + payload.size() * 4 + 1);
+            decodeAdpcm2Parallel(sampleData[0], payload, std::span<uint8_t>(output).subspan(offset));
             break;
         }
         case VocSampleFormat::VOC_FORMAT_ADPCM_4BIT:
         {
-            uint8_t initial = result.sampleData[0];
-            result.sampleData.erase(result.sampleData.begin()); 
-            result.sampleData = decodeAdpcm4(initial, result.sampleData);
-            result.sampleFormat = VocSampleFormat::VOC_FORMAT_PCM_8BIT;
+            auto payload = std::span<const uint8_t>(sampleData).subspan(1);
+            output.resize(offset + payload.size() * 2 + 1);
+            decodeAdpcm4Parallel(sampleData[0], payload, std::span<uint8_t>(output).subspan(offset));
             break;
         }
         case VocSampleFormat::VOC_FORMAT_PCM_8BIT:
         {
-            // nothing, already PCM
+            // nothing to decode, already PCM
+            output.insert(output.end(), sampleData.begin(), sampleData.end());
             break;
         }
         default:
         {
             throw std::runtime_error("Unsupported sample format");
         }
+    }
+}
+
+VocFile decodeToPcm(const VocFile& compressed)
+{
+    VocFile result = {
+        compressed.timeConstant,
+        compressed.majorVersion,
+        compressed.minorVersion,
+        VocSampleFormat::VOC_FORMAT_PCM_8BIT,
+        {},
+        {}};
+
+    if (compressed.blocks.empty())
+    {
+        appendDecodedSamples(compressed.sampleFormat, compressed.sampleData, result.sampleData);
+        return result;
+    }
+
+    auto& output = result.sampleData;
+    size_t sampleCount = vocSampleCount(compressed.blocks);
+    output.reserve(sampleCount);
+    ProgressStage progress("Decoding", sampleCount);
 
+    size_t repeatBegin = 0;
+    uint32_t repeatCount = 1;
+    for (const VocBlock& block : compressed.blocks)
+    {
+        progress.update(output.size());
+        switch (block.type)
+        {
+            case VOC_BLOCK_SOUND:
+                appendDecodedSamples(block.sampleFormat, block.sampleData, output);
+                break;
+            case VOC_BLOCK_SILENCE:
+                // silence is the zero line of unsigned 8bit samples
+                output.insert(output.end(), block.silenceLength, 128);
+                break;
+            case VOC_BLOCK_REPEAT_START:
+                repeatBegin = output.size();
+                repeatCount = std::max<uint32_t>(block.repeatCount, 1);
+                break;
+            case VOC_BLOCK_REPEAT_END:
+            {
+                // the decoded samples since the repeat start are copied, so they are decoded only once
+                size_t length = output.size() - repeatBegin;
+                for (uint32_t i = 1; i < repeatCount; ++i)
+                {
+                    size_t end = output.size();
+                    output.resize(end + length);
+                    std::copy_n(output.begin() + repeatBegin, length, output.begin() + end);
+                }
+                repeatCount = 1;
+                break;
+            }
+        }
     }
 
     return result;
 }
-
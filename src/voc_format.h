@@ -4,6 +4,8 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <functional>
+#include <span>
 
 enum VocSampleFormat
 {
@@ -13,22 +15,132 @@ enum VocSampleFormat
     VOC_FORMAT_ADPCM_2BIT = 3,
 };
 
+enum VocBlockType
+{
+    VOC_BLOCK_SOUND = 1,
+    VOC_BLOCK_SILENCE = 3,
+    VOC_BLOCK_REPEAT_START = 6,
+    VOC_BLOCK_REPEAT_END = 7,
+};
+
+/**
+ * @brief A block of a VOC file.
+ *
+ * Sound blocks contain sample data, ADPCM data starts with the reference byte.
+ * Silence blocks only contain the number of silent samples.
+ * The blocks between a repeat start and the next repeat end are played repeatCount times.
+ */
+struct VocBlock
+{
+    VocBlockType type;
+    VocSampleFormat sampleFormat;
+    std::vector<uint8_t> sampleData;
+    uint32_t silenceLength;
+    uint32_t repeatCount;       ///< 1 to 65535, 0 = endless
+};
+
+/**
+ * @brief Encodes unsigned 8bit samples into the sample data of a sound block.
+ */
+using SampleEncoder = std::function<std::vector<uint8_t>(const std::vector<uint8_t>&)>;
+
+/**
+ * @brief Encodes unsigned 8bit samples into VOC blocks.
+ */
+using BlockEncoder = std::function<std::vector<VocBlock>(const std::vector<uint8_t>&)>;
+
+VocBlock createSoundBlock(VocSampleFormat sampleFormat, std::vector<uint8_t> sampleData);
+VocBlock createSilenceBlock(uint32_t length);
+VocBlock createRepeatStartBlock(uint32_t repeatCount);
+VocBlock createRepeatEndBlock();
+
+/**
+ * @brief Encodes samples into sound blocks that decode to exactly samples.size() samples.
+ *
+ * Padding the encoder adds at the end is removed, samples it does not encode are
+ * appended as an 8bit PCM block.
+ */
+std::vector<VocBlock> createExactSoundBlocks(VocSampleFormat format, const std::vector<uint8_t>& samples, const SampleEncoder& encode);
+
+size_t vocSamplesPerByte(VocSampleFormat format);
+
+/**
+ * @brief Number of samples a sound or silence block decodes to, 0 for repeat blocks.
+ */
+size_t vocBlockSampleCount(const VocBlock& block);
+
+/**
+ * @brief Number of samples the blocks decode to, including repetitions.
+ *        Endless repeats are counted once.
+ */
+size_t vocSampleCount(const std::vector<VocBlock>& blocks);
+
 std::vector<uint8_t> createVocFile(uint32_t frequency,
                                    const std::vector<uint8_t> &sampleData,
                                    VocSampleFormat sampleFormat);
 
+/**
+ * @brief Creates a VOC file with the given blocks. Silence blocks longer than the
+ *        65536 samples a single VOC silence block can hold are split.
+ *        Repeats cannot be nested.
+ */
+std::vector<uint8_t> createVocFile(uint32_t frequency, const std::vector<VocBlock>& blocks);
+
 
 struct VocFile
 {
     uint8_t timeConstant;
     uint8_t majorVersion;
     uint8_t minorVersion;
-    VocSampleFormat sampleFormat;
-    std::vector<uint8_t> sampleData;
+    VocSampleFormat sampleFormat;       ///< format of the first sound block
+    std::vector<uint8_t> sampleData;    ///< data of the first sound block
+    std::vector<VocBlock> blocks;       ///< all sound, silence and repeat blocks, continuations are merged into their sound block. Empty if sampleData is all data.
 };
 
 uint32_t timeConstantToFrequency(uint8_t timeConstant);
+uint8_t frequencyToTimeConstant(uint32_t frequency);
+
+/**
+ * @brief Exact sample rate a VOC file created with the given frequency is played back with.
+ *
+ * The time constant is an integer, so the playback rate 1000000 / (256 - timeConstant)
+ * usually differs from the requested frequency, e.g. 43478.26 Hz instead of 44100 Hz.
+ */
+double vocPlaybackFrequency(uint32_t frequency);
 VocFile readVocFile(const std::string &filename);
+
+/**
+ * @brief Time constant and sample format of a sound block.
+ */
+struct VocSoundFormat
+{
+    uint8_t timeConstant;
+    VocSampleFormat sampleFormat;
+};
+
+/**
+ * @brief Reads the payload of an extended block (type 8), which replaces time constant and
+ *        format of the next sound block (type 1). Throws for stereo sound data.
+ */
+VocSoundFormat readVocExtendedBlock(std::span<const uint8_t> payload);
+
+/**
+ * @brief Size of the header of a sound block type 9, the sample data follows it.
+ */
+constexpr size_t vocSoundBlock9HeaderSize = 12;
+
+/**
+ * @brief Reads the header of a sound block type 9 with sample rate, bits per sample,
+ *        channels and codec. Throws for anything but mono 8bit PCM, 4bit and 2bit ADPCM.
+ */
+VocSoundFormat readVocSoundBlock9Header(std::span<const uint8_t> payload);
+
+/**
+ * @brief Decodes all blocks into a single 8bit PCM sound block.
+ *
+ * Silence blocks and repeats are expanded, endless repeats are played once.
+ * If blocks is empty, sampleData is decoded.
+ */
 VocFile decodeToPcm(const VocFile& compressed);
 
 
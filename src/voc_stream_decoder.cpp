@@ -0,0 +1,299 @@
+#include "voc_stream_decoder.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <string>
+
+AdpcmStreamDecoder::AdpcmStreamDecoder() :
+    m_format(VOC_FORMAT_PCM_8BIT),
+    m_symbolsPerByte(1),
+    m_expectReferenceByte(false),
+    m_decoder4(128),
+    m_decoder2(128),
+    m_pendingByte(0),
+    m_pendingIndex(1)
+{
+}
+
+void AdpcmStreamDecoder::startBlock(VocSampleFormat format, bool hasReferenceByte)
+{
+    switch (format)
+    {
+        case VOC_FORMAT_PCM_8BIT:
+            m_symbolsPerByte = 1;
+            hasReferenceByte = false;
+            break;
+        case VOC_FORMAT_ADPCM_4BIT:
+            m_symbolsPerByte = 2;
+            break;
+        case VOC_FORMAT_ADPCM_2BIT:
+            m_symbolsPerByte = 4;
+            break;
+        default:
+            throw std::runtime_error("Unsupported sample format");
+    }
+
+    if (!hasReferenceByte && format != m_format && format != VOC_FORMAT_PCM_8BIT)
+    {
+        throw std::runtime_error("ADPCM continuation block does not match previous format");
+    }
+
+    m_format = format;
+    m_expectReferenceByte = hasReferenceByte;
+    m_pendingIndex = m_symbolsPerByte;
+}
+
+uint8_t AdpcmStreamDecoder::decodeSymbol(uint8_t byte, uint8_t index)
+{
+    switch (m_format)
+    {
+        case VOC_FORMAT_ADPCM_4BIT:
+            return m_decoder4.decodeNibble((byte >> (4 - 4 * index)) & 0x0f);
+        case VOC_FORMAT_ADPCM_2BIT:
+            return m_decoder2.decode2bits((byte >> (6 - 2 * index)) & 0x03);
+        default:
+            return byte;
+    }
+}
+
+size_t AdpcmStreamDecoder::decode(std::span<const uint8_t>& input, std::span<uint8_t> output)
+{
+    size_t written = 0;
+
+    // finish a byte that was partly decoded by the previous call
+    while (m_pendingIndex < m_symbolsPerByte && written < output.size())
+    {
+        output[written++] = decodeSymbol(m_pendingByte, m_pendingIndex++);
+    }
+
+    if (m_expectReferenceByte && written < output.size() && !input.empty())
+    {
+        uint8_t reference = input.front();
+        input = input.subspan(1);
+        m_decoder4 = CreativeAdpcmDecoder4Bit(reference);
+        m_decoder2 = CreativeAdpcmDecoder2Bit(reference);
+        m_expectReferenceByte = false;
+        output[written++] = reference;
+    }
+
+    // whole bytes
+    size_t wholeBytes = std::min(input.size(), (output.size() - written) / m_symbolsPerByte);
+    uint8_t* out = output.data() + written;
+    switch (m_format)
+    {
+        case VOC_FORMAT_ADPCM_4BIT:
+            for (size_t i = 0; i < wholeBytes; ++i)
+            {
+                *out++ = m_decoder4.decodeNibble(input[i] >> 4);
+                *out++ = m_decoder4.decodeNibble(input[i] & 0x0f);
+            }
+            break;
+        case VOC_FORMAT_ADPCM_2BIT:
+            for (size_t i = 0; i < wholeBytes; ++i)
+            {
+                *out++ = m_decoder2.decode2bits((input[i] >> 6) & 0x03);
+                *out++ = m_decoder2.decode2bits((input[i] >> 4) & 0x03);
+                *out++ = m_decoder2.decode2bits((input[i] >> 2) & 0x03);
+                *out++ = m_decoder2.decode2bits((input[i] >> 0) & 0x03);
+            }
+            break;
+        default:
+            std::copy(input.begin(), input.begin() + wholeBytes, out);
+            break;
+    }
+    written += wholeBytes * m_symbolsPerByte;
+    input = input.subspan(wholeBytes);
+
+    // start a byte whose samples do not fit completely
+    if (written < output.size() && !input.empty())
+    {
+        m_pendingByte = input.front();
+        input = input.subspan(1);
+        m_pendingIndex = 0;
+        while (written < output.size())
+        {
+            output[written++] = decodeSymbol(m_pendingByte, m_pendingIndex++);
+        }
+    }
+
+    return written;
+}
+
+
+VocStreamDecoder::VocStreamDecoder(std::span<const uint8_t> vocData) :
+    m_data(vocData)
+{
+    const char vocHeader[] = "Creative Voice File\x1a";
+    const size_t vocHeaderSize = sizeof(vocHeader) - 1;
+    if (m_data.size() < vocHeaderSize + 6 || memcmp(m_data.data(), vocHeader, vocHeaderSize) != 0)
+    {
+        throw std::runtime_error("Invalid VOC file. Header does not match.");
+    }
+
+    uint16_t headerSize = m_data[20] | (m_data[21] << 8);
+    uint16_t version = m_data[22] | (m_data[23] << 8);
+    uint16_t versionCheck = m_data[24] | (m_data[25] << 8);
+    if ((uint16_t)(~version + 0x1234) != versionCheck)
+    {
+        throw std::runtime_error("Invalid VOC file. Version check failed.");
+    }
+
+    m_firstBlock = headerSize;
+    rewind();
+}
+
+void VocStreamDecoder::rewind()
+{
+    m_position = m_firstBlock;
+    m_block = {};
+    m_silenceRemaining = 0;
+    m_repeatPosition = 0;
+    m_repeatsRemaining = 0;
+    m_inRepeat = false;
+    m_repeatSamples = 0;
+    m_timeConstant = 0;
+    m_extended.reset();
+    m_finished = false;
+    m_decoder = AdpcmStreamDecoder();
+}
+
+void VocStreamDecoder::nextBlock()
+{
+    while (!m_finished)
+    {
+        if (m_position >= m_data.size() || m_data[m_position] == 0)
+        {
+            // terminator block, files without terminator end at the end of the data
+            m_finished = true;
+            return;
+        }
+
+        if (m_position + 4 > m_data.size())
+        {
+            throw std::runtime_error("Invalid VOC file. Truncated block header.");
+        }
+
+        uint8_t type = m_data[m_position];
+        uint32_t size = m_data[m_position + 1] | (m_data[m_position + 2] << 8) | (m_data[m_position + 3] << 16);
+        if (m_position + 4 + size > m_data.size())
+        {
+            throw std::runtime_error("Invalid VOC file. Truncated block.");
+        }
+        auto payload = m_data.subspan(m_position + 4, size);
+        m_position += 4 + size;
+
+        switch (type)
+        {
+            case 1: // sound data
+            {
+                if (size < 2)
+                {
+                    throw std::runtime_error("Invalid VOC file. Sound block too small.");
+                }
+                m_timeConstant = m_extended ? m_extended->timeConstant : payload[0];
+                m_decoder.startBlock(m_extended ? m_extended->sampleFormat : static_cast<VocSampleFormat>(payload[1]), true);
+                m_extended.reset();
+                m_block = payload.subspan(2);
+                return;
+            }
+            case 2: // sound continuation, uses format and decoder state of the previous block
+            {
+                m_decoder.startBlock(m_decoder.sampleFormat(), false);
+                m_block = payload;
+                return;
+            }
+            case 3: // silence
+            {
+                if (size < 3)
+                {
+                    throw std::runtime_error("Invalid VOC file. Silence block too small.");
+                }
+                m_silenceRemaining = (payload[0] | (payload[1] << 8)) + 1;
+                m_timeConstant = payload[2];
+                return;
+            }
+            case 6: // repeat start
+            {
+                if (size < 2)
+                {
+                    throw std::runtime_error("Invalid VOC file. Repeat block too small.");
+                }
+                m_repeatPosition = m_position;
+                m_repeatsRemaining = payload[0] | (payload[1] << 8);
+                m_inRepeat = true;
+                m_repeatSamples = 0;
+                break;
+            }
+            case 7: // repeat end
+            {
+                if (m_inRepeat && m_repeatsRemaining > 0 && m_repeatSamples > 0)
+                {
+                    if (m_repeatsRemaining != 0xffff)
+                    {
+                        --m_repeatsRemaining;
+                    }
+                    m_position = m_repeatPosition;
+                }
+                else
+                {
+                    m_inRepeat = false;
+                }
+                break;
+            }
+            case 4: // marker
+            case 5: // text
+            {
+                break;
+            }
+            case 8: // extended, replaces time constant and format of the next sound block
+            {
+                m_extended = readVocExtendedBlock(payload);
+                break;
+            }
+            case 9: // sound data with sample rate, bits per sample, channels and codec
+            {
+                auto soundFormat = readVocSoundBlock9Header(payload);
+                m_timeConstant = soundFormat.timeConstant;
+                m_decoder.startBlock(soundFormat.sampleFormat, true);
+                m_block = payload.subspan(vocSoundBlock9HeaderSize);
+                return;
+            }
+            default:
+            {
+                throw std::runtime_error("Unsupported VOC block type " + std::to_string(type));
+            }
+        }
+    }
+}
+
+size_t VocStreamDecoder::decode(std::span<uint8_t> output)
+{
+    size_t written = 0;
+    while (written < output.size())
+    {
+        if (m_silenceRemaining > 0)
+        {
+            size_t count = std::min<size_t>(m_silenceRemaining, output.size() - written);
+            std::fill_n(output.begin() + written, count, 128);
+            m_silenceRemaining -= static_cast<uint32_t>(count);
+            written += count;
+            m_repeatSamples += count;
+            continue;
+        }
+
+        size_t count = m_decoder.decode(m_block, output.subspan(written));
+        written += count;
+        m_repeatSamples += count;
+
+        if (count == 0)
+        {
+            if (m_finished)
+            {
+                break;
+            }
+            nextBlock();
+        }
+    }
+    return written;
+}
@@ -0,0 +1,116 @@
+#ifndef VOC_STREAM_DECODER_H
+#define VOC_STREAM_DECODER_H
+
+#include "voc_format.h"
+#include "decode_creative_adpcm.h"
+
+#include <cstdint>
+#include <span>
+#include <optional>
+
+/**
+ * @brief Resumable decoder for the sample data of a single VOC sound block.
+ *
+ * Decodes 8bit PCM, 4bit ADPCM and 2bit ADPCM data into unsigned 8bit samples.
+ * The decoder never allocates memory, so it can be used in a realtime audio thread.
+ * A byte whose samples did not fit into the output buffer is remembered, the
+ * remaining samples are returned by the next call to decode().
+ */
+class AdpcmStreamDecoder
+{
+public:
+    AdpcmStreamDecoder();
+
+    /**
+     * @brief Prepares decoding of a new block.
+     *
+     * @param format The sample format of the block.
+     * @param hasReferenceByte If true the first byte of the block is the ADPCM reference byte,
+     *                         as in VOC block type 1. If false the decoder state of the
+     *                         previous block is kept, as in VOC block type 2.
+     */
+    void startBlock(VocSampleFormat format, bool hasReferenceByte);
+
+    /**
+     * @brief Decodes up to output.size() samples.
+     *
+     * The consumed bytes are removed from the front of input.
+     *
+     * @return The number of samples written to output. Is 0 if input is empty and
+     *         no samples of a previous byte are left.
+     */
+    size_t decode(std::span<const uint8_t>& input, std::span<uint8_t> output);
+
+    VocSampleFormat sampleFormat() const { return m_format; }
+
+private:
+    uint8_t decodeSymbol(uint8_t byte, uint8_t index);
+
+    VocSampleFormat m_format;
+    uint8_t m_symbolsPerByte;
+    bool m_expectReferenceByte;
+    CreativeAdpcmDecoder4Bit m_decoder4;
+    CreativeAdpcmDecoder2Bit m_decoder2;
+    uint8_t m_pendingByte;
+    uint8_t m_pendingIndex;     // index of the next symbol of m_pendingByte, m_symbolsPerByte if none is left
+};
+
+
+/**
+ * @brief Resumable decoder for a complete VOC file in memory.
+ *
+ * The decoder walks the blocks of the file while decoding, so sound blocks with
+ * different formats, continuation blocks, silence blocks and repeats are handled
+ * transparently. Endless repeats are played until rewind() is called. Blocks are
+ * validated like in readVocFile(), unknown block types throw std::runtime_error.
+ * Decoding never allocates memory and the work per call is bounded by the size of the
+ * output buffer, so the decoder can be used in a fixed size audio callback.
+ */
+class VocStreamDecoder
+{
+public:
+    /**
+     * @param vocData The complete VOC file. The data is not copied and must stay valid
+     *                while the decoder is used.
+     */
+    explicit VocStreamDecoder(std::span<const uint8_t> vocData);
+
+    /**
+     * @brief Decodes up to output.size() unsigned 8bit samples.
+     *
+     * @return The number of samples written. Less than output.size() samples are only
+     *         returned at the end of the file.
+     */
+    size_t decode(std::span<uint8_t> output);
+
+    /**
+     * @brief Restarts decoding at the first block.
+     */
+    void rewind();
+
+    bool finished() const { return m_finished; }
+
+    /**
+     * @brief Time constant of the block that is currently decoded.
+     */
+    uint8_t timeConstant() const { return m_timeConstant; }
+
+private:
+    void nextBlock();
+
+    std::span<const uint8_t> m_data;
+    size_t m_firstBlock;
+    size_t m_position;                  // position of the next block header
+    std::span<const uint8_t> m_block;   // not yet decoded sample data of the current block
+    uint32_t m_silenceRemaining;
+    size_t m_repeatPosition;            // position of the first block after the repeat start
+    uint32_t m_repeatsRemaining;        // times the repeat is played again, 0xffff is endless
+    bool m_inRepeat;
+    size_t m_repeatSamples;             // samples written since the repeat start, empty repeats are not looped
+    uint8_t m_timeConstant;
+    std::optional<VocSoundFormat> m_extended;     // from an extended block, for the next sound block
+    bool m_finished;
+    AdpcmStreamDecoder m_decoder;
+};
+
+#endif
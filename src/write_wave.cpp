@@ -1,4 +1,5 @@
 #include "write_wave.h"
+#include "file_tools.h"
 
 #include <cstdio>
 #include <stdexcept>
@@ -19,7 +20,8 @@ void write8bitMonoWaveFile(const std::string& filename, uint32_t sampleRate, con
     header.byteRate = header.sampleRate * header.numChannels * header.bytesPerSample;
     header.chunkSize = static_cast<uint32_t>(data.size() + sizeof(WaveFileHeader));
     
-    FILE* file = fopen(filename.c_str(), "wb");
+    auto output = openFile(filename, "wb");
+    FILE* file = output.get();
     if (!file)
     {
         throw std::runtime_error("Could not open file for writing");
@@ -32,6 +34,5 @@ void write8bitMonoWaveFile(const std::string& filename, uint32_t sampleRate, con
     fwrite(&subChunk2Size, 4, 1, file);
 
     fwrite(data.data(), 1, data.size(), file);
-    fclose(file);
 }
 